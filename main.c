@@ -8,20 +8,78 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <termios.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#if defined(__SSE2__) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 /*** defines ***/
 
 #define EDITOR_VERSION "0.0.1"
+#define EDITOR_NAME "simple-text-editor"
 #define EDITOR_TAB_STOP 8
 #define EDITOR_QUIT_TIMES 3
+#define EDITOR_ROW_CACHE 256
+#define EDITOR_ROW_CACHE_BYTES (8 << 20)
+#define EDITOR_SYNTAX_BATCH 20000
+#define EDITOR_SYNTAX_CHUNK 16384
+#define EDITOR_PARALLEL_SCAN (64 << 20)
+#define EDITOR_SCAN_THREADS 8
+#define EDITOR_RUN_GAP 8
+#define EDITOR_SEARCH_BATCH (1 << 20)
+#define EDITOR_SEARCH_CHUNK (4 << 20)
+#define EDITOR_SEARCH_WAIT 20
+#define EDITOR_BMH_MIN 32
+#define EDITOR_DFA_STATES 1024
+#define EDITOR_SAVE_INPLACE 4
+#define EDITOR_SLAB_CLASSES 13
+#define EDITOR_SLAB_BYTES (256 << 10)
+#define EDITOR_LONG_LINE (64 << 10)
+#define EDITOR_LONG_SEGMENT 4096
+#ifndef EDITOR_UNDO_BYTES
+#define EDITOR_UNDO_BYTES (16 << 20)
+#endif
+#define EDITOR_PASTE_CHUNK (64 << 10)
+#define EDITOR_PASTE_WAIT 10
+#define EDITOR_INPUT_CHUNK 4096
+#define EDITOR_KEY_RING 256 // a power of two, so the indices can wrap
+#ifndef EDITOR_MAX_FPS
+#define EDITOR_MAX_FPS 60
+#endif
+#define EDITOR_STATUS_SECONDS 5
+#define EDITOR_LOAD_ASYNC (16 << 20)
+#define EDITOR_LOAD_FIRST (64 << 10)
+#define EDITOR_LOAD_CHUNK (4 << 20)
+#define EDITOR_FOLLOW_CHUNK (1 << 20)
+#define EDITOR_FOLLOW_POLL 1000
+#define EDITOR_KW_BUCKET 16          // the most keywords a bucket of a keyword table takes
+#define EDITOR_KW_DISPLACEMENTS 4096 // the displacements tried for a bucket
 
 // ctrl-key macro to bitwise-AND the key with 0x1f (00011111) to get the ASCII value of the ctrl-key
 #define CTRL_KEY(k) ((k) & 0x1f)
@@ -44,6 +102,8 @@ enum editorKey
     END_KEY,     // 1006
     PAGE_UP,     // 1007
     PAGE_DOWN,   // 1008
+    SEARCH_MORE, // 1009, not a key: new search results came in
+    PASTE_KEY,   // 1010, a bracketed paste, whose text is in E.input.paste
 };
 
 /**
@@ -83,8 +143,76 @@ enum editorHighlight
  */
 #define HL_HIGHLIGHT_STRINGS (1 << 1)
 
+/**
+ * The classes of the bytes of a syntax, looked up in its cls table by the lexer.
+ * HL_CLASS_SEPARATOR bytes end a word: whitespace, NUL, the characters of
+ * EDITOR_SEPARATORS and those the syntax adds. HL_CLASS_DIGIT bytes start a number,
+ * HL_CLASS_QUOTE bytes start and end a string, and HL_CLASS_DELIM bytes may start a
+ * comment.
+ */
+#define HL_CLASS_SEPARATOR (1 << 0)
+#define HL_CLASS_DIGIT (1 << 1)
+#define HL_CLASS_QUOTE (1 << 2)
+#define HL_CLASS_DELIM (1 << 3)
+#define EDITOR_SEPARATORS ",.()+-/*=~%<>[];"
+
+/**
+ * Where the syntax definition files are read from, before those of the user in
+ * $XDG_CONFIG_HOME/simple-text-editor/syntax. The Makefile sets it to the directory
+ * make install copies them to, or to the syntax directory of the source tree for a
+ * build run from there.
+ */
+#ifndef EDITOR_SYNTAX_DIR
+#define EDITOR_SYNTAX_DIR "/usr/local/share/" EDITOR_NAME "/syntax"
+#endif
+
+/**
+ * The first bytes of the cache of the compiled syntax definitions, changed with
+ * the layout of struct syntaxImage.
+ */
+#define EDITOR_SYNTAX_MAGIC "STESYN03"
+
+/**
+ * Files from EDITOR_INDEX_CACHE bytes on get their newline index and highlighting
+ * checkpoints cached in $XDG_CACHE_HOME/simple-text-editor/index, to be mapped back
+ * when they are opened again; 0 turns the cache off. A file that grew is taken as
+ * appended to when its EDITOR_INDEX_TAIL bytes before the old end are unchanged.
+ * EDITOR_INDEX_MAGIC changes with the layout of struct indexCacheHeader.
+ */
+#ifndef EDITOR_INDEX_CACHE
+#define EDITOR_INDEX_CACHE (64 << 20)
+#endif
+#define EDITOR_INDEX_TAIL 4096
+#define EDITOR_INDEX_MAGIC "STEIDX02"
+
+/**
+ * @brief Flags of the per-row highlighting checkpoints kept in E.buf->hlstate.
+ *
+ * HL_STATE_COMMENT is set when the row ends inside a multi-line comment.
+ * HL_STATE_STALE is set when the row has to be lexed again, because its text or the
+ * state it starts in changed since its checkpoint was stored.
+ */
+#define HL_STATE_COMMENT (1 << 0)
+#define HL_STATE_STALE (1 << 7)
+
+/**
+ * @brief Flag of a screen cell attribute: the cell is drawn in inverse video.
+ *
+ * The other bits of the attribute hold the editorHighlight giving the colour of the cell.
+ */
+#define CELL_INVERSE (1 << 7)
+
 /*** data ***/
 
+struct editorSyntax;
+
+/**
+ * @brief A skipper of the runs of bytes that leave the lexer state as it is, returning
+ * the index of the first byte from i that ends the run of chars, or end. With sep set
+ * the run is made of separators, otherwise it is the rest of a word.
+ */
+typedef int (*hlSkipFn)(const struct editorSyntax *s, const char *chars, int i, int end, int sep);
+
 /**
  * @struct editorSyntax
  * Represents the syntax configuration for a specific file type in the text editor.
@@ -98,6 +226,86 @@ struct editorSyntax
     char *multiline_comment_start;  /**< The start of a multi-line comment. */
     char *multiline_comment_end;    /**< The end of a multi-line comment. */
     int flags;                      /**< Flags for syntax highlighting. */
+    struct keywordTable *kwtable;   /**< The keywords compiled by kwCompile. */
+    char *separators;               /**< The characters ending a word besides EDITOR_SEPARATORS, or NULL. */
+    char *quotes;                   /**< The characters starting a string, or NULL for " and '. */
+    unsigned char cls[256];         /**< The class of every byte, see HL_CLASS_SEPARATOR. */
+    unsigned char runs[2][16];      /**< The nibble tables of the bytes ending a word and of the separators a run goes on with. */
+    hlSkipFn skip;                  /**< The skipper for the runs, or NULL to lex every byte. */
+};
+
+/**
+ * @struct keywordEntry
+ * @brief A slot of a compiled keyword table.
+ */
+struct keywordEntry
+{
+    const char *word;  /**< The keyword, without its '|' suffix, or NULL for an empty slot. */
+    int len;           /**< The length of the keyword. */
+    unsigned char hl;  /**< The highlight of the keyword, HL_KEYWORD1 or HL_KEYWORD2. */
+};
+
+/**
+ * @struct keywordTable
+ * @brief The keywords of a syntax compiled into a perfect hash.
+ *
+ * The hash of an identifier picks a bucket, and the displacement of the bucket mixed
+ * into the hash picks the slot. The displacements are chosen so that no two keywords
+ * share a slot, so a lookup hashes the identifier once and compares it against a
+ * single entry, while the table only has a few more slots than keywords.
+ */
+struct keywordTable
+{
+    struct keywordEntry *slots; /**< The slots, a power of two of them. */
+    unsigned int mask;          /**< The number of slots minus one. */
+    unsigned int *disp;         /**< The displacement of every bucket, a power of two of them. */
+    unsigned int bmask;         /**< The number of buckets minus one. */
+    unsigned int seed;          /**< The seed of the hash of the identifiers. */
+    int maxlen;                 /**< The length of the longest keyword. */
+};
+
+/**
+ * @struct syntaxMatch
+ * @brief A slot of the table of the file extensions the syntaxes match.
+ */
+struct syntaxMatch
+{
+    const char *ext; /**< The extension, with its dot, or NULL for an empty slot. */
+    int lang;        /**< The index in E.langs of the first syntax matching it. */
+};
+
+/**
+ * @struct hlSpan
+ * @brief A run of rendered columns that share a highlight other than HL_NORMAL.
+ */
+struct hlSpan
+{
+    int start;        ///< The first column of the run.
+    int len;          ///< The number of columns.
+    unsigned char hl; ///< The highlight of the columns.
+};
+
+/**
+ * @struct hlLexState
+ * @brief Where the lexer is in a row, and what it carries from one character to the next.
+ */
+struct hlLexState
+{
+    int cx;                ///< The index of the next character to lex.
+    unsigned char comment; ///< Set inside a multi-line comment.
+    char string;           ///< The quote of the string the lexer is in, 0 outside strings.
+    unsigned char sep;     ///< Set when the previous character is a separator.
+    unsigned char prev;    ///< The highlight of the previous character.
+};
+
+/**
+ * @struct rowTab
+ * @brief Where a tab of a row is, in characters and in rendered columns.
+ */
+struct rowTab
+{
+    int cx; ///< The index of the tab in chars.
+    int rx; ///< The render column where the tab starts.
 };
 
 /**
@@ -106,27 +314,344 @@ struct editorSyntax
  *
  * This struct contains information about the size of the row, the rendered size,
  * and pointers to the character array and the rendered version of the row.
+ * A row without tabs renders as its own text, so render then points to chars.
+ * Its highlighting is kept as the runs of columns that are not HL_NORMAL, in order.
+ * A row longer than EDITOR_LONG_LINE is only rendered and highlighted across the
+ * segments of EDITOR_LONG_SEGMENT columns in view, lexing from the closest of the
+ * states it keeps along the row.
  */
 typedef struct editorRow
 {
-    int idx;             ///< The index of the row.
-    int size;            ///< The size of the row.
-    int rsize;           ///< The rendered size of the row.
-    char *chars;         ///< Pointer to the character array of the row.
-    char *render;        ///< Pointer to the rendered version of the row.
-    unsigned char *hl;   ///< Pointer to the syntax highlighting array.
-    int hl_open_comment; ///< Flag to indicate if the row has an open comment.
+    int idx;           ///< The index of the row, or -1 for an unused cache slot.
+    int size;          ///< The size of the row.
+    int rsize;         ///< The rendered size of the row.
+    char *chars;       ///< Pointer to the character array of the row.
+    char *render;      ///< Pointer to the rendered version of the row, not NUL-terminated.
+    int rstart;        ///< The render column of render[0].
+    int wa, wb;        ///< The render columns a long row was rendered for.
+    int hla, hlb;      ///< The characters the spans were computed for.
+    struct hlSpan *spans; ///< The highlighted runs of the row.
+    int nspans;        ///< The number of runs.
+    size_t charscap;   ///< The capacity of chars, 0 while it is borrowed.
+    size_t rendercap;  ///< The capacity of render, 0 while it points to chars.
+    size_t spanscap;   ///< The capacity of spans, in bytes.
+    struct rowTab *tabs; ///< The tabs of the row, in order, valid while tabsvalid is set.
+    int ntabs;         ///< The number of tabs.
+    int tabsvalid;     ///< Set when tabs matches chars.
+    size_t tabscap;    ///< The capacity of tabs, in bytes.
+    struct hlLexState *marks; ///< Lexer states along a long row, in order, valid with tabs.
+    int nmarks;        ///< The number of marks.
+    int ntrusted;      ///< The number of marks before the text that changed since they were taken.
+    size_t markscap;   ///< The capacity of marks, in bytes.
+    int hlpending;     ///< Set when the state a long row leaves open has to be checked again.
+    unsigned char hlout; ///< The multi-line comment state a long row leaves open.
+    unsigned long lru; ///< Row cache clock value of the last access.
+    int borrowed;      ///< Set when chars points into the original buffer, which is not NUL-terminated.
+    int dirty;         ///< Set when render and spans have to be computed again.
+    int hlin;          ///< The multi-line comment state the row was highlighted with, -1 when drawn plain.
+    size_t bytes;      ///< The memory accounted to the row cache for the row.
 } erow;
 
 /**
- * @struct editorConfig
- * @brief Represents the configuration of the text editor.
+ * @brief Identifies the buffer a piece of text points into.
+ */
+enum pieceBuffer
+{
+    PT_ORIGINAL = 0, /**< The read-only contents of the opened file */
+    PT_ADD           /**< The append-only buffer holding every inserted text */
+};
+
+/**
+ * @struct pieceNode
+ * @brief A piece of the text buffer, stored as a node of a treap.
  *
- * The editorConfig struct stores various properties and settings related to the text editor.
- * It includes information about the cursor position, screen dimensions, number of rows, modified status,
- * filename, status message, and terminal settings.
+ * Each node describes a run of bytes of one of the piece table buffers. The
+ * in-order traversal of the tree gives the text of the document, and every node
+ * keeps the byte and newline totals of its subtree so that offsets and line
+ * numbers can be resolved in O(log pieces).
  */
-struct editorConfig
+typedef struct pieceNode
+{
+    struct pieceNode *left;  ///< Pieces before this one.
+    struct pieceNode *right; ///< Pieces after this one.
+    unsigned int prio;       ///< Random treap priority, higher is closer to the root.
+    int buf;                 ///< The buffer the piece points into.
+    size_t start;            ///< Offset of the piece in its buffer.
+    size_t len;              ///< Length of the piece in bytes.
+    size_t lf;               ///< Number of newlines in the piece.
+    size_t sublen;           ///< Total length of the subtree in bytes.
+    size_t sublf;            ///< Total number of newlines in the subtree.
+} pnode;
+
+/**
+ * @struct pieceTable
+ * @brief Text storage made of an original read-only buffer and an append-only add buffer.
+ *
+ * Both buffers keep a sorted index of the offsets of their newlines, which is
+ * what lets a piece count and locate its lines without looking at the text.
+ * The document always ends with a newline: every row is stored followed by '\n'.
+ * The original buffer is never written, so the piece tables of a file opened twice
+ * can share it and its index, each making its own edits in its own add buffer.
+ */
+struct pieceTable
+{
+    char *buf[2];       ///< The original and the add buffers.
+    size_t len[2];      ///< The lengths of the buffers.
+    size_t addcap;      ///< The capacity of the add buffer.
+    size_t *nl[2];      ///< Offsets of the newlines of each buffer.
+    size_t nlcount[2];  ///< Number of newlines of each buffer.
+    size_t nlcap;       ///< The capacity of the add buffer newline index.
+    pnode *root;        ///< Root of the piece tree.
+    unsigned int seed;  ///< State of the priority generator.
+    int mapped;         ///< Set when the original buffer is a read-only mapping of the file.
+    int cr;             ///< Set when the original buffer may hold carriage returns to cut out.
+    int *shared;        ///< The number of piece tables sharing the original buffer and its index, NULL while unshared.
+    char *nlmap;        ///< The mapping the original buffer newline index is read from, NULL when it is allocated.
+    size_t nlmaplen;    ///< The length of that mapping.
+    unsigned long version; ///< Bumped by every change of the document, never reset.
+    int pinned;         ///< The number of snapshots pointing into the buffers, which must not move meanwhile.
+    char **retired;     ///< The add buffers outgrown while pinned, freed once the last snapshot is gone.
+    int nretired;       ///< The number of retired buffers.
+};
+
+/**
+ * @struct rowArena
+ * @brief Slabs of row buffers of a few size classes, from 16 bytes to 64 KiB
+ * doubling at each class, with a free list each. Larger buffers are malloc'ed.
+ */
+struct rowArena
+{
+    char *free[EDITOR_SLAB_CLASSES]; ///< The free buffers of each class, linked through their first bytes.
+    char **blocks;                   ///< The blocks the slabs were cut from.
+    int nblocks;                     ///< The number of blocks.
+    int blockcap;                    ///< The capacity of blocks.
+};
+
+/**
+ * @struct pieceExtent
+ * @brief A range of the document and the bytes of a buffer it holds.
+ */
+struct pieceExtent
+{
+    size_t off;   ///< The offset of the range in the document.
+    size_t len;   ///< The length of the range.
+    int buf;      ///< The buffer holding its bytes.
+    size_t start; ///< The offset of its bytes in the buffer.
+};
+
+/**
+ * @struct editorDisk
+ * @brief What the file on disk is known to hold, as the buffer bytes found in each
+ * of its ranges, which is what lets a save write only the ranges that changed.
+ */
+struct editorDisk
+{
+    int valid;               ///< Set while the file is known to hold ext.
+    int mapped;              ///< Set while the original buffer maps this very file, so writing it changes the buffer.
+    struct pieceExtent *ext; ///< The ranges of the file, in order.
+    int count;               ///< The number of ranges.
+    size_t size;             ///< The length of the file.
+    dev_t dev;               ///< The device of the file, to notice it was replaced.
+    ino_t ino;               ///< The inode of the file.
+    struct timespec mtime;   ///< The last change of the file, to notice it was written by someone else.
+};
+
+/**
+ * @struct editorLoad
+ * @brief The background indexing of the file being opened. The document holds the
+ * lines indexed so far, and takes the next ones as the loader finds them.
+ */
+struct editorLoad
+{
+    int active;            ///< Set until the whole file is in the document.
+    pthread_t thread;      ///< The loader.
+    pthread_mutex_t lock;  ///< Guards the fields the loader writes.
+    pthread_cond_t cond;   ///< Signaled by the loader at every chunk.
+    const char *buf;       ///< The mapping of the file.
+    size_t len;            ///< The length of the file.
+    size_t *nl;            ///< The newlines found since the document last took them, under lock.
+    size_t count;          ///< The number of entries of nl, under lock.
+    size_t cap;            ///< The capacity of nl.
+    size_t scanned;        ///< The bytes scanned by the loader, under lock.
+    int cr;                ///< Set once a carriage return was found, under lock.
+    int done;              ///< Set when the loader is finished, under lock.
+    int cancel;            ///< Set to stop the loader.
+    size_t loaded;         ///< The bytes of the file in the document.
+    size_t nlcap;          ///< The capacity of the newline index of the original buffer.
+};
+
+/**
+ * @struct editorFollow
+ * @brief The file followed in follow mode, whose growth is appended to the document.
+ */
+struct editorFollow
+{
+    int on;         ///< Set in follow mode.
+    int fd;         ///< The file followed, or -1.
+    int notify;     ///< The inotify instance, or -1 when the file is polled.
+    int wd;         ///< The inotify watch of the file.
+    size_t size;    ///< The bytes of the file in the document.
+    int partial;    ///< Set when those bytes don't end with a newline, which the document then adds.
+    dev_t dev;      ///< The device of the file, to notice it was rotated.
+    ino_t ino;      ///< The inode of the file.
+    double next;    ///< When the file is polled next, without inotify.
+};
+
+/**
+ * @struct screenCells
+ * @brief The cells of the terminal screen, row after row, as parallel arrays of
+ * glyphs and of the attributes they are drawn with.
+ */
+struct screenCells
+{
+    char *ch;            ///< The byte shown in each cell.
+    unsigned char *attr; ///< The editorHighlight of each cell, optionally with CELL_INVERSE.
+};
+
+/**
+ * @struct searchList
+ * @brief The sorted offsets of the matches of a query in the document.
+ *
+ * The document is scanned EDITOR_SEARCH_BATCH matches at a time, so a list can
+ * cover only the start of the document; it holds every match starting before
+ * `scanned`, which is the length of the document once the list is complete.
+ */
+struct searchList
+{
+    size_t *pos;     ///< The offsets of the matches.
+    size_t len;      ///< The number of matches.
+    size_t cap;      ///< The capacity of pos.
+    size_t scanned;  ///< Every match starting before this offset is in pos.
+    int querylen;    ///< The length of the query prefix the list is for.
+    struct searchJob *job; ///< The background scan extending the list, if one is running.
+    int paused;      ///< Set when the last scan stopped at its limit of matches.
+};
+
+/**
+ * @struct searchEngine
+ * @brief The match lists of the current search, one for each prefix of the query
+ * that was typed, so extending the query narrows the deepest list and erasing
+ * the end of the query goes back to a list already built.
+ */
+struct searchEngine
+{
+    char *query;               ///< The query the deepest list is for.
+    struct searchList *lists;  ///< The lists, for growing prefixes of the query.
+    int depth;                 ///< The number of lists.
+    int cap;                   ///< The capacity of lists.
+    unsigned long version;     ///< The version of the piece table the lists were built on.
+    int active;                ///< Set while the search prompt is open, which is when scans may run.
+    int regex;                 ///< Set when the query is a regular expression.
+    struct regex *re;          ///< The compiled query of a regular expression search.
+    struct regexMatcher *matcher; ///< The DFAs of the main thread for re.
+    const char *reerror;       ///< Why the query does not compile, NULL when it does.
+    int matchline;             ///< The row of the match highlighted in the view.
+    int matchrx;               ///< The render column where the highlighted match starts.
+    int matchlen;              ///< The number of columns of the highlighted match, 0 for none.
+};
+
+/**
+ * @struct editorInput
+ * @brief The bytes read from the terminal ahead of the keys decoded so far, the keys
+ * decoded ahead of the editor, and the text of the last bracketed paste.
+ */
+struct editorInput
+{
+    char *buf;       ///< The bytes of the last read, or those past the end of the last paste.
+    size_t len;      ///< The number of bytes in buf.
+    size_t pos;      ///< The index of the next byte of buf to decode.
+    size_t cap;      ///< The capacity of buf.
+    char *paste;     ///< The text of the last paste, without its markers.
+    size_t pastelen; ///< The length of the text.
+    size_t pastecap; ///< The capacity of paste.
+    int keys[EDITOR_KEY_RING]; ///< The ring of decoded keys not yet handled.
+    unsigned int keyhead;      ///< The count of keys taken from the ring.
+    unsigned int keytail;      ///< The count of keys put in the ring.
+};
+
+/**
+ * @struct editorEvents
+ * @brief What the editor waits on besides the terminal input.
+ */
+struct editorEvents
+{
+    int winch[2];     ///< The self-pipe written to by the SIGWINCH handler.
+    int wake[2];      ///< The pipe written to by workers that have results.
+    int woken;        ///< Set when workers wrote, until their results are taken.
+    long pagesize;    ///< The size of a page, for the SIGBUS handler.
+    double lastframe; ///< When the last frame was drawn, in milliseconds.
+};
+
+/**
+ * @struct undoRecord
+ * @brief One change of the text, which the journal can take back or make again.
+ */
+struct undoRecord
+{
+    size_t off;           ///< The offset of the change in the text.
+    size_t pos;           ///< The offset of the bytes inserted or deleted in the log.
+    size_t len;           ///< The number of bytes.
+    unsigned char insert; ///< Set for an insertion, clear for a deletion.
+    unsigned char open;   ///< Set while the next keystroke may still extend the record.
+};
+
+/**
+ * @struct undoJournal
+ * @brief The changes of the text, in order, with the bytes they inserted or deleted.
+ *
+ * The records before cur are applied and the ones after it have been undone. The bytes
+ * of the records are stored one after the other in log, and the oldest records go once
+ * the journal weighs more than EDITOR_UNDO_BYTES.
+ */
+struct undoJournal
+{
+    struct undoRecord *recs; ///< The records.
+    int len;                 ///< The number of records.
+    int cur;                 ///< The number of records applied.
+    int cap;                 ///< The capacity of recs.
+    char *log;               ///< The bytes of the records.
+    size_t loglen;           ///< The number of bytes in log.
+    size_t logcap;           ///< The capacity of log.
+    int replaying;           ///< Set while the journal itself edits the text.
+};
+
+/**
+ * @struct editorStats
+ * @brief The time spent in each phase of the last frame, in milliseconds.
+ */
+struct editorStats
+{
+    int on;         ///< Whether the phases are timed; set while the overlay is shown and by the benchmark.
+    int overlay;    ///< Whether the timings are drawn over the message bar.
+    double open;    ///< The time the last editorOpen took.
+    double compose; ///< The time taken composing the frame, rendering and highlighting included.
+    double syntax;  ///< The part of compose spent rendering and highlighting rows.
+    double diff;    ///< The time taken turning the frame into terminal output.
+    double write;   ///< The time taken writing the output.
+    int bytes;      ///< The number of bytes written.
+};
+
+/**
+ * @struct editorIndex
+ * @brief The cache entry of the newline index and of the highlighting checkpoints of
+ * the file a buffer was opened from.
+ */
+struct editorIndex
+{
+    char *map;     ///< The mapping of the entry found at the opening, until its checkpoints are taken.
+    size_t maplen; ///< The length of the mapping.
+    struct stat st; ///< The file as it was opened, which the original buffer holds.
+    int save;      ///< Set when an entry is to be written, once the file is indexed and highlighted.
+    int edited;    ///< Set once the document was edited, when its rows are no longer those of the file.
+};
+
+/**
+ * @struct editorBuffer
+ * @brief A document open in the editor, with the view of it and the work going on
+ * in the background for it. Every buffer is allocated once, so the workers of a
+ * buffer that is not shown keep the pointers they were given.
+ */
+struct editorBuffer
 {
     int cx, cy; /**< The x and y coordinates of the cursor. */
     int rx;     /**< The index of the cursor in the rendered row. */
@@ -134,20 +659,71 @@ struct editorConfig
     int rowoff; /**< The offset of the displayed rows. */
     int coloff; /**< The offset of the displayed columns. */
 
-    int screenrows; /**< The number of rows in the terminal screen. */
-    int screencols; /**< The number of columns in the terminal screen. */
+    int numrows;            /**< The total number of rows in the text buffer. */
+    struct pieceTable pt;   /**< The piece table holding the text buffer. */
+    unsigned char *hlstate; /**< The highlighting checkpoint at the end of every row, see HL_STATE_COMMENT. */
+    int hlstatecap;         /**< The capacity of the hlstate array. */
+    int hlvalid;            /**< The number of leading rows whose hlstate was ever computed. */
+    int hlstale;            /**< No row before this one is flagged HL_STATE_STALE. */
+    struct hlJob *hljob;    /**< The rows after hlvalid being highlighted in the background, if any. */
 
-    int numrows; /**< The total number of rows in the text buffer. */
-    erow *row;   /**< An array of erow structs representing each row of the text buffer. */
+    struct searchEngine search; /**< The cached matches of the last search. */
+    struct undoJournal undo;    /**< The changes that can be undone and redone. */
+    struct editorSaveJob *save; /**< The save running in the background, if any. */
+    struct editorDisk disk;     /**< What the file on disk holds, for saving in place. */
+    struct editorLoad load;     /**< The loading of the file, while it goes on. */
+    struct editorFollow follow; /**< The file followed in follow mode. */
+    struct editorIndex index;   /**< The cache entry of the line index of the file. */
+
+    volatile sig_atomic_t truncated; /**< Set by the SIGBUS handler when the mapped file got shorter under the document. */
 
     int modified; /**< Flag indicating if the text buffer has been modified. */
 
     char *filename; /**< The name of the file being edited. */
 
+    struct editorSyntax *syntax; /**< The syntax highlighting rules for the editor. */
+};
+
+/**
+ * @struct editorConfig
+ * @brief Represents the configuration of the text editor.
+ *
+ * The editorConfig struct stores various properties and settings related to the text editor.
+ * It includes the open buffers and the one shown, the screen dimensions, the row cache,
+ * the status message, and terminal settings.
+ */
+struct editorConfig
+{
+    struct editorBuffer *buf;   /**< The buffer shown, one of bufs. */
+    struct editorBuffer **bufs; /**< The open buffers, in the order they were opened. */
+    int nbufs;                  /**< The number of buffers. */
+
+    int screenrows; /**< The number of rows in the terminal screen. */
+    int screencols; /**< The number of columns in the terminal screen. */
+
+    erow *rowcache;         /**< Rows of the shown buffer materialized from its piece table, recycled in LRU order. */
+    int rowcachelen;        /**< The number of slots of the row cache. */
+    unsigned long rowclock; /**< Clock used to order the row cache accesses. */
+    unsigned long rowframe; /**< The clock when the current frame started, whose rows stay cached. */
+    size_t rowcachebytes;   /**< The memory held by the rows of the row cache. */
+    struct rowArena arena;  /**< Where the buffers of the cached rows come from. */
+
+    struct screenCells screen; /**< The frame being composed, screenrows + 2 rows of screencols cells. */
+    struct screenCells shadow; /**< The cells the terminal is showing, as left by the previous frame. */
+    int shadowvalid;           /**< Whether shadow matches the terminal; when 0 the next frame is painted in full. */
+    int shadowrowoff;          /**< The row offset the text rows of shadow were drawn at. */
+    int shadowcoloff;          /**< The column offset the text rows of shadow were drawn at. */
+    struct editorStats stats;  /**< The timings of the last frame. */
+    struct editorInput input;   /**< The terminal input read ahead. */
+    struct editorEvents events; /**< The pipes and timers the editor waits on. */
+
     char statusmsg[80];    /**< The status message to be displayed in the editor. */
     time_t statusmsg_time; /**< The time at which the status message was set. */
 
-    struct editorSyntax *syntax; /**< The syntax highlighting rules for the editor. */
+    struct editorSyntax *langs;  /**< The syntaxes known: the built-in ones, then those of the definition files. */
+    int nlangs;                  /**< The number of syntaxes. */
+    struct syntaxMatch *langext; /**< The extensions the syntaxes match, hashed with kwHash. */
+    unsigned int langextmask;    /**< The number of slots of langext minus one. */
 
     struct termios orig_termios; /**< The original terminal settings. */
 };
@@ -191,7 +767,8 @@ struct editorSyntax HLDB[] = {
      C_HL_extensions,
      C_HL_keywords,
      "//", "/*", "*/",
-     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     NULL, NULL, NULL, {0}, {{0}}, NULL},
 };
 
 /**
@@ -230,82 +807,237 @@ void editorRefreshScreen();
  */
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
 
-/*** terminal ***/
-
 /**
- * Prints an error message and exits the program with status 1.
+ * Finishes a batch of the pending syntax highlighting while the editor is idle.
  *
- * @param s The error message to be printed.
+ * @param None
+ * @return None
+ */
+void editorSyntaxIdle();
+
+/**
+ * Merges the results of the running background search and shows them.
  *
+ * @param None
+ * @return None
  */
-void die(const char *s)
-{
-    // [2J - clear entire screen
-    write(STDOUT_FILENO, "\x1b[2J", 4);
+void editorSearchIdle();
 
-    // H - position cursor
-    write(STDOUT_FILENO, "\x1b[H", 3);
+/**
+ * Reports the end of the background save once its thread is finished.
+ *
+ * @param None
+ * @return None
+ */
+void editorSaveIdle();
 
-    perror(s);
-    exit(1);
-}
+/**
+ * Adds the lines the loader found to the document and shows them.
+ *
+ * @param None
+ * @return None
+ */
+void editorLoadIdle();
 
 /**
- * This function is responsible for disabling raw mode and enabling canonical mode
- * in the terminal. It saves the original terminal attributes to the `orig_termios`
- * struct to apply them after the program ends. The `TCSAFLUSH` flag is used to apply
- * the change immediately and discard any input that hasn't been read.
+ * Appends to the document what was added to the followed file, or opens it again
+ * when it was truncated or rotated.
  *
  * @param None
  * @return None
  */
-void disableRawMode()
-{
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
-        die("tcsetattr");
-}
+void editorFollowCheck();
 
 /**
- * This function reads the current terminal attributes into the `orig_termios` struct,
- * creates a raw struct and copies the `orig_termios` struct into it, modifying the flags
- * to enable raw mode. It also sets the minimum number of bytes of input needed before `read()`
- * can return to 0 and the maximum amount of time to wait before `read()` returns to 1.
+ * Follows the file the document was loaded from or saved to.
  *
  * @param None
  * @return None
  */
-void enableRawMode()
-{
-    // read the current terminal attributes into orig_termios struct
-    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1)
-        die("tcgetattr");
+int editorFollowOpen();
 
-    atexit(disableRawMode);
+/**
+ * Starts highlighting in the background the rows after the last one highlighted.
+ *
+ * @param None
+ * @return 1 when the rows are being highlighted in the background, 0 otherwise.
+ */
+int hlJobStart();
 
-    // create a raw struct and copy the orig_termios struct into it modifying the flags
-    struct termios raw = E.orig_termios;
+/**
+ * Takes the states the background highlighting computed and shows them.
+ *
+ * @param None
+ * @return None
+ */
+void hlJobIdle();
 
-    // iflag - input flags -> bitwise-NOT to disable the flags
-    // BRKINT - break condition
-    // ICRNL - carriage return
-    // INPCK - parity check
-    // ISTRIP - strip 8th bit
-    // IXON - ctrl-s and ctrl-q
-    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+/**
+ * Keeps the background highlighting in step with a change of the rows.
+ *
+ * @param at The index of the row that changed.
+ * @param delta The number of rows inserted after it, negative if rows were deleted.
+ * @return None
+ */
+void hlJobEdit(int at, int delta);
 
-    // oflag - output flags -> bitwise-NOT to disable the flags
-    // OPOST - output processing
-    raw.c_oflag &= ~(OPOST);
+/**
+ * Stops the background highlighting, dropping what it did not hand over yet.
+ *
+ * @param None
+ * @return None
+ */
+void hlJobCancel();
 
-    // cflag - control flags -> bitwise-OR to enable the flags
-    // CS8 - character size 8 bits per byte
-    raw.c_cflag |= (CS8);
+/**
+ * Loads a mapped file into the document from its cache entry, if it has one that holds.
+ *
+ * @param buf The mapping of the file.
+ * @param len The length of the file.
+ * @param st The status of the file.
+ * @return 1 when the document is loaded, 0 when the file has to be indexed.
+ */
+int editorIndexOpen(char *buf, size_t len, struct stat *st);
 
-    // lflag - local | misc flags -> bitwise-NOT to disable the flags
-    // ECHO - echo input characters
-    // ICANON - canonical mode
-    // IEXTEN - enable ctrl-v and ctrl-o
-    // ISIG - enable ctrl-c and ctrl-z
+/**
+ * Takes the highlighting checkpoints of the cache entry the document was loaded from.
+ *
+ * @param None
+ * @return None
+ */
+void editorIndexStates();
+
+/**
+ * Writes the cache entry of the file of the document when it is due.
+ *
+ * @param None
+ * @return None
+ */
+void editorIndexIdle();
+
+/**
+ * Tells of the buffers whose mapped file was truncated under them.
+ *
+ * @param None
+ * @return None
+ */
+void editorTruncatedIdle();
+
+/**
+ * Waits for terminal input, handling the other events that come first.
+ *
+ * @param None
+ * @return 1 when terminal input is ready, 0 otherwise.
+ */
+int editorWaitEvent();
+
+/**
+ * Sizes the editor for a terminal of the given size.
+ *
+ * @param rows The number of rows of the terminal.
+ * @param cols The number of columns of the terminal.
+ * @return None
+ */
+void editorResize(int rows, int cols);
+
+/**
+ * Records a change of the text in the undo journal, before the change is made.
+ *
+ * @param insert Set for an insertion, clear for a deletion.
+ * @param off The offset of the change in the text.
+ * @param s The text inserted, or NULL for a deletion.
+ * @param len The number of bytes inserted or deleted.
+ * @return None
+ */
+void editorUndoRecord(int insert, size_t off, const char *s, size_t len);
+
+/**
+ * Converts the index of a character in a row to its render column.
+ *
+ * @param row The row containing the characters.
+ * @param cx The character index in the row.
+ * @return The render index of the character.
+ */
+int editorRowCxToRx(erow *row, int cx);
+
+/*** terminal ***/
+
+/**
+ * Prints an error message and exits the program with status 1.
+ *
+ * @param s The error message to be printed.
+ *
+ */
+void die(const char *s)
+{
+    // [2J - clear entire screen
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+
+    // H - position cursor
+    write(STDOUT_FILENO, "\x1b[H", 3);
+
+    perror(s);
+    exit(1);
+}
+
+/**
+ * This function is responsible for disabling raw mode and enabling canonical mode
+ * in the terminal. It saves the original terminal attributes to the `orig_termios`
+ * struct to apply them after the program ends. The `TCSAFLUSH` flag is used to apply
+ * the change immediately and discard any input that hasn't been read.
+ *
+ * @param None
+ * @return None
+ */
+void disableRawMode()
+{
+    // [?2004l - bracketed paste off
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
+        die("tcsetattr");
+}
+
+/**
+ * This function reads the current terminal attributes into the `orig_termios` struct,
+ * creates a raw struct and copies the `orig_termios` struct into it, modifying the flags
+ * to enable raw mode. It also sets the minimum number of bytes of input needed before `read()`
+ * can return to 0 and the maximum amount of time to wait before `read()` returns to 1.
+ *
+ * @param None
+ * @return None
+ */
+void enableRawMode()
+{
+    // read the current terminal attributes into orig_termios struct
+    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1)
+        die("tcgetattr");
+
+    atexit(disableRawMode);
+
+    // create a raw struct and copy the orig_termios struct into it modifying the flags
+    struct termios raw = E.orig_termios;
+
+    // iflag - input flags -> bitwise-NOT to disable the flags
+    // BRKINT - break condition
+    // ICRNL - carriage return
+    // INPCK - parity check
+    // ISTRIP - strip 8th bit
+    // IXON - ctrl-s and ctrl-q
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+
+    // oflag - output flags -> bitwise-NOT to disable the flags
+    // OPOST - output processing
+    raw.c_oflag &= ~(OPOST);
+
+    // cflag - control flags -> bitwise-OR to enable the flags
+    // CS8 - character size 8 bits per byte
+    raw.c_cflag |= (CS8);
+
+    // lflag - local | misc flags -> bitwise-NOT to disable the flags
+    // ECHO - echo input characters
+    // ICANON - canonical mode
+    // IEXTEN - enable ctrl-v and ctrl-o
+    // ISIG - enable ctrl-c and ctrl-z
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 
     // c_cc - control characters
@@ -317,42 +1049,174 @@ void enableRawMode()
     // set the terminal attributes to the raw struct
     // TCSAFLUSH - apply the change immediately and discard any input that hasn't been read
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    // [?2004h - bracketed paste: pasted text comes between \x1b[200~ and \x1b[201~
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+/**
+ * Reads a byte of terminal input. The bytes are read from the terminal a chunk at
+ * a time, so that one read() takes all the keys typed since the last one.
+ *
+ * @param c Set to the byte.
+ * @return 1 when a byte was read, 0 when read() timed out, -1 on error.
+ */
+int editorReadByte(char *c)
+{
+    struct editorInput *in = &E.input;
+    if (in->pos == in->len)
+    {
+        if (in->buf == NULL)
+        {
+            in->cap = EDITOR_INPUT_CHUNK;
+            in->buf = malloc(in->cap);
+            if (in->buf == NULL)
+                die("malloc");
+        }
+        ssize_t n = read(STDIN_FILENO, in->buf, in->cap);
+        if (n <= 0)
+            return n;
+        in->len = n;
+        in->pos = 0;
+    }
+    *c = in->buf[in->pos++];
+    return 1;
+}
+
+/**
+ * Reads the text of a bracketed paste, whose start marker was just read, into
+ * E.input.paste. The text is read in chunks rather than byte by byte, and what
+ * comes after the end marker is kept for the next keys. A paste whose end marker
+ * does not come within EDITOR_PASTE_WAIT timeouts of read() ends there.
+ *
+ * @param None
+ * @return None
+ */
+void editorReadPaste()
+{
+    static const char end[] = "\x1b[201~";
+    const size_t endlen = sizeof(end) - 1;
+    struct editorInput *in = &E.input;
+
+    in->pastelen = 0;
+    int waits = 0;
+    while (waits < EDITOR_PASTE_WAIT)
+    {
+        size_t n = in->len - in->pos;
+        size_t want = n ? n : EDITOR_PASTE_CHUNK;
+        if (in->pastelen + want > in->pastecap)
+        {
+            in->pastecap = in->pastecap ? in->pastecap : EDITOR_PASTE_CHUNK;
+            while (in->pastelen + want > in->pastecap)
+                in->pastecap *= 2;
+            in->paste = realloc(in->paste, in->pastecap);
+            if (in->paste == NULL)
+                die("realloc");
+        }
+
+        if (n)
+        {
+            memcpy(&in->paste[in->pastelen], &in->buf[in->pos], n);
+            in->pos = in->len = 0;
+        }
+        else
+        {
+            ssize_t r = read(STDIN_FILENO, &in->paste[in->pastelen], want);
+            if (r == -1 && errno != EAGAIN)
+                die("read");
+            if (r <= 0)
+            {
+                waits++;
+                continue;
+            }
+            n = r;
+            waits = 0;
+        }
+
+        // the marker may straddle two reads
+        size_t from = in->pastelen >= endlen ? in->pastelen - (endlen - 1) : 0;
+        in->pastelen += n;
+        char *hit = memmem(&in->paste[from], in->pastelen - from, end, endlen);
+        if (hit)
+        {
+            size_t rest = &in->paste[in->pastelen] - (hit + endlen);
+            if (rest > in->cap)
+            {
+                in->cap = rest;
+                in->buf = realloc(in->buf, in->cap);
+                if (in->buf == NULL)
+                    die("realloc");
+            }
+            if (rest)
+                memcpy(in->buf, hit + endlen, rest);
+            in->len = rest;
+            in->pos = 0;
+            in->pastelen = hit - in->paste;
+            return;
+        }
+    }
 }
 
 /**
- * Reads a keypress from the user and returns the corresponding key code.
+ * Waits for a keypress from the user and decodes it.
  *
  * @param None
  * @return The key code of the pressed key.
  */
-int editorReadKey()
+int editorDecodeKey()
 {
     int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    for (;;)
     {
-        if (nread == -1 && errno != EAGAIN)
+        // the bytes already read are keys, the others are waited for
+        if (E.input.pos == E.input.len && !editorWaitEvent())
+            continue;
+        nread = editorReadByte(&c);
+        if (nread == 1)
+            break;
+        if (nread == -1 && errno != EAGAIN && errno != EINTR)
             die("read");
     }
 
     if (c == '\x1b')
     {
-        char seq[3];
+        char seq[2];
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
+        if (editorReadByte(&seq[0]) != 1)
             return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
+        if (editorReadByte(&seq[1]) != 1)
             return '\x1b';
 
         if (seq[0] == '[')
         {
             if (seq[1] >= '0' && seq[1] <= '9')
             {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
+                // the parameter bytes run up to the final byte; a sequence that is not
+                // known is dropped whole, so the keys after it are kept
+                char param[8];
+                int len = 0;
+                char final = seq[1];
+                while (final >= 0x30 && final <= 0x3f)
+                {
+                    if (len < (int)sizeof(param) - 1)
+                        param[len++] = final;
+                    if (editorReadByte(&final) != 1)
+                        return '\x1b';
+                }
+                param[len] = '\0';
+                if (final != '~')
                     return '\x1b';
-                if (seq[2] == '~')
+
+                // [200~ - the start of a bracketed paste
+                if (strcmp(param, "200") == 0)
                 {
-                    switch (seq[1])
+                    editorReadPaste();
+                    return PASTE_KEY;
+                }
+                if (len == 1)
+                {
+                    switch (param[0])
                     {
                     case '1':
                         return HOME_KEY;
@@ -409,6 +1273,40 @@ int editorReadKey()
     }
 }
 
+/**
+ * Decodes the keys whose bytes were already read, into the ring of keys. Decoding
+ * stops after a paste, as the next paste would take the place of its text.
+ *
+ * @param None
+ * @return The number of keys in the ring.
+ */
+int editorKeysPending()
+{
+    struct editorInput *in = &E.input;
+    while (in->pos < in->len && in->keytail - in->keyhead < EDITOR_KEY_RING)
+    {
+        if (in->keytail != in->keyhead && in->keys[(in->keytail - 1) % EDITOR_KEY_RING] == PASTE_KEY)
+            break;
+        int c = editorDecodeKey();
+        in->keys[in->keytail++ % EDITOR_KEY_RING] = c;
+    }
+    return in->keytail - in->keyhead;
+}
+
+/**
+ * Returns the next key, from the ring of keys decoded ahead or else from the user.
+ *
+ * @param None
+ * @return The key code of the pressed key.
+ */
+int editorReadKey()
+{
+    struct editorInput *in = &E.input;
+    if (in->keyhead != in->keytail)
+        return in->keys[in->keyhead++ % EDITOR_KEY_RING];
+    return editorDecodeKey();
+}
+
 /**
  * Retrieves the current cursor position in the terminal.
  *
@@ -482,1313 +1380,10830 @@ int getWindowSize(int *rows, int *cols)
     }
 }
 
-/*** syntax highlighting ***/
+/*** instrumentation ***/
 
-int is_separator(int c)
+/**
+ * Returns a monotonic time stamp in milliseconds.
+ *
+ * @param None
+ * @return The time stamp.
+ */
+double editorNow()
 {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
 
+/*** events ***/
+
 /**
- * This function updates the syntax highlighting for a specific row in the editor.
- * It takes a pointer to the row structure and modifies the hl (highlight) array
- * based on the characters in the row's render array.
+ * Wakes the editor from editorWaitEvent. Workers call it when they have results.
  *
- * @param row The row to update the syntax highlighting for.
+ * @param None
  * @return None
  */
-void editorUpdateSyntax(erow *row)
+void editorWake()
 {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+    // a full pipe already wakes the editor
+    ssize_t r = write(E.events.wake[1], "", 1);
+    (void)r;
+}
 
-    if (E.syntax == NULL)
-        return;
+/**
+ * Handles SIGWINCH by writing to the self-pipe, for editorWaitEvent to resize.
+ *
+ * @param sig The signal number.
+ * @return None
+ */
+void editorHandleWinch(int sig)
+{
+    (void)sig;
+    int saved = errno;
+    ssize_t r = write(E.events.winch[1], "", 1);
+    (void)r;
+    errno = saved;
+}
 
-    char **keywords = E.syntax->keywords;
+/**
+ * Handles SIGBUS, which reading a mapped file past its end raises once someone else
+ * truncated it. The rest of the mapping from the faulting page on is replaced by
+ * zero pages, so the read goes on, and the buffers reading the mapping are flagged
+ * for editorTruncatedIdle. A fault anywhere else gets the default action.
+ *
+ * @param sig The signal number.
+ * @param info Where the fault happened.
+ * @param context Unused.
+ * @return None
+ */
+void editorHandleBus(int sig, siginfo_t *info, void *context)
+{
+    (void)context;
+    char *addr = info->si_addr;
+    char *base = NULL;
+    size_t len = 0;
+    for (int i = 0; i < E.nbufs && base == NULL; i++)
+    {
+        struct pieceTable *pt = &E.bufs[i]->pt;
+        char *b = pt->buf[PT_ORIGINAL];
+        if (pt->mapped && b && addr >= b && addr < b + pt->len[PT_ORIGINAL])
+            base = b, len = pt->len[PT_ORIGINAL];
+    }
 
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+    // mappings start on a page
+    char *from = base ? base + (addr - base) / E.events.pagesize * E.events.pagesize : NULL;
+    if (base == NULL ||
+        mmap(from, base + len - from, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    {
+        signal(sig, SIG_DFL);
+        return;
+    }
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+    for (int i = 0; i < E.nbufs; i++)
+        if (E.bufs[i]->pt.mapped && E.bufs[i]->pt.buf[PT_ORIGINAL] == base)
+            E.bufs[i]->truncated = 1;
+    int saved = errno;
+    editorWake();
+    errno = saved;
+}
 
-    int prev_sep = 1;
-    int in_string = 0;
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+/**
+ * Creates the pipes the editor waits on, non-blocking so that neither a handler
+ * nor a worker can block on them.
+ *
+ * @param None
+ * @return None
+ */
+void editorEventsInit()
+{
+    if (pipe2(E.events.winch, O_NONBLOCK | O_CLOEXEC) == -1 ||
+        pipe2(E.events.wake, O_NONBLOCK | O_CLOEXEC) == -1)
+        die("pipe2");
+    E.events.woken = 0;
+    E.events.lastframe = 0;
+}
 
-    int i = 0;
-    while (i < row->rsize)
-    {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+/**
+ * Installs the SIGWINCH handler, so the editor follows the size of the terminal.
+ *
+ * @param None
+ * @return None
+ */
+void editorWatchWindow()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorHandleWinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &sa, NULL) == -1)
+        die("sigaction");
+}
 
-        if (scs_len && !in_string && !in_comment)
-        {
-            if (!strncmp(&row->render[i], scs, scs_len))
-            {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+/**
+ * Installs the SIGBUS handler, so a mapped file truncated by someone else does not
+ * take the editor and the changes of every buffer down with it.
+ *
+ * @param None
+ * @return None
+ */
+void editorWatchMappings()
+{
+    E.events.pagesize = sysconf(_SC_PAGESIZE);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = editorHandleBus;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    if (sigaction(SIGBUS, &sa, NULL) == -1)
+        die("sigaction");
+}
 
-        if (mcs_len && mce_len && !in_string)
-        {
-            if (in_comment)
-            {
-                row->hl[i] = HL_MLCOMMENT;
-                if (!strncmp(&row->render[i], mce, mce_len))
-                {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                }
-                else
-                {
-                    i++;
-                    continue;
-                }
-            }
-            else if (!strncmp(&row->render[i], mcs, mcs_len))
-            {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
-        }
-
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS)
-        {
-            if (in_string)
-            {
-                row->hl[i] = HL_STRING;
-                if (c == '\\' && i + 1 < row->rsize)
-                {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-                if (c == in_string)
-                    in_string = 0;
-                i++;
-                prev_sep = 1;
-                continue;
-            }
-            else
-            {
-                if (c == '"' || c == '\'')
-                {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
-        }
-
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
-        {
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-                (c == '.' && prev_hl == HL_NUMBER))
-            {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
-                continue;
-            }
-        }
-
-        if (prev_sep)
-        {
-            int j;
-            for (j = 0; keywords[j]; j++)
-            {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-                if (kw2)
-                    klen--;
-                if (!strncmp(&row->render[i], keywords[j], klen) &&
-                    is_separator(row->render[i + klen]))
-                {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL)
-            {
-                prev_sep = 0;
-                continue;
-            }
-        }
-
-        prev_sep = is_separator(c);
-        i++;
-    }
-
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < E.numrows)
-        editorUpdateSyntax(&E.row[row->idx + 1]);
+/**
+ * Empties a pipe.
+ *
+ * @param fd The read end of the pipe.
+ * @return None
+ */
+void editorDrain(int fd)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
 }
 
 /**
- * Returns the ANSI escape code for the specified syntax highlight.
+ * Returns when the status message stops being shown, on the CLOCK_MONOTONIC scale
+ * of editorNow.
  *
- * @param hl The syntax highlight value.
- * @return The ANSI escape code for the specified syntax highlight.
+ * @param None
+ * @return The time in milliseconds, or a negative number when no message is shown.
  */
-char *editorSyntaxToColor(int hl)
+double editorStatusExpiry()
 {
-    switch (hl)
-    {
-    case HL_COMMENT:
-    case HL_MLCOMMENT:
-        return "\x1b[38;2;98;114;164m";
-
-    case HL_KEYWORD1:
-        return "\x1b[38;2;255;121;198m";
-
-    case HL_KEYWORD2:
-        return "\x1b[38;2;156;220;254m";
-
-    case HL_STRING:
-        return "\x1b[38;2;241;250;140m";
-
-    case HL_NUMBER:
-        return "\x1b[38;2;189;147;249m";
-
-    case HL_MATCH:
-        return "\x1b[38;2;68;71;90m";
-
-    default:
-        return "\x1b[39m";
-    }
+    if (E.statusmsg[0] == '\0')
+        return -1;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    double left = (E.statusmsg_time + EDITOR_STATUS_SECONDS - ts.tv_sec) * 1e3 - ts.tv_nsec / 1e6;
+    return left > 0 ? editorNow() + left : -1;
 }
 
 /**
- * Selects the appropriate syntax highlighting for the current file based on its extension.
- * If no file is currently open, the function returns without making any changes.
- * The function searches through the HLDB (syntax highlight database) to find a match for the file extension.
- * Once a match is found, the corresponding syntax structure is assigned to E.syntax.
+ * Waits for terminal input, handling the other events that come first: a resize
+ * of the terminal, workers with results, changes of the followed file, the expiry
+ * of the status message and the pending syntax highlighting. Results of workers and
+ * changes of the file are taken at most EDITOR_MAX_FPS times a second, since taking
+ * them repaints the screen. Without inotify, the followed file is polled. With
+ * nothing pending, the editor sleeps in poll() until one of these happens.
  *
  * @param None
- * @return None
+ * @return 1 when terminal input is ready, 0 otherwise.
  */
-void editorSelectSyntaxHighlight()
+int editorWaitEvent()
 {
-    E.syntax = NULL;
-    if (E.filename == NULL)
-        return;
-
-    char *ext = strrchr(E.filename, '.');
+    struct editorEvents *ev = &E.events;
+    double now = editorNow();
+    double due = ev->lastframe + 1e3 / EDITOR_MAX_FPS;
+    double expiry = editorStatusExpiry();
+
+    // the next timer, in milliseconds, or -1 for none
+    double wait = -1;
+    if (E.buf->hlstale < E.buf->hlvalid)
+        wait = 0;
+    if (ev->woken && (wait < 0 || due - now < wait))
+        wait = due > now ? due - now : 0;
+    if (expiry >= 0 && (wait < 0 || expiry - now < wait))
+        wait = expiry > now ? expiry - now : 0;
+    int polled = E.buf->follow.on && E.buf->follow.notify < 0;
+    if (polled && (wait < 0 || E.buf->follow.next - now < wait))
+        wait = E.buf->follow.next > now ? E.buf->follow.next - now : 0;
+
+    // poll() skips the negative descriptors
+    struct pollfd fds[4] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {ev->winch[0], POLLIN, 0},
+        {ev->wake[0], POLLIN, 0},
+        {E.buf->follow.notify, POLLIN, 0},
+    };
+    int n = poll(fds, 4, wait < 0 ? -1 : (int)wait + 1);
+    if (n == -1)
+    {
+        if (errno == EINTR)
+            return 0;
+        die("poll");
+    }
 
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
+    if (fds[1].revents & POLLIN)
     {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->filematch[i])
+        editorDrain(ev->winch[0]);
+        int rows, cols;
+        if (getWindowSize(&rows, &cols) == 0)
         {
-            int is_ext = (s->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(E.filename, s->filematch[i])))
-            {
-                E.syntax = s;
-
-                int filerow;
-                for (filerow = 0; filerow < E.numrows; filerow++)
-                {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
-
-                return;
-            }
-            i++;
+            editorResize(rows, cols);
+            editorRefreshScreen();
         }
     }
-}
+    if (fds[2].revents & POLLIN)
+    {
+        editorDrain(ev->wake[0]);
+        ev->woken = 1;
+    }
+    if (fds[3].revents & POLLIN)
+    {
+        editorDrain(E.buf->follow.notify);
+        ev->woken = 1;
+    }
+    if (polled && editorNow() >= E.buf->follow.next)
+    {
+        E.buf->follow.next = editorNow() + EDITOR_FOLLOW_POLL;
+        ev->woken = 1;
+    }
+    if (ev->woken && editorNow() >= due)
+    {
+        ev->woken = 0;
+        editorLoadIdle();
+        hlJobIdle();
+        editorSearchIdle();
+        editorSaveIdle();
+        editorTruncatedIdle();
+        editorIndexIdle();
+        if (E.buf->follow.on)
+            editorFollowCheck();
+    }
+    if (expiry >= 0 && editorStatusExpiry() < 0)
+        editorRefreshScreen();
 
-/*** row operations ***/
+    if (fds[0].revents)
+        return 1;
+    if (n == 0 && E.buf->hlstale < E.buf->hlvalid)
+        editorSyntaxIdle();
+    return 0;
+}
 
 /**
- * Converts the index of a character in a row from the cx (character index) to the rx (render index).
+ * Waits for terminal input until the next frame is due, so that the keys coming
+ * faster than EDITOR_MAX_FPS frames a second share a frame.
  *
- * @param row The row containing the characters.
- * @param cx The character index in the row.
- * @return The render index of the character.
+ * @param None
+ * @return 1 when terminal input is ready before the frame is due, 0 otherwise.
  */
-int editorRowCxToRx(erow *row, int cx)
+int editorFrameWait()
 {
-    int rx = 0;
-
-    for (int j = 0; j < cx; j++)
-    {
-        if (row->chars[j] == '\t')
-            rx += (EDITOR_TAB_STOP - 1) - (rx % EDITOR_TAB_STOP);
-        rx++;
-    }
-    return rx;
+    double left = E.events.lastframe + 1e3 / EDITOR_MAX_FPS - editorNow();
+    if (left <= 0)
+        return 0;
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&fd, 1, (int)left + 1) > 0;
 }
 
+/*** row arena ***/
+
 /**
- * Converts a visual column index (rx) to a character index (cx) for a given row.
+ * Returns the size class of a buffer.
  *
- * @param row The row for which to convert the visual column index.
- * @param rx The visual column index to convert.
- * @return The character index (cx) corresponding to the given visual column index (rx).
+ * @param n The size of the buffer.
+ * @return The class, or -1 when the buffer is too large for the slabs.
  */
-int editorRowRxToCx(erow *row, int rx)
+int raClass(size_t n)
 {
-    int cur_rx = 0;
-    int cx;
-
-    for (cx = 0; cx < row->size; cx++)
-    {
-        if (row->chars[cx] == '\t')
-            cur_rx += (EDITOR_TAB_STOP - 1) - (cur_rx % EDITOR_TAB_STOP);
-
-        cur_rx++;
-
-        if (cur_rx > rx)
-            return cx;
-    }
-    return cx;
+    int c = 0;
+    while (c < EDITOR_SLAB_CLASSES && ((size_t)16 << c) < n)
+        c++;
+    return c < EDITOR_SLAB_CLASSES ? c : -1;
 }
 
 /**
- * This function updates the render field of a given row by converting tabs
- * into spaces and allocating memory for the updated render string.
+ * Returns a buffer of at least n bytes, from the free list of its class, which is
+ * refilled with a new slab block when it is empty.
  *
- * @param row A pointer to the row structure to be updated.
- * @return None
+ * @param n The size needed.
+ * @param cap Set to the capacity of the buffer.
+ * @return The buffer.
  */
-void editorUpdateRow(erow *row)
+char *raAlloc(size_t n, size_t *cap)
 {
-    int tabs = 0;
-    for (int j = 0; j < row->size; j++)
+    struct rowArena *ra = &E.arena;
+    int c = raClass(n);
+    if (c < 0)
     {
-        if (row->chars[j] == '\t')
-            tabs++;
+        *cap = n;
+        char *p = malloc(n);
+        if (p == NULL)
+            die("malloc");
+        return p;
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs * (EDITOR_TAB_STOP - 1) + 1);
-
-    int idx = 0;
-    for (int j = 0; j < row->size; j++)
+    size_t size = (size_t)16 << c;
+    if (ra->free[c] == NULL)
     {
-        if (row->chars[j] == '\t')
+        if (ra->nblocks == ra->blockcap)
         {
-            row->render[idx++] = ' ';
-            while (idx % EDITOR_TAB_STOP != 0)
-                row->render[idx++] = ' ';
+            ra->blockcap = ra->blockcap ? ra->blockcap * 2 : 16;
+            ra->blocks = realloc(ra->blocks, ra->blockcap * sizeof(char *));
+            if (ra->blocks == NULL)
+                die("realloc");
         }
-        else
+        char *block = malloc(EDITOR_SLAB_BYTES);
+        if (block == NULL)
+            die("malloc");
+        ra->blocks[ra->nblocks++] = block;
+
+        for (size_t off = EDITOR_SLAB_BYTES; off >= size; off -= size)
         {
-            row->render[idx++] = row->chars[j];
+            char *p = &block[off - size];
+            memcpy(p, &ra->free[c], sizeof(char *));
+            ra->free[c] = p;
         }
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
 
-    editorUpdateSyntax(row);
+    char *p = ra->free[c];
+    memcpy(&ra->free[c], p, sizeof(char *));
+    *cap = size;
+    return p;
 }
 
 /**
- * Inserts a new row at the specified position in the editor.
+ * Gives a buffer back to the free list of its class.
  *
- * @param at The index at which to insert the row.
- * @param s The string to be inserted.
- * @param len The length of the string.
+ * @param p The buffer, or NULL.
+ * @param cap Its capacity, as set by raAlloc.
  * @return None
  */
-void editorInsertRow(int at, char *s, size_t len)
+void raFree(char *p, size_t cap)
 {
-    if (at < 0 || at > E.numrows)
+    if (p == NULL)
         return;
-
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-    for (int j = at + 1; j <= E.numrows; j++)
-        E.row[j].idx++;
-
-    E.row[at].idx = at;
-
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-
-    editorUpdateRow(&E.row[at]);
-
-    E.numrows++;
-    E.modified = 1;
+    int c = raClass(cap);
+    if (c < 0 || ((size_t)16 << c) != cap)
+    {
+        free(p);
+        return;
+    }
+    memcpy(p, &E.arena.free[c], sizeof(char *));
+    E.arena.free[c] = p;
 }
 
 /**
- * Frees the memory allocated for a row in the editor.
+ * Makes a buffer at least n bytes long. The class sizes leave room for the
+ * buffer to grow, so most edits keep it where it is.
  *
- * @param row The row to be freed.
- * @return None
+ * @param p The buffer, or NULL.
+ * @param cap Its capacity, updated.
+ * @param n The size needed.
+ * @param keep The number of bytes to keep when the buffer moves.
+ * @return The buffer.
  */
-void editorFreeRow(erow *row)
+char *raGrow(char *p, size_t *cap, size_t n, size_t keep)
 {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+    if (p && n <= *cap)
+        return p;
+    // past the classes buffers are allocated to size, so a growing one takes half again
+    if (p && raClass(n) < 0 && n < *cap + *cap / 2)
+        n = *cap + *cap / 2;
+    size_t newcap;
+    char *q = raAlloc(n, &newcap);
+    if (p && keep)
+        memcpy(q, p, keep);
+    raFree(p, *cap);
+    *cap = newcap;
+    return q;
 }
 
 /**
- * Deletes a row from the editor.
+ * Releases every slab at once. No row may still use a buffer from them.
  *
- * @param at The index of the row to delete.
+ * @param None
  * @return None
  */
-void editorDelRow(int at)
+void raReset()
 {
-    if (at < 0 || at >= E.numrows)
-        return;
+    struct rowArena *ra = &E.arena;
+    for (int i = 0; i < ra->nblocks; i++)
+        free(ra->blocks[i]);
+    ra->nblocks = 0;
+    memset(ra->free, 0, sizeof(ra->free));
+}
 
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    for (int j = at; j < E.numrows - 1; j++)
-        E.row[j].idx--;
+/*** syntax highlighting ***/
 
-    E.numrows--;
-    E.modified = 1;
+/**
+ * Hashes a span of text for the keyword tables (FNV-1a, started from a seed).
+ *
+ * @param seed The seed of the table.
+ * @param s The text to hash.
+ * @param len The length of the text.
+ * @return The hash of the text.
+ */
+unsigned int kwHash(unsigned int seed, const char *s, int len)
+{
+    unsigned int h = 2166136261u ^ seed;
+    for (int i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
 }
 
 /**
- * Inserts a character at a given index in a row.
+ * Mixes the hash of an identifier with the displacement of its bucket into the index
+ * of its slot (the finalizer of MurmurHash3).
  *
- * @param row The row in which the character will be inserted.
- * @param at The index at which the character will be inserted.
- * @param c The character to be inserted.
- * @return None
+ * @param h The hash of the identifier.
+ * @param disp The displacement of its bucket.
+ * @return The mixed hash.
  */
-void editorRowInsertChar(erow *row, int at, int c)
+unsigned int kwMix(unsigned int h, unsigned int disp)
 {
-    if (at < 0 || at > row->size)
-        at = row->size;
-
-    row->chars = realloc(row->chars, row->size + 2);
-
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.modified = 1;
+    h ^= disp * 0x9e3779b9u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
 }
 
 /**
- * Inserts a new line in the text editor at the current cursor position.
- * If the cursor is at the beginning of a line, a new empty line is inserted.
- * If the cursor is in the middle of a line, the text after the cursor is moved to a new line.
- * The cursor is then moved to the beginning of the new line.
+ * Places the keywords in the slots of a table for its seed: the buckets, largest
+ * first, each get the first displacement sending their keywords to free slots.
  *
- * @param None
- * @return None
+ * @param kt The table, whose slots are filled in.
+ * @param words The keywords, without repeats.
+ * @param n The number of keywords.
+ * @return 1 when every keyword got a slot, 0 when a bucket holds more than
+ * EDITOR_KW_BUCKET keywords, which takes another seed, or -1 when a bucket found no
+ * displacement, which takes more slots.
  */
-void editorInsertNewLine()
+int kwPlace(struct keywordTable *kt, struct keywordEntry *words, int n)
 {
-    if (E.cx == 0)
+    size_t nbuckets = (size_t)kt->bmask + 1;
+    memset(kt->slots, 0, ((size_t)kt->mask + 1) * sizeof(struct keywordEntry));
+    memset(kt->disp, 0, nbuckets * sizeof(unsigned int));
+
+    // the keywords sorted by bucket, those of bucket b from start[b] to start[b + 1]
+    unsigned int *hash = malloc((n + 1) * sizeof(unsigned int));
+    int *order = malloc((n + 1) * sizeof(int));
+    int *start = calloc(nbuckets + 1, sizeof(int));
+    if (hash == NULL || order == NULL || start == NULL)
+        die("malloc");
+    int biggest = 0;
+    for (int i = 0; i < n; i++)
     {
-        editorInsertRow(E.cy, "", 0);
+        hash[i] = kwHash(kt->seed, words[i].word, words[i].len);
+        start[(hash[i] & kt->bmask) + 1]++;
     }
-    else
+    for (size_t b = 0; b < nbuckets; b++)
     {
-        erow *row = &E.row[E.cy];
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        if (start[b + 1] > biggest)
+            biggest = start[b + 1];
+        start[b + 1] += start[b];
+    }
+    int *fill = malloc((nbuckets + 1) * sizeof(int));
+    if (fill == NULL)
+        die("malloc");
+    memcpy(fill, start, nbuckets * sizeof(int));
+    for (int i = 0; i < n; i++)
+        order[fill[hash[i] & kt->bmask]++] = i;
+    free(fill);
+
+    int placed = biggest <= EDITOR_KW_BUCKET;
+    unsigned int slot[EDITOR_KW_BUCKET];
+    for (int want = biggest; want > 0 && placed == 1; want--)
+    {
+        for (size_t b = 0; b < nbuckets && placed == 1; b++)
+        {
+            if (start[b + 1] - start[b] != want)
+                continue;
+
+            unsigned int d;
+            for (d = 0; d < EDITOR_KW_DISPLACEMENTS; d++)
+            {
+                int k;
+                for (k = 0; k < want; k++)
+                {
+                    slot[k] = kwMix(hash[order[start[b] + k]], d) & kt->mask;
+                    int taken = kt->slots[slot[k]].word != NULL;
+                    for (int j = 0; j < k && !taken; j++)
+                        taken = slot[j] == slot[k];
+                    if (taken)
+                        break;
+                }
+                if (k == want)
+                    break;
+            }
+            if (d == EDITOR_KW_DISPLACEMENTS)
+            {
+                placed = -1;
+                break;
+            }
+
+            kt->disp[b] = d;
+            for (int k = 0; k < want; k++)
+                kt->slots[slot[k]] = words[order[start[b] + k]];
+        }
     }
-    E.cy++;
-    E.cx = 0;
+    free(hash);
+    free(order);
+    free(start);
+    return placed;
 }
 
 /**
- * Deletes a character at a given index in a row.
+ * Compiles a NULL-terminated keyword list into a perfect hash. Keywords ending
+ * in '|' are stored as HL_KEYWORD2. There is a bucket for every EDITOR_KW_BUCKET / 4
+ * keywords and about a quarter more slots than keywords; seeds are tried until
+ * every bucket finds its displacement, and the slots are doubled when a bucket
+ * finds none. Repeated keywords keep their first type, as the linear scan over
+ * the list did.
  *
- * @param row The row from which to delete the character.
- * @param at The index of the character to delete.
- * @return None
+ * @param keywords The keyword list of a syntax.
+ * @return The compiled table.
  */
-void editorRowDelChar(erow *row, int at)
+struct keywordTable *kwCompile(char **keywords)
 {
-    if (at < 0 || at >= row->size)
-        return;
+    int count = 0;
+    while (keywords[count])
+        count++;
+
+    struct keywordTable *kt = malloc(sizeof(struct keywordTable));
+    struct keywordEntry *words = malloc((count + 1) * sizeof(struct keywordEntry));
+    if (kt == NULL || words == NULL)
+        die("malloc");
+
+    int n = 0;
+    kt->maxlen = 0;
+    for (int j = 0; j < count; j++)
+    {
+        int len = strlen(keywords[j]);
+        int kw2 = len > 0 && keywords[j][len - 1] == '|';
+        if (kw2)
+            len--;
+        int seen = 0;
+        for (int i = 0; i < n && !seen; i++)
+            seen = words[i].len == len && !strncmp(words[i].word, keywords[j], len);
+        if (seen)
+            continue;
+        words[n++] = (struct keywordEntry){keywords[j], len, kw2 ? HL_KEYWORD2 : HL_KEYWORD1};
+        if (len > kt->maxlen)
+            kt->maxlen = len;
+    }
 
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
+    unsigned int buckets = 1, size = 8;
+    while (buckets * (EDITOR_KW_BUCKET / 4) < (unsigned int)n)
+        buckets <<= 1;
+    while (size < (unsigned int)n + n / 4)
+        size <<= 1;
+    kt->bmask = buckets - 1;
+    kt->mask = size - 1;
+    kt->disp = malloc(buckets * sizeof(unsigned int));
+    kt->slots = malloc(size * sizeof(struct keywordEntry));
+    if (kt->disp == NULL || kt->slots == NULL)
+        die("malloc");
+
+    int placed;
+    for (kt->seed = 0; (placed = kwPlace(kt, words, n)) != 1; kt->seed++)
+    {
+        if (placed == 0)
+            continue;
+        size <<= 1;
+        kt->mask = size - 1;
+        kt->slots = realloc(kt->slots, size * sizeof(struct keywordEntry));
+        if (kt->slots == NULL)
+            die("realloc");
+    }
 
-    editorUpdateRow(row);
-    E.modified = 1;
+    free(words);
+    return kt;
 }
 
-/*** editor operations ***/
-
 /**
- * Inserts a character at the cursor position.
- * If the cursor is at the end of the file, a new empty row is appended before inserting the character.
+ * Looks up an identifier in a compiled keyword table.
  *
- * @param c The character to be inserted.
- * @return None
+ * @param kt The compiled table.
+ * @param s The identifier.
+ * @param len The length of the identifier.
+ * @return HL_KEYWORD1 or HL_KEYWORD2 when the identifier is a keyword, HL_NORMAL otherwise.
  */
-void editorInsertChar(int c)
+int kwLookup(struct keywordTable *kt, const char *s, int len)
 {
-    if (E.cy == E.numrows)
-        editorInsertRow(E.numrows, "", 0);
-
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
-    E.cx++;
+    if (len == 0 || len > kt->maxlen)
+        return HL_NORMAL;
+    unsigned int h = kwHash(kt->seed, s, len);
+    struct keywordEntry *e = &kt->slots[kwMix(h, kt->disp[h & kt->bmask]) & kt->mask];
+    if (e->word == NULL || e->len != len || memcmp(e->word, s, len) != 0)
+        return HL_NORMAL;
+    return e->hl;
 }
 
 /**
- * This function appends the given string `s` of length `len` to the end of the specified row.
- * It reallocates memory for the row's characters, copies the string to the allocated memory,
- * updates the row's size, adds a null terminator at the end, updates the editor, and marks
- * the editor as modified.
+ * Skips a run of bytes one at a time. This is the reference the vectorized skippers
+ * have to agree with, and the one they use for their tail. A word goes on until a
+ * separator, a quote or the start of a comment; a run of separators until a byte
+ * that is none, or that may start a number, a string or a comment.
  *
- * @param row The row to append the string to.
- * @param s The string to append.
- * @param len The length of the string.
- * @return None
+ * @param s The syntax.
+ * @param chars The characters of the row.
+ * @param i The index of the first byte of the run.
+ * @param end The index where to stop.
+ * @param sep Set for a run of separators, clear for the rest of a word.
+ * @return The index of the first byte ending the run, or end.
  */
-void editorRowAppendString(erow *row, char *s, size_t len)
+int hlSkipScalar(const struct editorSyntax *s, const char *chars, int i, int end, int sep)
 {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.modified = 1;
-}
-
-/**
- * Deletes a character at the cursor position.
- * If the cursor is at the end of the file, nothing happens.
- * If the cursor is not at the beginning of the line, the character to the left of the cursor is deleted.
- * After deleting the character, the cursor is moved one position to the left.
- *
- * @param None
- * @return None
- */
-void editorDelChar()
-{
-    if (E.cy == E.numrows)
-        return;
-    if (E.cx == 0 && E.cy == 0)
-        return;
-    erow *row = &E.row[E.cy];
-    if (E.cx > 0)
+    const unsigned char *cls = s->cls;
+    if (sep)
     {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
+        while (i < end && (cls[(unsigned char)chars[i]] & (HL_CLASS_SEPARATOR | HL_CLASS_QUOTE | HL_CLASS_DELIM |
+                                                           HL_CLASS_DIGIT)) == HL_CLASS_SEPARATOR)
+            i++;
     }
     else
     {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+        while (i < end && !(cls[(unsigned char)chars[i]] & (HL_CLASS_SEPARATOR | HL_CLASS_QUOTE | HL_CLASS_DELIM)))
+            i++;
     }
+    return i;
 }
 
-/*** file i/o ***/
-
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
 /**
- * Converts the editor rows to a single string.
- *
- * This function takes the editor rows and concatenates them into a single string,
- * separating each row with a newline character. The resulting string is stored in
- * a dynamically allocated buffer, and the length of the buffer is returned through
- * the `buflen` parameter.
+ * Skips a run of bytes 16 at a time with SSSE3. A byte is looked up in the nibble
+ * tables of the syntax by its low nibble, giving the set of high nibbles it has in
+ * the set, and by its high nibble, giving its own bit: the two share a bit when the
+ * byte is in the set. It is compiled for SSSE3 on its own and only called when the
+ * CPU supports it.
  *
- * @param buflen A pointer to an integer that will store the length of the resulting string.
- * @return A pointer to the dynamically allocated buffer containing the converted string.
+ * @param s The syntax.
+ * @param chars The characters of the row.
+ * @param i The index of the first byte of the run.
+ * @param end The index where to stop.
+ * @param sep Set for a run of separators, clear for the rest of a word.
+ * @return The index of the first byte ending the run, or end.
  */
-char *editorRowsToString(int *buflen)
+__attribute__((target("ssse3"))) int hlSkipSSSE3(const struct editorSyntax *s, const char *chars, int i, int end,
+                                                 int sep)
 {
-    int totlen = 0;
-    int j;
-
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1;
-
-    *buflen = totlen;
+    const __m128i lo = _mm_loadu_si128((const __m128i *)s->runs[sep]);
+    const __m128i hi = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    // the bytes out of the set end a run of separators, those in it end a word
+    unsigned int flip = sep ? 0 : 0xffff;
 
-    char *buf = malloc(totlen);
-    char *p = buf;
-
-    for (j = 0; j < E.numrows; j++)
+    for (; i + 16 <= end; i += 16)
     {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+        __m128i v = _mm_loadu_si128((const __m128i *)&chars[i]);
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i out = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+        unsigned int m = (unsigned int)_mm_movemask_epi8(out) ^ flip;
+        if (m)
+            return i + __builtin_ctz(m);
     }
-
-    return buf;
+    return hlSkipScalar(s, chars, i, end, sep);
 }
 
 /**
- * Opens a file and reads it line by line, appending each line to the editor.
+ * Skips a run of bytes 32 at a time with AVX2, as hlSkipSSSE3 does. It is compiled
+ * for AVX2 on its own and only called when the CPU supports it.
  *
- * @param filename The name of the file to be opened.
- * @return None
+ * @param s The syntax.
+ * @param chars The characters of the row.
+ * @param i The index of the first byte of the run.
+ * @param end The index where to stop.
+ * @param sep Set for a run of separators, clear for the rest of a word.
+ * @return The index of the first byte ending the run, or end.
  */
-void editorOpen(char *filename)
+__attribute__((target("avx2"))) int hlSkipAVX2(const struct editorSyntax *s, const char *chars, int i, int end,
+                                               int sep)
 {
-    free(E.filename);
-    E.filename = strdup(filename);
-
-    editorSelectSyntaxHighlight();
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)s->runs[sep]));
+    const __m256i hi = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+                                        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    unsigned int flip = sep ? 0 : 0xffffffffu;
 
-    FILE *fp = fopen(filename, "r");
-
-    if (!fp)
-        die("fopen");
-
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-
-    while ((linelen = getline(&line, &linecap, fp)) != -1)
+    for (; i + 32 <= end; i += 32)
     {
-        while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                               line[linelen - 1] == '\r'))
-            linelen--;
-
-        editorInsertRow(E.numrows, line, linelen);
+        __m256i v = _mm256_loadu_si256((const __m256i *)&chars[i]);
+        __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+        __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i out = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+        unsigned int m = (unsigned int)_mm256_movemask_epi8(out) ^ flip;
+        if (m)
+            return i + __builtin_ctz(m);
     }
-    free(line);
-    fclose(fp);
-    E.modified = 0;
+    return hlSkipScalar(s, chars, i, end, sep);
 }
+#endif
 
+#if defined(__ARM_NEON) && defined(__aarch64__)
 /**
- * Saves the contents of the editor buffer to a file.
- * If the file doesn't exist, it will be created.
+ * Skips a run of bytes 16 at a time with NEON, as hlSkipSSSE3 does. NEON has no
+ * movemask, so the bytes ending the run are narrowed to a 64-bit mask holding 4 bits
+ * per byte.
  *
- * @param None
- * @return None
+ * @param s The syntax.
+ * @param chars The characters of the row.
+ * @param i The index of the first byte of the run.
+ * @param end The index where to stop.
+ * @param sep Set for a run of separators, clear for the rest of a word.
+ * @return The index of the first byte ending the run, or end.
  */
-void editorSave()
+int hlSkipNEON(const struct editorSyntax *s, const char *chars, int i, int end, int sep)
 {
-    if (E.filename == NULL)
-    {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (E.filename == NULL)
-        {
-            editorSetStatusMessage("Operation aborted");
-            return;
-        }
-        editorSelectSyntaxHighlight();
-    }
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+    const uint8x16_t lo = vld1q_u8(s->runs[sep]);
+    const uint8x16_t hi = vld1q_u8(bits);
+    const uint8x16_t nibble = vdupq_n_u8(0x0f);
 
-    int len;
-    char *buf = editorRowsToString(&len);
-
-    // O_RDWR - read/write mode
-    // O_CREAT - create the file if it doesn't exist
-    // 0644 - file permissions
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1)
+    for (; i + 16 <= end; i += 16)
     {
-        if (ftruncate(fd, len) != -1)
-        {
-            if (write(fd, buf, len) == len)
-            {
-                close(fd);
-                free(buf);
-                E.modified = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
-        }
-        close(fd);
+        uint8x16_t v = vld1q_u8((const uint8_t *)&chars[i]);
+        uint8x16_t in = vandq_u8(vqtbl1q_u8(lo, vandq_u8(v, nibble)), vqtbl1q_u8(hi, vshrq_n_u8(v, 4)));
+        uint8x16_t stop = sep ? vceqq_u8(in, vdupq_n_u8(0)) : vtstq_u8(in, in);
+        uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(stop), 4)), 0);
+        if (m)
+            return i + (__builtin_ctzll(m) >> 2);
     }
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    return hlSkipScalar(s, chars, i, end, sep);
 }
+#endif
 
-/*** find ***/
+/**
+ * Picks the fastest skipper the CPU supports.
+ *
+ * @param None
+ * @return The skipper function.
+ */
+hlSkipFn hlSkipper()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("avx2"))
+        return hlSkipAVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return hlSkipSSSE3;
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    return hlSkipNEON;
+#else
+    return hlSkipScalar;
+#endif
+}
 
 /**
- * This function is called when the user wants to find a specific text in the editor.
- * It searches for the given query in each row of the editor's content and moves the cursor
- * to the first occurrence of the query. If the user presses the enter key or the escape key,
- * the function returns without performing any action.
+ * Builds the nibble tables of a syntax from the classes of its bytes and picks its
+ * skipper. The tables only describe ASCII bytes: the others are taken out of both
+ * sets, which only ends runs of separators early, and a syntax where one may end a
+ * word is skipped one byte at a time.
  *
- * @param query The text to search for.
- * @param key The key that triggered the callback.
+ * @param s The syntax, whose cls is built.
  * @return None
  */
-void editorFindCallback(char *query, int key)
+void hlClassify(struct editorSyntax *s)
 {
-    static int last_match = -1;
-    static int direction = 1;
-
-    static int saved_hl_line;
-    static char *saved_hl = NULL;
-
-    if (saved_hl)
-    {
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
-    }
-
-    if (key == '\r' || key == '\x1b')
-    {
-        last_match = -1;
-        direction = 1;
-        return;
-    }
-    else if (key == ARROW_RIGHT || key == ARROW_DOWN)
-    {
-        direction = 1;
-    }
-    else if (key == ARROW_LEFT || key == ARROW_UP)
-    {
-        direction = -1;
-    }
-    else
-    {
-        last_match = -1;
-        direction = 1;
-    }
-
-    if (last_match == -1)
-        direction = 1;
-
-    int current = last_match;
-
-    for (int i = 0; i < E.numrows; i++)
+    memset(s->runs, 0, sizeof(s->runs));
+    s->skip = hlSkipper();
+    for (int c = 0; c < 256; c++)
     {
-        current += direction;
-        if (current == -1)
-            current = E.numrows - 1;
-        else if (current == E.numrows)
-            current = 0;
-
-        erow *row = &E.row[current];
-
-        char *match = strstr(row->render, query);
-        if (match)
+        unsigned char cc = s->cls[c];
+        int endsword = (cc & (HL_CLASS_SEPARATOR | HL_CLASS_QUOTE | HL_CLASS_DELIM)) != 0;
+        int separator = (cc & (HL_CLASS_SEPARATOR | HL_CLASS_QUOTE | HL_CLASS_DELIM | HL_CLASS_DIGIT)) ==
+                        HL_CLASS_SEPARATOR;
+        if (c >= 0x80)
         {
-            last_match = current;
-            E.cy = current;
-            E.cx = editorRowRxToCx(row, match - row->render);
-            E.rowoff = E.numrows;
-
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
+            if (endsword)
+                s->skip = hlSkipScalar;
+            continue;
         }
+        if (endsword)
+            s->runs[0][c & 15] |= 1 << (c >> 4);
+        if (separator)
+            s->runs[1][c & 15] |= 1 << (c >> 4);
     }
 }
 
 /**
- * This function prompts the user to enter a search query and searches for that query in the text editor.
- * If the user cancels the search by pressing ESC, the function restores the editor's previous state.
+ * Compiles what the lexer looks up for a syntax: its keywords, unless they come
+ * compiled already, and the class of every byte.
  *
- * @param None
+ * @param s The syntax.
  * @return None
  */
-void editorFind()
+void hlCompile(struct editorSyntax *s)
 {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.coloff;
-    int saved_rowoff = E.rowoff;
+    if (s->kwtable == NULL)
+        s->kwtable = kwCompile(s->keywords);
 
-    char *query = editorPrompt("Search: %s (ESC | Arrows | Enter)", editorFindCallback);
-
-    if (query)
-        free(query);
-    else
+    const char *quotes = s->quotes ? s->quotes : "\"'";
+    memset(s->cls, 0, sizeof(s->cls));
+    for (int c = 0; c < 256; c++)
     {
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.coloff = saved_coloff;
-        E.rowoff = saved_rowoff;
+        if (isspace(c) || c == '\0' || strchr(EDITOR_SEPARATORS, c) ||
+            (s->separators && strchr(s->separators, c)))
+            s->cls[c] |= HL_CLASS_SEPARATOR;
+        if (isdigit(c))
+            s->cls[c] |= HL_CLASS_DIGIT;
+        if (c != '\0' && strchr(quotes, c))
+            s->cls[c] |= HL_CLASS_QUOTE;
     }
+    if (s->singleline_comment_start)
+        s->cls[(unsigned char)s->singleline_comment_start[0]] |= HL_CLASS_DELIM;
+    if (s->multiline_comment_start)
+        s->cls[(unsigned char)s->multiline_comment_start[0]] |= HL_CLASS_DELIM;
+    hlClassify(s);
 }
 
-/*** append buffer ***/
-
-struct abuf
-{
-    char *b;
-    int len;
-};
-
-// buffer constructor
-#define ABUF_INIT \
-    {             \
-        NULL, 0   \
-    }
-
 /**
- * This function reallocates the buffer memory to fit the new string and then
- * copies the new string to the end of the buffer.
+ * Highlights a run of characters of a row, as the run of render columns they cover,
+ * clipped to the characters the spans are computed for. Runs are marked in order, so
+ * the run is either merged into the last one, when it touches it with the same
+ * highlight, or appended.
  *
- * @param ab The buffer to append the string to.
- * @param s The string to append.
- * @param len The length of the string to append.
+ * @param row The row being highlighted.
+ * @param start The first character of the run, not before the start of the last run.
+ * @param len The number of characters.
+ * @param hl The highlight of the characters.
  * @return None
  */
-void abAppend(struct abuf *ab, const char *s, int len)
+void hlMark(erow *row, int start, int len, unsigned char hl)
 {
-    char *new = realloc(ab->b, ab->len + len);
-    if (new == NULL)
+    int end = start + len;
+    if (start < row->hla)
+        start = row->hla;
+    if (end > row->hlb)
+        end = row->hlb;
+    if (start >= end)
         return;
 
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
+    start = editorRowCxToRx(row, start);
+    end = editorRowCxToRx(row, end);
+
+    if (row->nspans > 0)
+    {
+        struct hlSpan *last = &row->spans[row->nspans - 1];
+        if (last->hl == hl && start <= last->start + last->len)
+        {
+            if (end > last->start + last->len)
+                last->len = end - last->start;
+            return;
+        }
+    }
+
+    size_t need = (row->nspans + 1) * sizeof(struct hlSpan);
+    row->spans = (struct hlSpan *)raGrow((char *)row->spans, &row->spanscap, need,
+                                         row->nspans * sizeof(struct hlSpan));
+    row->spans[row->nspans++] = (struct hlSpan){start, end - start, hl};
 }
 
 /**
- * Frees the memory allocated for the abuf structure.
+ * Tells whether a delimiter starts at a character of the row.
  *
- * @param ab The abuf structure to be freed.
- * @return None
+ * @param row The row.
+ * @param i The index of the character.
+ * @param s The delimiter.
+ * @param len The length of the delimiter.
+ * @return Whether the row holds s at i.
  */
-void abFree(struct abuf *ab)
+int hlAt(erow *row, int i, const char *s, int len)
 {
-    free(ab->b);
+    return i + len <= row->size && memcmp(&row->chars[i], s, len) == 0;
 }
 
-/*** output ***/
-
 /**
- * Scrolls the editor to keep the cursor in view.
+ * Returns how far past a character the lexer may look before deciding how to highlight
+ * it, so that a state taken at a character does not depend on the text after that far.
  *
  * @param None
- * @return None
+ * @return The number of characters.
  */
-void editorScroll()
+int hlReach()
 {
-    E.rx = 0;
-    if (E.cy < E.numrows)
-    {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
-    }
-
-    if (E.cy < E.rowoff)
-    {
-        E.rowoff = E.cy;
-    }
-    if (E.cy >= E.rowoff + E.screenrows)
+    int reach = E.buf->syntax->kwtable->maxlen + 1;
+    char *delims[] = {E.buf->syntax->singleline_comment_start, E.buf->syntax->multiline_comment_start,
+                      E.buf->syntax->multiline_comment_end};
+    for (int k = 0; k < 3; k++)
     {
-        E.rowoff = E.cy - E.screenrows + 1;
-    }
-    if (E.rx < E.coloff)
-    {
-        E.coloff = E.rx;
-    }
-    if (E.rx >= E.coloff + E.screencols)
-    {
-        E.coloff = E.rx - E.screencols + 1;
+        int len = delims[k] ? strlen(delims[k]) : 0;
+        if (len > reach)
+            reach = len;
     }
+    return reach;
 }
 
 /**
- * Draws the rows of the editor on the screen.
+ * This function lexes the characters of a row from a state until it gets to the given
+ * index, and marks the runs of highlighted characters it finds. Tabs are separators
+ * that can not start a token, so lexing the characters rather than the render gives
+ * the same highlights. The lexer stops on a token boundary, which may be past stop.
  *
- * @param ab The buffer to append the output to.
+ * @param row The row being highlighted.
+ * @param st The state to start from, updated with the state where the lexer stopped.
+ * @param stop The index of the character where to stop.
  * @return None
  */
-void editorDrawRows(struct abuf *ab)
+void editorLex(erow *row, struct hlLexState *st, int stop)
 {
-    for (int y = 0; y < E.screenrows; y++)
+    struct keywordTable *keywords = E.buf->syntax->kwtable;
+    const unsigned char *cls = E.buf->syntax->cls;
+
+    char *scs = E.buf->syntax->singleline_comment_start;
+    char *mcs = E.buf->syntax->multiline_comment_start;
+    char *mce = E.buf->syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int prev_sep = st->sep;
+    int in_string = st->string;
+    int in_comment = st->comment;
+    unsigned char prev_hl = st->prev;
+
+    hlSkipFn skip = E.buf->syntax->skip;
+    int end = row->size < stop ? row->size : stop;
+
+    int i = st->cx;
+    while (i < end)
     {
-        int filerow = y + E.rowoff;
+        char c = row->chars[i];
+        unsigned char cc = cls[(unsigned char)c];
 
-        if (filerow >= E.numrows)
+        // a run of bytes that can't start a token leaves the state as it is
+        if (skip && !in_string && !in_comment && prev_hl != HL_NUMBER &&
+            (prev_sep ? (cc & (HL_CLASS_SEPARATOR | HL_CLASS_QUOTE | HL_CLASS_DELIM | HL_CLASS_DIGIT)) == HL_CLASS_SEPARATOR
+                      : !(cc & (HL_CLASS_SEPARATOR | HL_CLASS_QUOTE | HL_CLASS_DELIM))))
         {
-            if (E.numrows == 0 && y == E.screenrows / 3)
+            int next = skip(E.buf->syntax, row->chars, i, end, prev_sep);
+            if (next > i)
             {
-                char welcome[80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                                          "simple text editor -- version %s", EDITOR_VERSION);
-                if (welcomelen > E.screencols)
-                    welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if (padding)
-                {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while (padding--)
-                    abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
+                i = next;
+                prev_hl = HL_NORMAL;
+                continue;
             }
-            else
+        }
+
+        if (scs_len && !in_string && !in_comment)
+        {
+            if (hlAt(row, i, scs, scs_len))
             {
-                abAppend(ab, "~", 1);
+                hlMark(row, i, row->size - i, HL_COMMENT);
+                i = row->size;
+                prev_hl = HL_COMMENT;
+                break;
             }
         }
-        else
-        {
-            int len = E.row[filerow].size - E.coloff;
-
-            if (len < 0)
-                len = 0;
-
-            if (len > E.screencols)
-                len = E.screencols;
-
-            char *c = &E.row[filerow].render[E.coloff];
-            unsigned char *hl = &E.row[filerow].hl[E.coloff];
 
-            char *current_color = "\x1b[39m";
-
-            for (int j = 0; j < len; j++)
+        if (mcs_len && mce_len && !in_string)
+        {
+            if (in_comment)
             {
-                if (iscntrl(c[j]))
+                prev_hl = HL_MLCOMMENT;
+                if (hlAt(row, i, mce, mce_len))
                 {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    if (strcmp(current_color, "\x1b[39m") != 0)
-                    {
-                        char *color_code = editorSyntaxToColor(hl[j]);
-                        abAppend(ab, color_code, strlen(color_code));
-                    }
+                    hlMark(row, i, mce_len, HL_MLCOMMENT);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
                 }
-                else if (hl[j] == HL_NORMAL)
+                else
                 {
-                    if (strcmp(current_color, "\x1b[39m") != 0)
+                    // nothing but the end of the comment matters in it
+                    int next = i + 1;
+                    if (skip)
                     {
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = "\x1b[39m";
+                        const char *p = memchr(&row->chars[next], mce[0], end - next);
+                        next = p ? p - row->chars : end;
                     }
-                    abAppend(ab, &c[j], 1);
+                    hlMark(row, i, next - i, HL_MLCOMMENT);
+                    i = next;
+                    continue;
                 }
-                else
-                {
-                    char *color = editorSyntaxToColor(hl[j]);
+            }
+            else if (hlAt(row, i, mcs, mcs_len))
+            {
+                hlMark(row, i, mcs_len, HL_MLCOMMENT);
+                i += mcs_len;
+                in_comment = 1;
+                prev_hl = HL_MLCOMMENT;
+                continue;
+            }
+        }
 
-                    if (strcmp(color, current_color) != 0)
-                    {
-                        current_color = color;
-                        char *color_code = editorSyntaxToColor(hl[j]);
-                        abAppend(ab, color_code, strlen(color_code));
-                    }
-                    abAppend(ab, &c[j], 1);
+        if (E.buf->syntax->flags & HL_HIGHLIGHT_STRINGS)
+        {
+            if (in_string)
+            {
+                prev_hl = HL_STRING;
+                if (c == '\\' && i + 1 < row->size)
+                {
+                    hlMark(row, i, 2, HL_STRING);
+                    i += 2;
+                    continue;
+                }
+                hlMark(row, i, 1, HL_STRING);
+                if (c == in_string)
+                    in_string = 0;
+                i++;
+                prev_sep = 1;
+                continue;
+            }
+            else
+            {
+                if (cc & HL_CLASS_QUOTE)
+                {
+                    in_string = c;
+                    hlMark(row, i, 1, HL_STRING);
+                    i++;
+                    prev_hl = HL_STRING;
+                    continue;
                 }
             }
-            abAppend(ab, "\x1b[39m", 5);
         }
 
-        // [K - erase in line
-        abAppend(ab, "\x1b[K", 3);
+        if (E.buf->syntax->flags & HL_HIGHLIGHT_NUMBERS)
+        {
+            if (((cc & HL_CLASS_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER))
+            {
+                hlMark(row, i, 1, HL_NUMBER);
+                i++;
+                prev_sep = 0;
+                prev_hl = HL_NUMBER;
+                continue;
+            }
+        }
+
+        if (prev_sep)
+        {
+            // a word longer than every keyword is not one, however long it is
+            int klen = 0;
+            while (i + klen < row->size && klen <= keywords->maxlen &&
+                   !(cls[(unsigned char)row->chars[i + klen]] & HL_CLASS_SEPARATOR))
+                klen++;
+            int kw = kwLookup(keywords, &row->chars[i], klen);
+            if (kw != HL_NORMAL)
+            {
+                hlMark(row, i, klen, kw);
+                i += klen;
+                prev_sep = 0;
+                prev_hl = kw;
+                continue;
+            }
+        }
 
-        //
-        abAppend(ab, "\r\n", 2);
+        prev_sep = cc & HL_CLASS_SEPARATOR;
+        prev_hl = HL_NORMAL;
+        i++;
     }
+
+    st->cx = i;
+    st->sep = prev_sep;
+    st->string = in_string;
+    st->comment = in_comment;
+    st->prev = prev_hl;
 }
 
 /**
- * Draws the status bar on the screen.
+ * Makes room in the marks of a long row for one more at the given index.
  *
- * @param ab The buffer to append the status bar content to.
+ * @param row The row.
+ * @param k Where the new mark goes.
  * @return None
  */
-void editorDrawStatusBar(struct abuf *ab)
+void editorRowMarksOpen(erow *row, int k)
 {
-    // [7m - invert colors
-    abAppend(ab, "\x1b[7m", 4);
-
-    char status[80], rstatus[80];
-
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       E.filename ? E.filename : "[No Name]", E.numrows,
-                       E.modified ? "(modified)" : "");
-
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d / %d",
-                        E.syntax ? E.syntax->filetype : "no filetype", E.cy + 1, E.numrows);
-
-    if (len > E.screencols)
-        len = E.screencols;
-
-    abAppend(ab, status, len);
-
-    while (len < E.screencols)
-    {
-        if (E.screencols - len == rlen)
-        {
-            abAppend(ab, rstatus, rlen);
-            break;
-        }
-        else
-        {
-            abAppend(ab, "", 1);
-            len++;
-        }
-    }
-
-    // [m - reset colors
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
+    size_t need = (row->nmarks + 1) * sizeof(struct hlLexState);
+    row->marks = (struct hlLexState *)raGrow((char *)row->marks, &row->markscap, need,
+                                             row->nmarks * sizeof(struct hlLexState));
+    memmove(&row->marks[k + 1], &row->marks[k], (row->nmarks - k) * sizeof(struct hlLexState));
+    row->nmarks++;
 }
 
 /**
- * Draws the message bar on the screen.
+ * Updates the marks of a long row for text replaced in it: the marks past the change
+ * move with the text and are only trusted again once the lexer finds the same state at
+ * one of them.
  *
- * @param ab The output buffer to append the message bar to.
+ * @param row The row, whose marks were taken before the change.
+ * @param col The index of the first character that changed.
+ * @param removed The number of characters removed.
+ * @param added The number of characters inserted.
  * @return None
  */
-void editorDrawMessageBar(struct abuf *ab)
+void editorRowMarksEdit(erow *row, int col, int removed, int added)
 {
-    abAppend(ab, "\x1b[K", 3);
-    int msglen = strlen(E.statusmsg);
+    int reach = E.buf->syntax ? hlReach() : 0;
+    int k = 0;
+    while (k < row->nmarks && row->marks[k].cx + reach <= col)
+        k++;
+    if (row->ntrusted > k)
+        row->ntrusted = k;
+
+    int w = k;
+    for (int j = k; j < row->nmarks; j++)
+    {
+        struct hlLexState m = row->marks[j];
+        if (m.cx < col + removed)
+            continue;
+        m.cx += added - removed;
+        row->marks[w++] = m;
+    }
+    row->nmarks = w;
+    row->hlpending = 1;
+}
 
-    if (msglen > E.screencols)
-        msglen = E.screencols;
+/**
+ * Lexes a long row again from its last trusted mark, to find the multi-line comment state
+ * it leaves open, taking new marks every EDITOR_LONG_SEGMENT characters on the way.
+ * Reaching one of the marks moved by an edit in the state it has means that the rest
+ * of the row lexes as it did, so the state it leaves open did not change either.
+ *
+ * @param row The long row.
+ * @param start The state the row starts in.
+ * @return None
+ */
+void editorLexSettle(erow *row, struct hlLexState start)
+{
+    // only the spans of the window are wanted, and they are computed afterwards
+    int hla = row->hla, hlb = row->hlb;
+    row->hla = row->hlb = 0;
+
+    int k = row->ntrusted;
+    struct hlLexState st = k > 0 ? row->marks[k - 1] : start;
+    for (;;)
+    {
+        int stop = st.cx + EDITOR_LONG_SEGMENT;
+        if (k < row->nmarks && row->marks[k].cx < stop)
+            stop = row->marks[k].cx;
+        editorLex(row, &st, stop);
+        if (st.cx >= row->size)
+            break;
+
+        // marks the lexer stepped over are not on a token boundary any more
+        int skip = k;
+        while (skip < row->nmarks && row->marks[skip].cx < st.cx)
+            skip++;
+        if (skip > k)
+        {
+            memmove(&row->marks[k], &row->marks[skip], (row->nmarks - skip) * sizeof(struct hlLexState));
+            row->nmarks -= skip - k;
+        }
+
+        if (k < row->nmarks && row->marks[k].cx == st.cx)
+        {
+            struct hlLexState *m = &row->marks[k];
+            if (m->comment == st.comment && m->string == st.string &&
+                m->sep == st.sep && m->prev == st.prev)
+            {
+                k = row->nmarks;
+                break;
+            }
+            *m = st;
+        }
+        else
+        {
+            editorRowMarksOpen(row, k);
+            row->marks[k] = st;
+        }
+        k++;
+    }
+
+    if (st.cx >= row->size)
+    {
+        row->nmarks = k;
+        row->hlout = st.comment;
+    }
+    row->ntrusted = k;
+    row->hlpending = 0;
+    row->hla = hla;
+    row->hlb = hlb;
+}
+
+/**
+ * This function updates the syntax highlighting for a specific row in the editor.
+ * It takes a pointer to the row structure and rebuilds the runs of highlighted columns
+ * based on the characters of the row; a long row only gets the runs of the characters
+ * it was rendered for. The multi-line comment state left open by the row is stored in
+ * E.buf->hlstate. When it changes, the next row is flagged HL_STATE_STALE instead of being
+ * highlighted again right away.
+ *
+ * @param row The row to update the syntax highlighting for.
+ * @return None
+ */
+void editorUpdateSyntax(erow *row)
+{
+    row->nspans = 0;
+
+    // the state the row starts in is not known yet
+    if (row->hlin < 0)
+        return;
+
+    if (E.buf->syntax == NULL)
+    {
+        E.buf->hlstate[row->idx] = 0;
+        return;
+    }
+
+    int in = (row->idx > 0 && (E.buf->hlstate[row->idx - 1] & HL_STATE_COMMENT));
+    struct hlLexState st = {0, in, 0, 1, HL_NORMAL};
+
+    int in_comment;
+    if (row->size > EDITOR_LONG_LINE)
+    {
+        if (row->hlpending)
+            editorLexSettle(row, st);
+        in_comment = row->hlout;
+
+        int lo = 0, hi = row->nmarks;
+        while (lo < hi)
+        {
+            int mid = lo + (hi - lo) / 2;
+            if (row->marks[mid].cx <= row->hla)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0)
+            st = row->marks[lo - 1];
+        editorLex(row, &st, row->hlb);
+    }
+    else
+    {
+        editorLex(row, &st, row->size);
+        in_comment = st.comment;
+    }
+
+    int changed = ((E.buf->hlstate[row->idx] & HL_STATE_COMMENT) != in_comment);
+    E.buf->hlstate[row->idx] = in_comment;
+    if (changed && row->idx + 1 < E.buf->hlvalid)
+    {
+        E.buf->hlstate[row->idx + 1] |= HL_STATE_STALE;
+        if (E.buf->hlstale > row->idx + 1)
+            E.buf->hlstale = row->idx + 1;
+    }
+}
+
+/**
+ * Returns the ANSI escape code for the specified syntax highlight.
+ *
+ * @param hl The syntax highlight value.
+ * @return The ANSI escape code for the specified syntax highlight.
+ */
+char *editorSyntaxToColor(int hl)
+{
+    switch (hl)
+    {
+    case HL_COMMENT:
+    case HL_MLCOMMENT:
+        return "\x1b[38;2;98;114;164m";
+
+    case HL_KEYWORD1:
+        return "\x1b[38;2;255;121;198m";
+
+    case HL_KEYWORD2:
+        return "\x1b[38;2;156;220;254m";
 
-    if (msglen && time(NULL) - E.statusmsg_time < 5)
-        abAppend(ab, E.statusmsg, msglen);
+    case HL_STRING:
+        return "\x1b[38;2;241;250;140m";
+
+    case HL_NUMBER:
+        return "\x1b[38;2;189;147;249m";
+
+    case HL_MATCH:
+        return "\x1b[38;2;68;71;90m";
+
+    default:
+        return "\x1b[39m";
+    }
 }
 
 /**
- * Refreshes the screen by redrawing all the elements of the text editor.
+ * Selects the appropriate syntax highlighting for the current file based on its extension.
+ * If no file is currently open, the function returns without making any changes.
+ * The syntaxes of E.langs are tried in order, the first one with a pattern matching the file
+ * name winning; the extensions are found in E.langext rather than compared one by one.
+ * Once a match is found, the corresponding syntax structure is assigned to E.buf->syntax.
+ * Nothing is highlighted here: rows are highlighted when they are drawn.
  *
  * @param None
  * @return None
  */
-void editorRefreshScreen()
+void editorSelectSyntaxHighlight()
 {
-    editorScroll();
+    // rows are highlighted again when they are drawn
+    hlJobCancel();
+    E.buf->syntax = NULL;
+    E.buf->hlvalid = 0;
+    E.buf->hlstale = 0;
+    for (int j = 0; j < E.rowcachelen; j++)
+        E.rowcache[j].dirty = 1;
+
+    if (E.buf->filename == NULL)
+        return;
 
-    struct abuf ab = ABUF_INIT;
+    // the extension is looked up; only the syntaxes before the one it finds can
+    // still match first, with a pattern that is not an extension
+    char *ext = strrchr(E.buf->filename, '.');
+    int found = -1;
+    if (ext && E.langext)
+    {
+        int len = strlen(ext);
+        for (unsigned int h = kwHash(0, ext, len);; h++)
+        {
+            struct syntaxMatch *m = &E.langext[h & E.langextmask];
+            if (m->ext == NULL)
+                break;
+            if (!strcmp(m->ext, ext))
+            {
+                found = m->lang;
+                break;
+            }
+        }
+    }
 
-    // [?25l - hide cursor
-    abAppend(&ab, "\x1b[?25l", 6);
+    int upto = found >= 0 ? found : E.nlangs;
+    for (int j = 0; j < upto; j++)
+    {
+        char **match = E.langs[j].filematch;
+        for (int i = 0; match[i]; i++)
+        {
+            if (match[i][0] != '.' && strstr(E.buf->filename, match[i]))
+            {
+                E.buf->syntax = &E.langs[j];
+                return;
+            }
+        }
+    }
+    if (found >= 0)
+        E.buf->syntax = &E.langs[found];
+}
 
-    // [H - position cursor
-    abAppend(&ab, "\x1b[H", 3);
+/*** line index ***/
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+/**
+ * @struct lineIndex
+ * @brief The offsets of the newlines of a buffer, as built by the newline scanner.
+ */
+struct lineIndex
+{
+    size_t *nl;   ///< Offsets of the newlines.
+    size_t count; ///< Number of newlines.
+    size_t cap;   ///< Capacity of the nl array.
+    int cr;       ///< Set when the buffer contains a carriage return.
+};
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-    abAppend(&ab, buf, strlen(buf));
+/**
+ * @brief A newline scanner, appending the offsets of the newlines of buf plus base to li.
+ */
+typedef void (*liScanFn)(struct lineIndex *li, const char *buf, size_t len, size_t base);
 
-    abAppend(&ab, "\x1b[?25h", 6);
+/**
+ * @struct lineIndexChunk
+ * @brief A part of a buffer scanned by a worker thread into its own index.
+ */
+struct lineIndexChunk
+{
+    struct lineIndex li; ///< The newlines found in the chunk.
+    const char *buf;     ///< The start of the chunk.
+    size_t len;          ///< The length of the chunk.
+    size_t base;         ///< The offset of the chunk in the buffer.
+    liScanFn scan;       ///< The scanner to use.
+};
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+/**
+ * Makes room for at least n more offsets in a line index.
+ *
+ * @param li The line index.
+ * @param n The number of offsets about to be added.
+ * @return None
+ */
+void liReserve(struct lineIndex *li, size_t n)
+{
+    if (li->count + n <= li->cap)
+        return;
+
+    size_t cap = li->cap ? li->cap : 1024;
+    while (cap < li->count + n)
+        cap *= 2;
+    li->nl = realloc(li->nl, sizeof(size_t) * cap);
+    if (li->nl == NULL)
+        die("realloc");
+    li->cap = cap;
 }
 
 /**
- * This function takes a format string and a variable number of arguments, similar to the `printf` function.
- * It formats the message according to the format string and stores it in the `E.statusmsg` buffer.
- * The formatted message is truncated if it exceeds the size of the buffer.
- * The current time is also stored in `E.statusmsg_time` to track when the status message was set.
+ * Scans a buffer for newlines one byte at a time. This is the reference every
+ * vectorized scanner has to agree with, and the one they use for their tail.
  *
- * @param fmt The format string for the status message.
- * @param ... The variable number of arguments to be formatted.
+ * @param li The line index receiving the offsets.
+ * @param buf The buffer to scan.
+ * @param len The length of the buffer.
+ * @param base The offset added to every newline position.
  * @return None
  */
-void editorSetStatusMessage(const char *fmt, ...)
+void liScanScalar(struct lineIndex *li, const char *buf, size_t len, size_t base)
 {
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
-    va_end(ap);
-    E.statusmsg_time = time(NULL);
+    for (size_t i = 0; i < len; i++)
+    {
+        if (buf[i] == '\n')
+        {
+            liReserve(li, 1);
+            li->nl[li->count++] = base + i;
+        }
+        else if (buf[i] == '\r')
+        {
+            li->cr = 1;
+        }
+    }
 }
 
-/*** input ***/
+#ifdef __SSE2__
+/**
+ * Scans a buffer for newlines 16 bytes at a time with SSE2.
+ *
+ * @param li The line index receiving the offsets.
+ * @param buf The buffer to scan.
+ * @param len The length of the buffer.
+ * @param base The offset added to every newline position.
+ * @return None
+ */
+void liScanSSE2(struct lineIndex *li, const char *buf, size_t len, size_t base)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    unsigned int crmask = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&buf[i]);
+        unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        crmask |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+
+        if (m)
+        {
+            liReserve(li, 16);
+            while (m)
+            {
+                li->nl[li->count++] = base + i + __builtin_ctz(m);
+                m &= m - 1;
+            }
+        }
+    }
+    if (crmask)
+        li->cr = 1;
+
+    liScanScalar(li, &buf[i], len - i, base + i);
+}
+#endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
 /**
- * This function displays a prompt message to the user and waits for the user to enter text.
- * The entered text is stored in a dynamically allocated string and returned to the caller.
- * The function also accepts an optional callback function that can be used to perform additional actions on the entered text.
+ * Scans a buffer for newlines 32 bytes at a time with AVX2. It is compiled for
+ * AVX2 on its own and only called when the CPU supports it.
  *
- * @param prompt The prompt message to display to the user.
- * @param callback A pointer to a function that takes a char pointer and an integer as arguments.
- *                 This function will be called with the entered text and the last key pressed as arguments.
- *                 Pass NULL if no callback function is needed.
- * @return The entered text as a dynamically allocated string.
- *         Returns NULL if the user cancels the input by pressing the escape key.
+ * @param li The line index receiving the offsets.
+ * @param buf The buffer to scan.
+ * @param len The length of the buffer.
+ * @param base The offset added to every newline position.
+ * @return None
  */
-char *editorPrompt(char *prompt, void (*callback)(char *, int))
+__attribute__((target("avx2"))) void liScanAVX2(struct lineIndex *li, const char *buf, size_t len, size_t base)
 {
-    size_t bufsize = 128;
-    char *buf = malloc(bufsize);
-    size_t buflen = 0;
-    buf[0] = '\0';
-    while (1)
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    unsigned int crmask = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
     {
-        editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
-        int c = editorReadKey();
-        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+        __m256i v = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        crmask |= (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+
+        if (m)
         {
-            if (buflen != 0)
-                buf[--buflen] = '\0';
+            liReserve(li, 32);
+            while (m)
+            {
+                li->nl[li->count++] = base + i + __builtin_ctz(m);
+                m &= m - 1;
+            }
         }
-        else if (c == '\x1b')
+    }
+    if (crmask)
+        li->cr = 1;
+
+    liScanScalar(li, &buf[i], len - i, base + i);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+/**
+ * Scans a buffer for newlines 16 bytes at a time with NEON. NEON has no movemask,
+ * so the comparison is narrowed to a 64-bit mask holding 4 bits per byte.
+ *
+ * @param li The line index receiving the offsets.
+ * @param buf The buffer to scan.
+ * @param len The length of the buffer.
+ * @param base The offset added to every newline position.
+ * @return None
+ */
+void liScanNEON(struct lineIndex *li, const char *buf, size_t len, size_t base)
+{
+    const uint8x16_t lf = vdupq_n_u8('\n');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    uint8x16_t crseen = vdupq_n_u8(0);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        uint8x16_t v = vld1q_u8((const uint8_t *)&buf[i]);
+        uint8x16_t eq = vceqq_u8(v, lf);
+        crseen = vorrq_u8(crseen, vceqq_u8(v, cr));
+
+        uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (m)
         {
-            editorSetStatusMessage("");
-            if (callback)
-                callback(buf, c);
-            free(buf);
-            return NULL;
+            liReserve(li, 16);
+            while (m)
+            {
+                li->nl[li->count++] = base + i + (__builtin_ctzll(m) >> 2);
+                m &= ~(0xfull << (__builtin_ctzll(m) & ~3));
+            }
+        }
+    }
+    if (vmaxvq_u8(crseen))
+        li->cr = 1;
+
+    liScanScalar(li, &buf[i], len - i, base + i);
+}
+#endif
+
+/**
+ * Picks the fastest newline scanner the CPU supports.
+ *
+ * @param None
+ * @return The scanner function.
+ */
+liScanFn liScanner()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("avx2"))
+        return liScanAVX2;
+#endif
+#ifdef __SSE2__
+    return liScanSSE2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return liScanNEON;
+#else
+    return liScanScalar;
+#endif
+}
+
+/**
+ * Thread entry point scanning one chunk of a buffer.
+ *
+ * @param arg The lineIndexChunk to scan.
+ * @return NULL
+ */
+void *liScanWorker(void *arg)
+{
+    struct lineIndexChunk *c = arg;
+    c->scan(&c->li, c->buf, c->len, c->base);
+    return NULL;
+}
+
+/**
+ * Builds the newline index of a buffer. Buffers above EDITOR_PARALLEL_SCAN are split
+ * into chunks scanned by worker threads, whose indexes are then concatenated in order.
+ *
+ * @param li An empty line index receiving the offsets.
+ * @param buf The buffer to scan.
+ * @param len The length of the buffer.
+ * @return None
+ */
+void liBuild(struct lineIndex *li, const char *buf, size_t len)
+{
+    liScanFn scan = liScanner();
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = (ncpu > EDITOR_SCAN_THREADS) ? EDITOR_SCAN_THREADS : (int)ncpu;
+
+    if (len < EDITOR_PARALLEL_SCAN || n < 2)
+    {
+        scan(li, buf, len, 0);
+        return;
+    }
+
+    struct lineIndexChunk chunks[EDITOR_SCAN_THREADS];
+    pthread_t threads[EDITOR_SCAN_THREADS];
+    int started[EDITOR_SCAN_THREADS];
+    size_t step = len / n;
+
+    for (int j = 0; j < n; j++)
+    {
+        memset(&chunks[j].li, 0, sizeof(chunks[j].li));
+        chunks[j].base = j * step;
+        chunks[j].buf = &buf[chunks[j].base];
+        chunks[j].len = (j == n - 1) ? len - chunks[j].base : step;
+        chunks[j].scan = scan;
+
+        // a chunk whose thread can't be started is scanned here instead
+        started[j] = (pthread_create(&threads[j], NULL, liScanWorker, &chunks[j]) == 0);
+        if (!started[j])
+            liScanWorker(&chunks[j]);
+    }
+
+    size_t total = 0;
+    for (int j = 0; j < n; j++)
+    {
+        if (started[j])
+            pthread_join(threads[j], NULL);
+        total += chunks[j].li.count;
+    }
+
+    liReserve(li, total);
+    for (int j = 0; j < n; j++)
+    {
+        memcpy(&li->nl[li->count], chunks[j].li.nl, sizeof(size_t) * chunks[j].li.count);
+        li->count += chunks[j].li.count;
+        li->cr |= chunks[j].li.cr;
+        free(chunks[j].li.nl);
+    }
+}
+
+/*** piece table ***/
+
+/**
+ * Returns the next value of the xorshift generator used for the treap priorities.
+ *
+ * @param pt The piece table owning the generator.
+ * @return A pseudo-random priority.
+ */
+unsigned int ptRandom(struct pieceTable *pt)
+{
+    unsigned int x = pt->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pt->seed = x;
+    return x;
+}
+
+/**
+ * Returns the index of the first entry of a sorted offset array that is not less than a value.
+ *
+ * @param a The sorted array.
+ * @param n The number of entries of the array.
+ * @param v The value to look for.
+ * @return The index of the first entry >= v, or n if there is none.
+ */
+size_t ptLowerBound(const size_t *a, size_t n, size_t v)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Counts the newlines of a range of one of the buffers using its newline index.
+ *
+ * @param pt The piece table.
+ * @param buf The buffer of the range.
+ * @param start The offset of the range in the buffer.
+ * @param len The length of the range.
+ * @return The number of newlines in the range.
+ */
+size_t ptCountNewlines(struct pieceTable *pt, int buf, size_t start, size_t len)
+{
+    return ptLowerBound(pt->nl[buf], pt->nlcount[buf], start + len) -
+           ptLowerBound(pt->nl[buf], pt->nlcount[buf], start);
+}
+
+/**
+ * Recomputes the subtree totals of a node from its piece and its children.
+ *
+ * @param n The node to update.
+ * @return None
+ */
+void ptUpdate(pnode *n)
+{
+    n->sublen = n->len;
+    n->sublf = n->lf;
+    if (n->left)
+    {
+        n->sublen += n->left->sublen;
+        n->sublf += n->left->sublf;
+    }
+    if (n->right)
+    {
+        n->sublen += n->right->sublen;
+        n->sublf += n->right->sublf;
+    }
+}
+
+/**
+ * Allocates a node for a piece of one of the buffers.
+ *
+ * @param pt The piece table.
+ * @param buf The buffer the piece points into.
+ * @param start The offset of the piece in the buffer.
+ * @param len The length of the piece.
+ * @return The new node.
+ */
+pnode *ptNewNode(struct pieceTable *pt, int buf, size_t start, size_t len)
+{
+    pnode *n = malloc(sizeof(pnode));
+    if (n == NULL)
+        die("malloc");
+
+    n->left = NULL;
+    n->right = NULL;
+    n->prio = ptRandom(pt);
+    n->buf = buf;
+    n->start = start;
+    n->len = len;
+    n->lf = ptCountNewlines(pt, buf, start, len);
+    ptUpdate(n);
+    return n;
+}
+
+/**
+ * Concatenates two piece trees, every piece of a coming before every piece of b.
+ *
+ * @param a The left tree.
+ * @param b The right tree.
+ * @return The root of the merged tree.
+ */
+pnode *ptMerge(pnode *a, pnode *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+
+    if (a->prio > b->prio)
+    {
+        a->right = ptMerge(a->right, b);
+        ptUpdate(a);
+        return a;
+    }
+    b->left = ptMerge(a, b->left);
+    ptUpdate(b);
+    return b;
+}
+
+/**
+ * Splits a piece tree at a byte offset, cutting the piece that contains the offset in two.
+ *
+ * @param pt The piece table.
+ * @param t The tree to split.
+ * @param off The offset of the split, relative to the start of the tree.
+ * @param l Receives the tree holding the bytes before the offset.
+ * @param r Receives the tree holding the bytes from the offset on.
+ * @return None
+ */
+void ptSplit(struct pieceTable *pt, pnode *t, size_t off, pnode **l, pnode **r)
+{
+    if (t == NULL)
+    {
+        *l = NULL;
+        *r = NULL;
+        return;
+    }
+
+    size_t lsize = t->left ? t->left->sublen : 0;
+
+    if (off <= lsize)
+    {
+        ptSplit(pt, t->left, off, l, &t->left);
+        ptUpdate(t);
+        *r = t;
+    }
+    else if (off >= lsize + t->len)
+    {
+        ptSplit(pt, t->right, off - lsize - t->len, &t->right, r);
+        ptUpdate(t);
+        *l = t;
+    }
+    else
+    {
+        size_t k = off - lsize;
+        pnode *tail = ptNewNode(pt, t->buf, t->start + k, t->len - k);
+        t->len = k;
+        t->lf -= tail->lf;
+
+        *r = ptMerge(tail, t->right);
+        t->right = NULL;
+        ptUpdate(t);
+        *l = t;
+    }
+}
+
+/**
+ * Frees every node of a piece tree.
+ *
+ * @param t The root of the tree.
+ * @return None
+ */
+void ptFreeNodes(pnode *t)
+{
+    while (t)
+    {
+        pnode *right = t->right;
+        ptFreeNodes(t->left);
+        free(t);
+        t = right;
+    }
+}
+
+/**
+ * Initializes an empty piece table.
+ *
+ * @param pt The piece table to initialize.
+ * @return None
+ */
+void ptInit(struct pieceTable *pt)
+{
+    memset(pt, 0, sizeof(*pt));
+    pt->seed = 2463534242u;
+}
+
+/**
+ * Frees the buffers and the pieces of a piece table and leaves it empty.
+ *
+ * @param pt The piece table to free.
+ * @return None
+ */
+void ptFree(struct pieceTable *pt)
+{
+    ptFreeNodes(pt->root);
+    // a shared original buffer goes with the last piece table reading it
+    if (pt->shared == NULL || --*pt->shared == 0)
+    {
+        if (pt->mapped)
+            munmap(pt->buf[PT_ORIGINAL], pt->len[PT_ORIGINAL]);
+        else
+            free(pt->buf[PT_ORIGINAL]);
+        if (pt->nlmap)
+            munmap(pt->nlmap, pt->nlmaplen);
+        else
+            free(pt->nl[PT_ORIGINAL]);
+        free(pt->shared);
+    }
+    free(pt->buf[PT_ADD]);
+    free(pt->nl[PT_ADD]);
+
+    unsigned long version = pt->version + 1;
+    ptInit(pt);
+    pt->version = version;
+}
+
+/**
+ * Appends text to the add buffer, indexing its newlines.
+ *
+ * @param pt The piece table.
+ * @param s The text to append.
+ * @param len The length of the text.
+ * @return The offset of the text in the add buffer.
+ */
+size_t ptAppend(struct pieceTable *pt, const char *s, size_t len)
+{
+    size_t start = pt->len[PT_ADD];
+
+    if (start + len > pt->addcap)
+    {
+        size_t cap = pt->addcap ? pt->addcap : 1024;
+        while (cap < start + len)
+            cap *= 2;
+        if (pt->pinned)
+        {
+            // the buffer is append-only, so a snapshot still reads the same text in the old one
+            char *grown = malloc(cap);
+            if (grown == NULL)
+                die("malloc");
+            memcpy(grown, pt->buf[PT_ADD], start);
+            pt->retired = realloc(pt->retired, (pt->nretired + 1) * sizeof(char *));
+            pt->retired[pt->nretired++] = pt->buf[PT_ADD];
+            pt->buf[PT_ADD] = grown;
+        }
+        else
+        {
+            pt->buf[PT_ADD] = realloc(pt->buf[PT_ADD], cap);
+            if (pt->buf[PT_ADD] == NULL)
+                die("realloc");
+        }
+        pt->addcap = cap;
+    }
+    memcpy(&pt->buf[PT_ADD][start], s, len);
+    pt->len[PT_ADD] += len;
+
+    const char *p = s;
+    const char *end = s + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL)
+    {
+        if (pt->nlcount[PT_ADD] == pt->nlcap)
+        {
+            pt->nlcap = pt->nlcap ? pt->nlcap * 2 : 256;
+            pt->nl[PT_ADD] = realloc(pt->nl[PT_ADD], sizeof(size_t) * pt->nlcap);
+            if (pt->nl[PT_ADD] == NULL)
+                die("realloc");
+        }
+        pt->nl[PT_ADD][pt->nlcount[PT_ADD]++] = start + (p - s);
+        p++;
+    }
+    return start;
+}
+
+/**
+ * Appends a piece after every other piece of the document.
+ *
+ * @param pt The piece table.
+ * @param buf The buffer the piece points into.
+ * @param start The offset of the piece in the buffer.
+ * @param len The length of the piece.
+ * @return None
+ */
+void ptAppendPiece(struct pieceTable *pt, int buf, size_t start, size_t len)
+{
+    if (len > 0)
+        pt->root = ptMerge(pt->root, ptNewNode(pt, buf, start, len));
+}
+
+/**
+ * Appends a range of the original buffer after every other piece of the document,
+ * normalized the way ptLoad normalizes a file. The newlines of the range have to be
+ * in the newline index of the buffer already.
+ *
+ * @param pt The piece table.
+ * @param from The offset of the range, which starts a line.
+ * @param to The end of the range: just after a newline, or the end of the buffer.
+ * @param cr Set when the range may hold carriage returns.
+ * @return None
+ */
+void ptLoadRange(struct pieceTable *pt, size_t from, size_t to, int cr)
+{
+    const char *buf = pt->buf[PT_ORIGINAL];
+    const size_t *nl = pt->nl[PT_ORIGINAL];
+    size_t first = ptLowerBound(nl, pt->nlcount[PT_ORIGINAL], from);
+    pt->cr |= cr;
+    size_t end = ptLowerBound(nl, pt->nlcount[PT_ORIGINAL], to);
+
+    // a piece runs until a line that ends with carriage returns, which are cut out
+    size_t start = from;
+    for (size_t i = first; cr && i < end; i++)
+    {
+        size_t e = nl[i];
+        while (e > start && buf[e - 1] == '\r')
+            e--;
+        if (e < nl[i])
+        {
+            ptAppendPiece(pt, PT_ORIGINAL, start, e - start);
+            start = nl[i];
+        }
+    }
+
+    size_t last = end > first ? nl[end - 1] + 1 : from;
+    if (last < to)
+    {
+        size_t e = to;
+        while (e > start && buf[e - 1] == '\r')
+            e--;
+        ptAppendPiece(pt, PT_ORIGINAL, start, e - start);
+        ptAppendPiece(pt, PT_ADD, ptAppend(pt, "\n", 1), 1);
+    }
+    else
+    {
+        ptAppendPiece(pt, PT_ORIGINAL, start, to - start);
+    }
+}
+
+/**
+ * Loads a file into an empty piece table, making its contents the original buffer.
+ * The text is normalized the same way the rows of a file have always been read:
+ * carriage returns before a newline are left out and a missing final newline is added.
+ *
+ * @param pt The piece table, which takes the ownership of buf.
+ * @param buf The contents of the file.
+ * @param len The length of the contents.
+ * @param mapped Whether buf is a mapping of the file, to be unmapped instead of freed.
+ * @return None
+ */
+void ptLoad(struct pieceTable *pt, char *buf, size_t len, int mapped)
+{
+    pt->version++;
+    pt->buf[PT_ORIGINAL] = buf;
+    pt->len[PT_ORIGINAL] = len;
+    pt->mapped = mapped;
+
+    struct lineIndex li = {0};
+    liBuild(&li, buf, len);
+    pt->nl[PT_ORIGINAL] = li.nl;
+    pt->nlcount[PT_ORIGINAL] = li.count;
+
+    ptLoadRange(pt, 0, len, li.cr);
+}
+
+/**
+ * Loads into an empty piece table the original buffer of another one, which both
+ * then share with its newline index, instead of reading and indexing the file again.
+ * The document is the original buffer as ptLoad normalized it, whatever edits the
+ * other piece table made since.
+ *
+ * @param pt The piece table.
+ * @param from The piece table whose original buffer is shared, with all of it indexed.
+ * @return None
+ */
+void ptShare(struct pieceTable *pt, struct pieceTable *from)
+{
+    if (from->shared == NULL)
+    {
+        from->shared = malloc(sizeof(int));
+        if (from->shared == NULL)
+            die("malloc");
+        *from->shared = 1;
+    }
+    (*from->shared)++;
+
+    pt->version++;
+    pt->shared = from->shared;
+    pt->buf[PT_ORIGINAL] = from->buf[PT_ORIGINAL];
+    pt->len[PT_ORIGINAL] = from->len[PT_ORIGINAL];
+    pt->nl[PT_ORIGINAL] = from->nl[PT_ORIGINAL];
+    pt->nlcount[PT_ORIGINAL] = from->nlcount[PT_ORIGINAL];
+    pt->nlmap = from->nlmap;
+    pt->nlmaplen = from->nlmaplen;
+    pt->mapped = from->mapped;
+
+    ptLoadRange(pt, 0, pt->len[PT_ORIGINAL], from->cr);
+}
+
+/**
+ * Returns the length of the document in bytes.
+ *
+ * @param pt The piece table.
+ * @return The length of the document.
+ */
+size_t ptLength(struct pieceTable *pt)
+{
+    return pt->root ? pt->root->sublen : 0;
+}
+
+/**
+ * Returns the number of lines of the document, which is its number of newlines.
+ *
+ * @param pt The piece table.
+ * @return The number of lines.
+ */
+size_t ptLineCount(struct pieceTable *pt)
+{
+    return pt->root ? pt->root->sublf : 0;
+}
+
+/**
+ * Returns the offset of the first byte of a line of the document.
+ *
+ * @param pt The piece table.
+ * @param line The index of the line.
+ * @return The offset of the line, or the length of the document past the last line.
+ */
+size_t ptLineStart(struct pieceTable *pt, size_t line)
+{
+    if (line == 0)
+        return 0;
+
+    size_t off = 0;
+    pnode *t = pt->root;
+    while (t)
+    {
+        size_t llf = t->left ? t->left->sublf : 0;
+        if (line <= llf)
+        {
+            t = t->left;
+            continue;
+        }
+
+        size_t lsize = t->left ? t->left->sublen : 0;
+        line -= llf;
+        if (line <= t->lf)
+        {
+            // the (line)th newline of the piece ends the previous line
+            size_t first = ptLowerBound(pt->nl[t->buf], pt->nlcount[t->buf], t->start);
+            return off + lsize + (pt->nl[t->buf][first + line - 1] - t->start) + 1;
+        }
+        line -= t->lf;
+        off += lsize + t->len;
+        t = t->right;
+    }
+    return off;
+}
+
+/**
+ * Returns the line of the document an offset is on, which is the number of
+ * newlines before it.
+ *
+ * @param pt The piece table.
+ * @param off The offset.
+ * @return The index of the line.
+ */
+size_t ptLineOf(struct pieceTable *pt, size_t off)
+{
+    size_t line = 0;
+    pnode *t = pt->root;
+    while (t)
+    {
+        size_t lsize = t->left ? t->left->sublen : 0;
+        if (off < lsize)
+        {
+            t = t->left;
+            continue;
+        }
+
+        off -= lsize;
+        line += t->left ? t->left->sublf : 0;
+        if (off < t->len)
+            return line + ptCountNewlines(pt, t->buf, t->start, off);
+        line += t->lf;
+        off -= t->len;
+        t = t->right;
+    }
+    return line;
+}
+
+/**
+ * Calls a function on the pieces of a subtree that end after an offset, in
+ * document order, until it returns nonzero.
+ *
+ * @param pt The piece table.
+ * @param t The root of the subtree.
+ * @param base The offset of the subtree in the document.
+ * @param from The offset the visit starts at.
+ * @param fn The function, given the text of a piece, its length and its offset.
+ * @param arg The argument passed to the function.
+ * @return Nonzero when the function stopped the visit.
+ */
+int ptVisitNode(struct pieceTable *pt, pnode *t, size_t base, size_t from,
+                int (*fn)(void *, const char *, size_t, size_t), void *arg)
+{
+    while (t)
+    {
+        size_t lsize = t->left ? t->left->sublen : 0;
+        if (from < base + lsize && ptVisitNode(pt, t->left, base, from, fn, arg))
+            return 1;
+        base += lsize;
+        if (from < base + t->len && fn(arg, &pt->buf[t->buf][t->start], t->len, base))
+            return 1;
+        base += t->len;
+        t = t->right;
+    }
+    return 0;
+}
+
+/**
+ * Calls a function on the pieces of the document that end after an offset, in
+ * document order, until it returns nonzero.
+ *
+ * @param pt The piece table.
+ * @param from The offset the visit starts at.
+ * @param fn The function, given the text of a piece, its length and its offset.
+ * @param arg The argument passed to the function.
+ * @return None
+ */
+void ptVisit(struct pieceTable *pt, size_t from, int (*fn)(void *, const char *, size_t, size_t), void *arg)
+{
+    ptVisitNode(pt, pt->root, 0, from, fn, arg);
+}
+
+/**
+ * @struct pieceSnapshot
+ * @brief The text of the document at some version, as the list of its pieces.
+ */
+struct pieceSnapshot
+{
+    struct iovec *iov;       ///< The text of the pieces, in document order.
+    struct pieceExtent *ext; ///< Where the pieces are, in the document and in the buffers.
+    int count;               ///< The number of pieces.
+    int cap;                 ///< The capacity of iov and ext.
+    size_t len;              ///< The length of the document.
+};
+
+/**
+ * Adds the pieces of a subtree to a snapshot.
+ *
+ * @param pt The piece table.
+ * @param t The root of the subtree.
+ * @param base The offset of the subtree in the document.
+ * @param ps The snapshot.
+ * @return None
+ */
+void ptSnapshotNode(struct pieceTable *pt, pnode *t, size_t base, struct pieceSnapshot *ps)
+{
+    while (t)
+    {
+        size_t lsize = t->left ? t->left->sublen : 0;
+        ptSnapshotNode(pt, t->left, base, ps);
+        base += lsize;
+
+        if (ps->count == ps->cap)
+        {
+            ps->cap = ps->cap ? ps->cap * 2 : 64;
+            ps->iov = realloc(ps->iov, ps->cap * sizeof(struct iovec));
+            ps->ext = realloc(ps->ext, ps->cap * sizeof(struct pieceExtent));
+            if (ps->iov == NULL || ps->ext == NULL)
+                die("realloc");
+        }
+        ps->iov[ps->count].iov_base = &pt->buf[t->buf][t->start];
+        ps->iov[ps->count].iov_len = t->len;
+        ps->ext[ps->count] = (struct pieceExtent){base, t->len, t->buf, t->start};
+        ps->count++;
+        ps->len += t->len;
+
+        base += t->len;
+        t = t->right;
+    }
+}
+
+/**
+ * Takes a snapshot of the document that stays valid while it is edited, for
+ * another thread to read. It only costs the list of the pieces: the buffers they
+ * point into are append-only, and pinning them keeps the add buffer from moving.
+ *
+ * @param pt The piece table.
+ * @param ps The snapshot to fill in, released with ptRelease.
+ * @return None
+ */
+void ptSnapshot(struct pieceTable *pt, struct pieceSnapshot *ps)
+{
+    memset(ps, 0, sizeof(*ps));
+    ptSnapshotNode(pt, pt->root, 0, ps);
+    pt->pinned++;
+}
+
+/**
+ * Releases a snapshot of the document, freeing the add buffers that were only
+ * kept for the snapshots.
+ *
+ * @param pt The piece table.
+ * @param ps The snapshot.
+ * @return None
+ */
+void ptRelease(struct pieceTable *pt, struct pieceSnapshot *ps)
+{
+    free(ps->iov);
+    free(ps->ext);
+    ps->iov = NULL;
+    ps->ext = NULL;
+    if (--pt->pinned > 0)
+        return;
+    for (int i = 0; i < pt->nretired; i++)
+        free(pt->retired[i]);
+    free(pt->retired);
+    pt->retired = NULL;
+    pt->nretired = 0;
+}
+
+/**
+ * Returns a pointer to a range of the document when it lies in a single piece of the
+ * original buffer. The add buffer moves when it grows, so its text is never handed out.
+ *
+ * @param pt The piece table.
+ * @param off The offset of the range, which has to be inside the document.
+ * @param len The length of the range.
+ * @return A pointer to the range in the original buffer, or NULL if it has to be copied.
+ */
+char *ptContiguous(struct pieceTable *pt, size_t off, size_t len)
+{
+    pnode *t = pt->root;
+    while (t)
+    {
+        size_t lsize = t->left ? t->left->sublen : 0;
+        if (off < lsize)
+        {
+            t = t->left;
+            continue;
+        }
+
+        off -= lsize;
+        if (off < t->len)
+        {
+            if (t->buf != PT_ORIGINAL || off + len > t->len)
+                return NULL;
+            return &pt->buf[PT_ORIGINAL][t->start + off];
+        }
+        off -= t->len;
+        t = t->right;
+    }
+    return NULL;
+}
+
+/**
+ * Copies a range of the document from the pieces of a subtree.
+ *
+ * @param pt The piece table.
+ * @param t The root of the subtree.
+ * @param off The offset of the range, relative to the start of the subtree.
+ * @param len The length of the range.
+ * @param dst The destination, at least len bytes long.
+ * @return None
+ */
+void ptCopyNode(struct pieceTable *pt, pnode *t, size_t off, size_t len, char *dst)
+{
+    while (t && len > 0)
+    {
+        size_t lsize = t->left ? t->left->sublen : 0;
+        if (off < lsize)
+        {
+            size_t n = (len < lsize - off) ? len : lsize - off;
+            ptCopyNode(pt, t->left, off, n, dst);
+            dst += n;
+            off += n;
+            len -= n;
+            if (len == 0)
+                break;
+        }
+        if (off < lsize + t->len)
+        {
+            size_t k = off - lsize;
+            size_t n = (len < t->len - k) ? len : t->len - k;
+            memcpy(dst, &pt->buf[t->buf][t->start + k], n);
+            dst += n;
+            off += n;
+            len -= n;
+        }
+        off -= lsize + t->len;
+        t = t->right;
+    }
+}
+
+/**
+ * Copies a range of the document.
+ *
+ * @param pt The piece table.
+ * @param off The offset of the range.
+ * @param len The length of the range.
+ * @param dst The destination, at least len bytes long.
+ * @return None
+ */
+void ptCopy(struct pieceTable *pt, size_t off, size_t len, char *dst)
+{
+    ptCopyNode(pt, pt->root, off, len, dst);
+}
+
+/**
+ * Inserts text into the document. The text goes to the end of the add buffer, and
+ * when it continues the piece that ends right before the insertion point, which is
+ * what typing does, that piece is extended instead of adding a new one.
+ *
+ * @param pt The piece table.
+ * @param off The offset at which the text is inserted.
+ * @param s The text to insert.
+ * @param len The length of the text.
+ * @return None
+ */
+void ptInsert(struct pieceTable *pt, size_t off, const char *s, size_t len)
+{
+    if (len == 0)
+        return;
+
+    pt->version++;
+    size_t start = ptAppend(pt, s, len);
+
+    pnode *l, *r;
+    ptSplit(pt, pt->root, off, &l, &r);
+
+    pnode *last = l;
+    while (last && last->right)
+        last = last->right;
+
+    if (last && last->buf == PT_ADD && last->start + last->len == start)
+    {
+        size_t lf = ptCountNewlines(pt, PT_ADD, start, len);
+        for (pnode *n = l; n; n = n->right)
+        {
+            n->sublen += len;
+            n->sublf += lf;
+        }
+        last->len += len;
+        last->lf += lf;
+    }
+    else
+    {
+        l = ptMerge(l, ptNewNode(pt, PT_ADD, start, len));
+    }
+
+    pt->root = ptMerge(l, r);
+}
+
+/**
+ * Deletes a range of the document.
+ *
+ * @param pt The piece table.
+ * @param off The offset of the range.
+ * @param len The length of the range.
+ * @return None
+ */
+void ptDelete(struct pieceTable *pt, size_t off, size_t len)
+{
+    if (len == 0)
+        return;
+
+    pt->version++;
+    pnode *l, *m, *r;
+    ptSplit(pt, pt->root, off, &l, &m);
+    ptSplit(pt, m, len, &m, &r);
+    ptFreeNodes(m);
+    pt->root = ptMerge(l, r);
+}
+
+/*** row operations ***/
+
+/**
+ * Returns the render column right after a tab that starts at the given column.
+ *
+ * @param rx The render column where the tab starts.
+ * @return The next tab stop.
+ */
+int editorTabStop(int rx)
+{
+    return rx + EDITOR_TAB_STOP - rx % EDITOR_TAB_STOP;
+}
+
+/**
+ * Computes again the render columns of the tabs of a row from the given one on. The tabs
+ * after an old one that did not move did not move either, so the walk stops there.
+ *
+ * @param row The row, whose tabs have their cx up to date.
+ * @param k The index of the first tab that may have moved.
+ * @param fresh The number of tabs from k on that were just added, whose rx is not known.
+ * @return None
+ */
+void editorRowTabsFrom(erow *row, int k, int fresh)
+{
+    for (int j = k; j < row->ntabs; j++)
+    {
+        struct rowTab *t = &row->tabs[j];
+        int rx = (j == 0) ? t->cx : editorTabStop(t[-1].rx) + (t->cx - t[-1].cx - 1);
+        if (j >= k + fresh && rx == t->rx)
+            return;
+        t->rx = rx;
+    }
+}
+
+/**
+ * Makes room in the tabs of a row for more tabs at the given index.
+ *
+ * @param row The row.
+ * @param k Where the new tabs go.
+ * @param n The number of new tabs.
+ * @return None
+ */
+void editorRowTabsOpen(erow *row, int k, int n)
+{
+    size_t need = (row->ntabs + n) * sizeof(struct rowTab);
+    row->tabs = (struct rowTab *)raGrow((char *)row->tabs, &row->tabscap, need ? need : 1,
+                                        row->ntabs * sizeof(struct rowTab));
+    memmove(&row->tabs[k + n], &row->tabs[k], (row->ntabs - k) * sizeof(struct rowTab));
+    row->ntabs += n;
+}
+
+/**
+ * Finds the tabs of a row, when they are not known yet.
+ *
+ * @param row The row.
+ * @return None
+ */
+void editorRowIndexTabs(erow *row)
+{
+    if (row->tabsvalid)
+        return;
+
+    // the marks were taken on other text
+    row->nmarks = row->ntrusted = 0;
+    row->ntabs = 0;
+    const char *p = row->chars, *end = row->chars + row->size;
+    while ((p = memchr(p, '\t', end - p)) != NULL)
+    {
+        editorRowTabsOpen(row, row->ntabs, 1);
+        row->tabs[row->ntabs - 1].cx = p - row->chars;
+        p++;
+    }
+    editorRowTabsFrom(row, 0, row->ntabs);
+    row->tabsvalid = 1;
+}
+
+/**
+ * Returns the last tab of a row before the given character.
+ *
+ * @param row The row, whose tabs are known.
+ * @param cx The character index in the row.
+ * @return The index of the tab, or -1 when there is no tab before cx.
+ */
+int editorRowTabBefore(erow *row, int cx)
+{
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (row->tabs[mid].cx < cx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+/**
+ * Updates the tabs of a row for text inserted in it, which holds no newline.
+ *
+ * @param row The row, whose tabs were valid before the insertion.
+ * @param col The index of the character where the text was inserted.
+ * @param s The text.
+ * @param len The length of the text.
+ * @return None
+ */
+void editorRowTabsInsert(erow *row, int col, const char *s, int len)
+{
+    int k = editorRowTabBefore(row, col) + 1;
+    for (int j = k; j < row->ntabs; j++)
+        row->tabs[j].cx += len;
+
+    int n = 0;
+    for (int j = 0; j < len; j++)
+        n += (s[j] == '\t');
+    if (n > 0)
+    {
+        editorRowTabsOpen(row, k, n);
+        for (int j = 0, t = k; j < len; j++)
+        {
+            if (s[j] == '\t')
+                row->tabs[t++].cx = col + j;
+        }
+    }
+    editorRowTabsFrom(row, k, n);
+    row->tabsvalid = 1;
+}
+
+/**
+ * Updates the tabs of a row for text deleted from it, which held no newline.
+ *
+ * @param row The row, whose tabs were valid before the deletion.
+ * @param col The index of the first character deleted.
+ * @param len The number of characters deleted.
+ * @return None
+ */
+void editorRowTabsDelete(erow *row, int col, int len)
+{
+    int k = editorRowTabBefore(row, col) + 1;
+    int e = editorRowTabBefore(row, col + len) + 1;
+
+    if (e > k)
+    {
+        memmove(&row->tabs[k], &row->tabs[e], (row->ntabs - e) * sizeof(struct rowTab));
+        row->ntabs -= e - k;
+    }
+    for (int j = k; j < row->ntabs; j++)
+        row->tabs[j].cx -= len;
+    editorRowTabsFrom(row, k, 0);
+    row->tabsvalid = 1;
+}
+
+/**
+ * Converts the index of a character in a row from the cx (character index) to the rx (render index).
+ * Only the tabs of the row make the two differ, so the conversion starts from the last tab before cx.
+ *
+ * @param row The row containing the characters.
+ * @param cx The character index in the row.
+ * @return The render index of the character.
+ */
+int editorRowCxToRx(erow *row, int cx)
+{
+    editorRowIndexTabs(row);
+
+    int k = editorRowTabBefore(row, cx);
+    if (k < 0)
+        return cx;
+    return editorTabStop(row->tabs[k].rx) + (cx - row->tabs[k].cx - 1);
+}
+
+/**
+ * Converts a visual column index (rx) to a character index (cx) for a given row.
+ * The conversion starts from the last tab that starts at or before rx.
+ *
+ * @param row The row for which to convert the visual column index.
+ * @param rx The visual column index to convert.
+ * @return The character index (cx) corresponding to the given visual column index (rx).
+ */
+int editorRowRxToCx(erow *row, int rx)
+{
+    editorRowIndexTabs(row);
+
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (row->tabs[mid].rx <= rx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int cx = rx;
+    if (lo > 0)
+    {
+        struct rowTab *t = &row->tabs[lo - 1];
+        int end = editorTabStop(t->rx);
+        if (rx < end)
+            return t->cx;
+        cx = t->cx + 1 + (rx - end);
+    }
+    return cx < row->size ? cx : row->size;
+}
+
+/**
+ * Returns the render columns a long row is rendered for: the segments of
+ * EDITOR_LONG_SEGMENT columns the view overlaps.
+ *
+ * @param wa Set to the first column.
+ * @param wb Set to the column past the last one.
+ * @return None
+ */
+void editorRowWindow(int *wa, int *wb)
+{
+    int cols = E.screencols > 0 ? E.screencols : 1;
+    *wa = E.buf->coloff / EDITOR_LONG_SEGMENT * EDITOR_LONG_SEGMENT;
+    *wb = ((E.buf->coloff + cols - 1) / EDITOR_LONG_SEGMENT + 1) * EDITOR_LONG_SEGMENT;
+}
+
+/**
+ * Tells whether the render of a row covers what the view shows of it. Only long rows
+ * are rendered for a part of them.
+ *
+ * @param row The row.
+ * @return Whether the render covers the view.
+ */
+int editorRowShows(erow *row)
+{
+    if (row->size <= EDITOR_LONG_LINE)
+        return 1;
+    int wa, wb;
+    editorRowWindow(&wa, &wb);
+    return row->wa == wa && row->wb == wb;
+}
+
+/**
+ * This function updates the render field of a given row by converting tabs
+ * into spaces and allocating memory for the updated render string.
+ * A row without tabs renders as it is, so its render is chars itself; otherwise
+ * the text between its tabs is copied from one tab to the next. A long row with
+ * tabs only has the characters of the segments in view rendered.
+ *
+ * @param row A pointer to the row structure to be updated.
+ * @return None
+ */
+void editorUpdateRow(erow *row)
+{
+    editorRowIndexTabs(row);
+
+    int cxa = 0, cxb = row->size;
+    if (row->size > EDITOR_LONG_LINE)
+    {
+        editorRowWindow(&row->wa, &row->wb);
+        cxa = editorRowRxToCx(row, row->wa);
+        cxb = editorRowRxToCx(row, row->wb - 1) + 1;
+        if (cxb > row->size)
+            cxb = row->size;
+    }
+    row->hla = cxa;
+    row->hlb = cxb;
+
+    if (row->ntabs == 0)
+    {
+        raFree(row->rendercap ? row->render : NULL, row->rendercap);
+        row->rendercap = 0;
+        row->render = row->chars;
+        row->rstart = 0;
+        row->rsize = row->size;
+        editorUpdateSyntax(row);
+        return;
+    }
+
+    if (row->rendercap == 0)
+        row->render = NULL;
+    row->rstart = editorRowCxToRx(row, cxa);
+    row->rsize = editorRowCxToRx(row, cxb) - row->rstart;
+    row->render = raGrow(row->render, &row->rendercap, row->rsize ? row->rsize : 1, 0);
+
+    int cx = cxa, rx = 0;
+    for (int k = editorRowTabBefore(row, cxa) + 1; k < row->ntabs && row->tabs[k].cx < cxb; k++)
+    {
+        struct rowTab *t = &row->tabs[k];
+        memcpy(&row->render[rx], &row->chars[cx], t->cx - cx);
+        rx = editorTabStop(t->rx) - row->rstart;
+        memset(&row->render[t->rx - row->rstart], ' ', rx - (t->rx - row->rstart));
+        cx = t->cx + 1;
+    }
+    memcpy(&row->render[rx], &row->chars[cx], cxb - cx);
+
+    editorUpdateSyntax(row);
+}
+
+/**
+ * Frees the memory allocated for a row in the editor.
+ *
+ * @param row The row to be freed.
+ * @return None
+ */
+void editorFreeRow(erow *row)
+{
+    if (row->rendercap)
+        raFree(row->render, row->rendercap);
+    if (!row->borrowed)
+        raFree(row->chars, row->charscap);
+    raFree((char *)row->spans, row->spanscap);
+    raFree((char *)row->tabs, row->tabscap);
+    raFree((char *)row->marks, row->markscap);
+    row->borrowed = 0;
+    row->render = NULL;
+    row->chars = NULL;
+    row->spans = NULL;
+    row->tabs = NULL;
+    row->marks = NULL;
+    row->nspans = row->ntabs = row->tabsvalid = row->nmarks = row->ntrusted = 0;
+    row->charscap = row->rendercap = row->spanscap = row->tabscap = row->markscap = 0;
+    row->size = 0;
+    row->rsize = 0;
+}
+
+/**
+ * Fills a row with the text of a line of the piece table. Its render and highlighting
+ * are only computed when the row is drawn, by editorRowRender.
+ * A line that lies in a single piece of the original buffer is read in place: rows are only
+ * copied once they have been edited.
+ *
+ * @param row The row to fill, whose buffers are reused.
+ * @param at The index of the line.
+ * @return None
+ */
+void editorRowLoad(erow *row, int at)
+{
+    size_t start = ptLineStart(&E.buf->pt, at);
+    size_t len = ptLineStart(&E.buf->pt, at + 1) - start - 1;
+
+    row->idx = at;
+    row->size = len;
+    row->dirty = 1;
+    row->tabsvalid = 0;
+    row->hlpending = 1;
+
+    char *p = ptContiguous(&E.buf->pt, start, len);
+    if (p)
+    {
+        if (!row->borrowed)
+            raFree(row->chars, row->charscap);
+        row->chars = p;
+        row->charscap = 0;
+        row->borrowed = 1;
+    }
+    else
+    {
+        if (row->borrowed)
+            row->chars = NULL;
+        row->borrowed = 0;
+        row->chars = raGrow(row->chars, &row->charscap, len + 1, 0);
+        ptCopy(&E.buf->pt, start, len, row->chars);
+        row->chars[len] = '\0';
+    }
+}
+
+/**
+ * Updates the row cache memory total with the current footprint of a cached row.
+ *
+ * @param row The cached row.
+ * @return None
+ */
+void editorRowAccount(erow *row)
+{
+    size_t bytes = row->charscap + row->rendercap + row->spanscap + row->tabscap + row->markscap;
+
+    E.rowcachebytes += bytes - row->bytes;
+    row->bytes = bytes;
+}
+
+/**
+ * Frees a cached row and gives its slot back to the row cache.
+ *
+ * @param row The cached row.
+ * @return None
+ */
+void editorRowEvict(erow *row)
+{
+    editorFreeRow(row);
+    editorRowAccount(row);
+    row->idx = -1;
+    row->lru = 0;
+}
+
+/**
+ * Evicts the least recently used rows until the row cache is back under EDITOR_ROW_CACHE_BYTES.
+ * The rows of the frame being drawn are kept whatever they weigh, or a row as long as
+ * the budget would be loaded again on every frame.
+ *
+ * @param keep A row that must stay in the cache, because the caller is using it.
+ * @return None
+ */
+void editorRowCacheTrim(erow *keep)
+{
+    while (E.rowcachebytes > EDITOR_ROW_CACHE_BYTES)
+    {
+        erow *victim = NULL;
+        for (int j = 0; j < E.rowcachelen; j++)
+        {
+            erow *row = &E.rowcache[j];
+            if (row->idx >= 0 && row != keep && row->lru <= E.rowframe &&
+                (victim == NULL || row->lru < victim->lru))
+                victim = row;
+        }
+        if (victim == NULL)
+            return;
+        editorRowEvict(victim);
+    }
+}
+
+/**
+ * Returns the cached row at the given index without materializing it.
+ *
+ * @param at The index of the row.
+ * @return A pointer to the cached row, or NULL if the row is not in the cache.
+ */
+erow *editorRowCached(int at)
+{
+    for (int j = 0; j < E.rowcachelen; j++)
+    {
+        if (E.rowcache[j].idx == at)
+            return &E.rowcache[j];
+    }
+    return NULL;
+}
+
+/**
+ * Returns the row at the given index, materializing it from the piece table if it is not cached.
+ * When the cache is full the least recently used row is recycled. Only the text of the row is
+ * loaded: call editorRowRender before using its render or hl.
+ *
+ * @param at The index of the row.
+ * @return A pointer to the cached row, valid until the row cache recycles it.
+ */
+erow *editorRowAt(int at)
+{
+    erow *victim = NULL;
+
+    for (int j = 0; j < E.rowcachelen; j++)
+    {
+        erow *row = &E.rowcache[j];
+        if (row->idx == at)
+        {
+            row->lru = ++E.rowclock;
+            return row;
+        }
+        // unused slots have a clock of 0, so they are taken first
+        if (victim == NULL || row->lru < victim->lru)
+            victim = row;
+    }
+
+    editorRowEvict(victim);
+    editorRowLoad(victim, at);
+    victim->lru = ++E.rowclock;
+    editorRowAccount(victim);
+    editorRowCacheTrim(victim);
+    return victim;
+}
+
+/**
+ * Drops every row of the row cache, for when the text they were loaded from goes away.
+ * Their buffers go with the slabs, all at once; only the few too large for them are
+ * freed one by one.
+ *
+ * @param None
+ * @return None
+ */
+void editorRowCacheClear()
+{
+    for (int j = 0; j < E.rowcachelen; j++)
+    {
+        erow *row = &E.rowcache[j];
+        if (row->charscap && raClass(row->charscap) < 0)
+            free(row->chars);
+        if (row->rendercap && raClass(row->rendercap) < 0)
+            free(row->render);
+        if (row->spanscap && raClass(row->spanscap) < 0)
+            free(row->spans);
+        if (row->tabscap && raClass(row->tabscap) < 0)
+            free(row->tabs);
+        if (row->markscap && raClass(row->markscap) < 0)
+            free(row->marks);
+        row->chars = row->render = NULL;
+        row->spans = NULL;
+        row->tabs = NULL;
+        row->marks = NULL;
+        row->nspans = row->ntabs = row->tabsvalid = row->nmarks = row->ntrusted = 0;
+        row->charscap = row->rendercap = row->spanscap = row->tabscap = row->markscap = 0;
+        row->borrowed = 0;
+        row->size = row->rsize = 0;
+        row->bytes = 0;
+        row->idx = -1;
+        row->lru = 0;
+    }
+    E.rowcachebytes = 0;
+    raReset();
+}
+
+/**
+ * Lexes again, in order, the rows flagged HL_STATE_STALE before the given row. A row whose
+ * new state matches its checkpoint stops the propagation: the rows after it are left alone.
+ *
+ * @param upto The index of the row where to stop.
+ * @param budget The maximum number of rows to lex, or -1 for no limit.
+ * @return Whether every stale row before upto was settled.
+ */
+int editorSyntaxSettle(int upto, int budget)
+{
+    if (upto > E.buf->hlvalid)
+        upto = E.buf->hlvalid;
+
+    erow scratch = {0};
+    while (E.buf->hlstale < upto && budget != 0)
+    {
+        if (E.buf->hlstate[E.buf->hlstale] & HL_STATE_STALE)
+        {
+            // flags the next row when the state it leaves open changed
+            editorRowLoad(&scratch, E.buf->hlstale);
+            editorUpdateRow(&scratch);
+            budget--;
+        }
+        E.buf->hlstale++;
+    }
+    editorFreeRow(&scratch);
+    return E.buf->hlstale >= upto;
+}
+
+/**
+ * Finishes a batch of the propagation left over from the last edits while the editor is idle.
+ * Only rows below the part of the file that was drawn can still be stale.
+ *
+ * @param None
+ * @return None
+ */
+void editorSyntaxIdle()
+{
+    editorSyntaxSettle(E.buf->hlvalid, EDITOR_SYNTAX_BATCH);
+}
+
+/**
+ * Makes the multi-line comment state exact for every row before the given one, settling the
+ * stale rows first and then highlighting the rows that were never reached before.
+ *
+ * @param at The index of the row.
+ * @return None
+ */
+void editorSyntaxUpto(int at)
+{
+    editorSyntaxSettle(at, -1);
+
+    if (E.buf->syntax == NULL)
+    {
+        // without syntax the state is never read
+        if (E.buf->hlvalid < at)
+            E.buf->hlvalid = at;
+        return;
+    }
+
+    erow scratch = {0};
+    while (E.buf->hlvalid < at)
+    {
+        editorRowLoad(&scratch, E.buf->hlvalid);
+        editorUpdateRow(&scratch);
+        E.buf->hlvalid++;
+    }
+    editorFreeRow(&scratch);
+}
+
+/**
+ * Computes the render and the highlighting of a cached row if its text changed, the
+ * multi-line comment state it starts in is not the one it was highlighted with, or,
+ * for a long row, the view moved off the segments it was rendered for.
+ *
+ * @param row The cached row.
+ * @return None
+ */
+void editorRowRender(erow *row)
+{
+    double start = E.stats.on ? editorNow() : 0;
+
+    // far below the rows highlighted, a row is drawn plain until the workers get to it
+    int in = -1;
+    if (E.buf->syntax == NULL || row->idx <= E.buf->hlvalid + EDITOR_SYNTAX_BATCH || !hlJobStart())
+    {
+        editorSyntaxUpto(row->idx);
+        in = (row->idx > 0) ? (E.buf->hlstate[row->idx - 1] & HL_STATE_COMMENT) : 0;
+    }
+    if (row->hlin != in)
+    {
+        // every mark of a long row may be off now, and the first one found right stops the lexer
+        row->ntrusted = 0;
+        row->hlpending = 1;
+    }
+    if (row->dirty || row->hlin != in || !editorRowShows(row))
+    {
+        row->hlin = in;
+        editorUpdateRow(row);
+        row->dirty = 0;
+        if (row->idx == E.buf->hlvalid)
+            E.buf->hlvalid++;
+
+        editorRowAccount(row);
+        editorRowCacheTrim(row);
+    }
+
+    if (E.stats.on)
+        E.stats.syntax += editorNow() - start;
+}
+
+/**
+ * Updates the row cache and the highlighting state after the text of a row changed.
+ * Rows after it are renumbered, the ones that were deleted are dropped from the cache,
+ * and the rows that changed are flagged stale. They are lexed again when they are
+ * needed, which for an edit on screen means as far as the last row drawn.
+ *
+ * @param at The index of the row that changed.
+ * @param delta The number of rows inserted after it, negative if rows were deleted.
+ * @return None
+ */
+void editorRowsChanged(int at, int delta)
+{
+    int oldrows = E.buf->numrows - delta;
+
+    for (int j = 0; j < E.rowcachelen; j++)
+    {
+        erow *row = &E.rowcache[j];
+        if (row->idx < 0 || row->idx < at)
+            continue;
+
+        if (row->idx == at && at < E.buf->numrows)
+        {
+            // the row is loaded again into its own buffers, which usually have room for the change
+            editorRowLoad(row, at);
+            editorRowAccount(row);
+        }
+        else if (row->idx == at || (delta < 0 && row->idx <= at - delta))
+            editorRowEvict(row);
+        else
+            row->idx += delta;
+    }
+
+    if (delta > 0)
+    {
+        if (E.buf->numrows > E.buf->hlstatecap)
+        {
+            E.buf->hlstatecap = E.buf->hlstatecap ? E.buf->hlstatecap : 1024;
+            while (E.buf->hlstatecap < E.buf->numrows)
+                E.buf->hlstatecap *= 2;
+            E.buf->hlstate = realloc(E.buf->hlstate, E.buf->hlstatecap);
+            if (E.buf->hlstate == NULL)
+                die("realloc");
+        }
+
+        // the last of the new rows ends with the tail of the row that changed, so its
+        // state is compared against the one the row used to end with
+        if (at < oldrows)
+            memmove(&E.buf->hlstate[at + delta], &E.buf->hlstate[at], oldrows - at);
+        memset(&E.buf->hlstate[at], 0, delta);
+
+        if (E.buf->hlvalid > at)
+            E.buf->hlvalid += delta;
+    }
+    else if (delta < 0)
+    {
+        // the row now ends with the tail of the last row that was joined to it
+        if (oldrows > at - delta)
+            memmove(&E.buf->hlstate[at], &E.buf->hlstate[at - delta], oldrows - (at - delta));
+
+        if (E.buf->hlvalid > at - delta)
+            E.buf->hlvalid += delta;
+        else if (E.buf->hlvalid > at)
+            E.buf->hlvalid = at;
+    }
+    if (E.buf->hlvalid > E.buf->numrows)
+        E.buf->hlvalid = E.buf->numrows;
+
+    for (int j = at; j <= at + (delta > 0 ? delta : 0) && j < E.buf->hlvalid; j++)
+        E.buf->hlstate[j] |= HL_STATE_STALE;
+    if (E.buf->hlstale > at)
+        E.buf->hlstale = at;
+
+    hlJobEdit(at, delta);
+}
+
+/**
+ * Inserts text, which may contain newlines, at a position of the buffer.
+ * Every edit of the text goes through this function or editorBufferDelete.
+ *
+ * @param at The index of the row of the position. It can be E.buf->numrows only if the text ends with a newline.
+ * @param col The index of the character of the position in the row.
+ * @param s The text to insert.
+ * @param len The length of the text.
+ * @return None
+ */
+void editorBufferInsert(int at, int col, const char *s, size_t len)
+{
+    if (len == 0)
+        return;
+
+    // the tabs of the row are moved rather than looked for again along the whole line
+    erow *row = editorRowCached(at);
+    int tabs = row && row->tabsvalid;
+
+    size_t off = ptLineStart(&E.buf->pt, at) + col;
+    editorUndoRecord(1, off, s, len);
+
+    int oldrows = E.buf->numrows;
+    ptInsert(&E.buf->pt, off, s, len);
+    E.buf->numrows = ptLineCount(&E.buf->pt);
+
+    editorRowsChanged(at, E.buf->numrows - oldrows);
+    if (tabs && E.buf->numrows == oldrows)
+    {
+        editorRowTabsInsert(row, col, s, len);
+        editorRowMarksEdit(row, col, 0, len);
+    }
+    E.buf->modified = 1;
+    E.buf->index.edited = 1;
+}
+
+/**
+ * Deletes text, which may span several rows, from a position of the buffer.
+ *
+ * @param at The index of the row of the position.
+ * @param col The index of the character of the position in the row.
+ * @param len The number of bytes to delete, counting one for each newline.
+ * @return None
+ */
+void editorBufferDelete(int at, int col, size_t len)
+{
+    if (len == 0)
+        return;
+
+    erow *row = editorRowCached(at);
+    int tabs = row && row->tabsvalid;
+
+    size_t off = ptLineStart(&E.buf->pt, at) + col;
+    editorUndoRecord(0, off, NULL, len);
+
+    int oldrows = E.buf->numrows;
+    ptDelete(&E.buf->pt, off, len);
+    E.buf->numrows = ptLineCount(&E.buf->pt);
+
+    editorRowsChanged(at, E.buf->numrows - oldrows);
+    if (tabs && E.buf->numrows == oldrows)
+    {
+        editorRowTabsDelete(row, col, len);
+        editorRowMarksEdit(row, col, len, 0);
+    }
+    E.buf->modified = 1;
+    E.buf->index.edited = 1;
+}
+
+/**
+ * Inserts a new row at the specified position in the editor.
+ *
+ * @param at The index at which to insert the row.
+ * @param s The string to be inserted.
+ * @param len The length of the string.
+ * @return None
+ */
+void editorInsertRow(int at, char *s, size_t len)
+{
+    if (at < 0 || at > E.buf->numrows)
+        return;
+
+    char *line = malloc(len + 1);
+    memcpy(line, s, len);
+    line[len] = '\n';
+
+    editorBufferInsert(at, 0, line, len + 1);
+    free(line);
+}
+
+/**
+ * Deletes a row from the editor.
+ *
+ * @param at The index of the row to delete.
+ * @return None
+ */
+void editorDelRow(int at)
+{
+    if (at < 0 || at >= E.buf->numrows)
+        return;
+
+    editorBufferDelete(at, 0, editorRowAt(at)->size + 1);
+}
+
+/**
+ * Inserts a character at a given index in a row.
+ *
+ * @param row The row in which the character will be inserted.
+ * @param at The index at which the character will be inserted.
+ * @param c The character to be inserted.
+ * @return None
+ */
+void editorRowInsertChar(erow *row, int at, int c)
+{
+    if (at < 0 || at > row->size)
+        at = row->size;
+
+    char ch = c;
+    editorBufferInsert(row->idx, at, &ch, 1);
+}
+
+/**
+ * Inserts a new line in the text editor at the current cursor position.
+ * If the cursor is at the beginning of a line, a new empty line is inserted.
+ * If the cursor is in the middle of a line, the text after the cursor is moved to a new line.
+ * The cursor is then moved to the beginning of the new line.
+ *
+ * @param None
+ * @return None
+ */
+void editorInsertNewLine()
+{
+    editorBufferInsert(E.buf->cy, E.buf->cx, "\n", 1);
+    E.buf->cy++;
+    E.buf->cx = 0;
+}
+
+/**
+ * Deletes a character at a given index in a row.
+ *
+ * @param row The row from which to delete the character.
+ * @param at The index of the character to delete.
+ * @return None
+ */
+void editorRowDelChar(erow *row, int at)
+{
+    if (at < 0 || at >= row->size)
+        return;
+
+    editorBufferDelete(row->idx, at, 1);
+}
+
+/*** background highlighting ***/
+
+/**
+ * @struct hlJobChunk
+ * @brief A run of rows highlighted by one worker of a background highlighting job.
+ *
+ * The state a chunk starts in is only known once the rows before it are highlighted,
+ * so a worker lexes the rows from both: outside of a multi-line comment, and inside
+ * one until the two agree, which is usually a few rows in.
+ */
+struct hlJobChunk
+{
+    size_t start;          ///< The offset of the first row in the snapshot.
+    int row;               ///< The index of the first row, kept up to date with the edits.
+    int nrows;             ///< The number of rows in the snapshot.
+    int count;             ///< The number of rows now, which only differs from nrows once dirty.
+    unsigned char *states; ///< The states the rows end in, from outside a comment then from inside one.
+    int apart;             ///< The number of leading rows for which the two differ.
+    int done;              ///< Set atomically once the states are computed.
+    int dirty;             ///< Set when the rows were edited after the snapshot.
+};
+
+/**
+ * @struct hlJob
+ * @brief The rows after E.buf->hlvalid being highlighted by workers on a snapshot of the document.
+ *
+ * Only the state every row ends in is computed: the runs of the rows are cheap to
+ * get from it once the rows are drawn. The chunks are handed over in order.
+ */
+struct hlJob
+{
+    struct pieceSnapshot snap;              ///< The document being highlighted.
+    unsigned long version;                  ///< The version of the document the chunks are in step with.
+    struct hlJobChunk *chunks;              ///< The chunks, in document order.
+    int nchunks;                            ///< The number of chunks.
+    int next;                               ///< The next chunk to take, taken atomically.
+    int merged;                             ///< The number of chunks handed over.
+    int cancel;                             ///< Set by the main thread to stop the workers.
+    pthread_t threads[EDITOR_SCAN_THREADS]; ///< The workers.
+    int nthreads;                           ///< The number of workers.
+};
+
+/**
+ * Lexes the characters of a row and returns the multi-line comment state it leaves open.
+ *
+ * @param chars The characters of the row.
+ * @param len The number of characters.
+ * @param in The state the row starts in.
+ * @return The state the row ends in.
+ */
+unsigned char hlJobLex(char *chars, size_t len, unsigned char in)
+{
+    // without a window of columns nothing is marked
+    erow row = {0};
+    row.chars = chars;
+    row.size = len;
+    struct hlLexState st = {0, in, 0, 1, HL_NORMAL};
+    editorLex(&row, &st, row.size);
+    return st.comment;
+}
+
+/**
+ * Highlights the chunks of a job until none is left or it is canceled. Rows are read
+ * from the snapshot in place, unless they are split between pieces.
+ *
+ * @param arg The hlJob.
+ * @return NULL.
+ */
+void *hlJobWorker(void *arg)
+{
+    struct hlJob *job = arg;
+    struct pieceSnapshot *ps = &job->snap;
+    char *line = NULL;
+    size_t linecap = 0;
+
+    while (!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+    {
+        int k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (k >= job->nchunks)
+            break;
+        struct hlJobChunk *c = &job->chunks[k];
+
+        int lo = 0, hi = ps->count - 1;
+        while (lo < hi)
+        {
+            int mid = lo + (hi - lo + 1) / 2;
+            if (ps->ext[mid].off <= c->start)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        int p = lo;
+        size_t pos = c->start - ps->ext[p].off;
+
+        unsigned char out = 0, alt = 1;
+        c->apart = 0;
+        int i;
+        for (i = 0; i < c->nrows; i++)
+        {
+            if ((i & 1023) == 0 && __atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+                break;
+
+            // every row ends with a newline, so there is a piece left
+            while (pos == ps->iov[p].iov_len)
+            {
+                p++;
+                pos = 0;
+            }
+            char *s = (char *)ps->iov[p].iov_base + pos;
+            char *nl = memchr(s, '\n', ps->iov[p].iov_len - pos);
+            char *chars = s;
+            size_t len;
+            if (nl)
+            {
+                len = nl - s;
+                pos += len + 1;
+            }
+            else
+            {
+                len = 0;
+                while (nl == NULL)
+                {
+                    size_t n = ps->iov[p].iov_len - pos;
+                    if (len + n > linecap)
+                    {
+                        linecap = (len + n) * 2;
+                        line = realloc(line, linecap);
+                        if (line == NULL)
+                            die("realloc");
+                    }
+                    memcpy(&line[len], s, n);
+                    len += n;
+                    p++;
+                    pos = 0;
+                    s = (char *)ps->iov[p].iov_base;
+                    nl = memchr(s, '\n', ps->iov[p].iov_len);
+                }
+                size_t n = nl - s;
+                if (len + n > linecap)
+                {
+                    linecap = (len + n) * 2;
+                    line = realloc(line, linecap);
+                    if (line == NULL)
+                        die("realloc");
+                }
+                memcpy(&line[len], s, n);
+                len += n;
+                pos = n + 1;
+                chars = line;
+            }
+
+            out = hlJobLex(chars, len, out);
+            c->states[i] = out;
+            if (c->apart == i)
+            {
+                alt = hlJobLex(chars, len, alt);
+                c->states[c->nrows + i] = alt;
+                if (alt != out)
+                    c->apart = i + 1;
+            }
+        }
+        if (i < c->nrows)
+            break;
+
+        __atomic_store_n(&c->done, 1, __ATOMIC_RELEASE);
+        editorWake();
+    }
+
+    free(line);
+    return NULL;
+}
+
+/**
+ * Starts highlighting in the background the rows after the last one highlighted,
+ * cut into chunks of EDITOR_SYNTAX_CHUNK rows shared by up to EDITOR_SCAN_THREADS
+ * workers. Nothing is started if a job is running already, or if every row is
+ * highlighted.
+ *
+ * @param None
+ * @return 1 when the rows are being highlighted in the background, 0 otherwise.
+ */
+int hlJobStart()
+{
+    if (E.buf->hljob)
+        return 1;
+    if (E.buf->syntax == NULL || E.buf->hlvalid >= E.buf->numrows)
+        return 0;
+
+    struct hlJob *job = calloc(1, sizeof(struct hlJob));
+    if (job == NULL)
+        die("calloc");
+    int rows = E.buf->numrows - E.buf->hlvalid;
+    job->nchunks = (rows + EDITOR_SYNTAX_CHUNK - 1) / EDITOR_SYNTAX_CHUNK;
+    job->chunks = calloc(job->nchunks, sizeof(struct hlJobChunk));
+    if (job->chunks == NULL)
+        die("calloc");
+    for (int k = 0; k < job->nchunks; k++)
+    {
+        struct hlJobChunk *c = &job->chunks[k];
+        c->row = E.buf->hlvalid + k * EDITOR_SYNTAX_CHUNK;
+        c->nrows = (rows - k * EDITOR_SYNTAX_CHUNK < EDITOR_SYNTAX_CHUNK) ? rows - k * EDITOR_SYNTAX_CHUNK
+                                                                          : EDITOR_SYNTAX_CHUNK;
+        c->count = c->nrows;
+        c->start = ptLineStart(&E.buf->pt, c->row);
+        c->states = malloc(2 * c->nrows);
+        if (c->states == NULL)
+            die("malloc");
+    }
+    ptSnapshot(&E.buf->pt, &job->snap);
+    job->version = E.buf->pt.version;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = cpus < 1 ? 1 : (cpus > EDITOR_SCAN_THREADS ? EDITOR_SCAN_THREADS : cpus);
+    if (want > job->nchunks)
+        want = job->nchunks;
+    for (int i = 0; i < want; i++)
+    {
+        if (pthread_create(&job->threads[job->nthreads], NULL, hlJobWorker, job) == 0)
+            job->nthreads++;
+    }
+
+    E.buf->hljob = job;
+    // without any thread the rows are highlighted when they are drawn
+    if (job->nthreads == 0)
+    {
+        hlJobCancel();
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Stops the background highlighting, dropping what it did not hand over yet.
+ *
+ * @param None
+ * @return None
+ */
+void hlJobCancel()
+{
+    struct hlJob *job = E.buf->hljob;
+    if (job == NULL)
+        return;
+
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < job->nthreads; i++)
+        pthread_join(job->threads[i], NULL);
+    ptRelease(&E.buf->pt, &job->snap);
+    for (int k = 0; k < job->nchunks; k++)
+        free(job->chunks[k].states);
+    free(job->chunks);
+    free(job);
+    E.buf->hljob = NULL;
+}
+
+/**
+ * Hands over to E.buf->hlstate the chunks the workers finished, for as far as they follow
+ * E.buf->hlvalid. The states of a chunk are the ones lexed from the state the row before it
+ * really ends in. A chunk edited since the snapshot is highlighted again here instead,
+ * and a job out of step with the document is dropped.
+ *
+ * @param None
+ * @return The number of rows handed over.
+ */
+int hlJobCommit()
+{
+    struct hlJob *job = E.buf->hljob;
+    if (job == NULL)
+        return 0;
+    if (job->version != E.buf->pt.version)
+    {
+        hlJobCancel();
+        return 0;
+    }
+
+    int from = E.buf->hlvalid;
+    while (job->merged < job->nchunks)
+    {
+        struct hlJobChunk *c = &job->chunks[job->merged];
+        int end = c->row + c->count;
+        if (c->dirty || E.buf->hlvalid >= end)
+        {
+            editorSyntaxUpto(end);
+            job->merged++;
+            continue;
+        }
+        if (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE))
+            break;
+        if (E.buf->hlvalid < c->row)
+        {
+            // rows before the chunk were deleted and joined: they are few
+            editorSyntaxUpto(c->row);
+        }
+
+        int k = E.buf->hlvalid - c->row;
+        unsigned char in = E.buf->hlvalid > 0 ? (E.buf->hlstate[E.buf->hlvalid - 1] & HL_STATE_COMMENT) : 0;
+        int inside;
+        if (k == 0)
+            inside = in;
+        else if (c->states[k - 1] == in)
+            inside = 0;
+        else if (k - 1 < c->apart && c->states[c->nrows + k - 1] == in)
+            inside = 1;
+        else
+        {
+            hlJobCancel();
+            return E.buf->hlvalid - from;
+        }
+
+        for (int i = k; i < c->nrows; i++)
+            E.buf->hlstate[c->row + i] = (inside && i < c->apart) ? c->states[c->nrows + i] : c->states[i];
+        E.buf->hlvalid = end;
+        job->merged++;
+    }
+
+    if (job->merged == job->nchunks)
+        hlJobCancel();
+    return E.buf->hlvalid - from;
+}
+
+/**
+ * Takes the states the background highlighting computed, repainting when rows on
+ * screen that were drawn plain can be highlighted now. Once the job is over, the
+ * rows added to the document since it started, by the loader for one, get a job
+ * of their own.
+ *
+ * @param None
+ * @return None
+ */
+void hlJobIdle()
+{
+    int from = E.buf->hlvalid;
+    if (hlJobCommit() > 0 && from < E.buf->rowoff + E.screenrows)
+        editorRefreshScreen();
+    if (E.buf->hljob == NULL && E.buf->hlvalid + EDITOR_SYNTAX_BATCH < E.buf->numrows)
+        hlJobStart();
+}
+
+/**
+ * Waits for the background highlighting to be over, taking every state it computes.
+ *
+ * @param None
+ * @return None
+ */
+void hlJobFinish()
+{
+    while (E.buf->hljob)
+    {
+        for (int i = 0; i < E.buf->hljob->nthreads; i++)
+            pthread_join(E.buf->hljob->threads[i], NULL);
+        E.buf->hljob->nthreads = 0;
+        hlJobCommit();
+    }
+}
+
+/**
+ * Keeps the background highlighting in step with a change of the rows. The chunks
+ * after the change are renumbered; the one the change falls in is flagged dirty, to
+ * be highlighted again when it is handed over. A change across several chunks drops
+ * the job.
+ *
+ * @param at The index of the row that changed.
+ * @param delta The number of rows inserted after it, negative if rows were deleted.
+ * @return None
+ */
+void hlJobEdit(int at, int delta)
+{
+    struct hlJob *job = E.buf->hljob;
+    if (job == NULL)
+        return;
+
+    int last = at + (delta < 0 ? -delta : 0);
+    int hit = -1;
+    for (int k = job->merged; k < job->nchunks; k++)
+    {
+        struct hlJobChunk *c = &job->chunks[k];
+        if (last < c->row)
+            c->row += delta;
+        else if (at < c->row + c->count)
+        {
+            // rows joined across chunks, or more rows than a chunk is highlighted again with
+            if (hit >= 0 || at < c->row || last >= c->row + c->count ||
+                c->count + delta > 2 * EDITOR_SYNTAX_CHUNK)
+            {
+                hlJobCancel();
+                return;
+            }
+            hit = k;
+        }
+    }
+    if (hit >= 0)
+    {
+        struct hlJobChunk *c = &job->chunks[hit];
+        c->count += delta;
+        c->dirty = 1;
+    }
+    job->version = E.buf->pt.version;
+}
+
+/*** editor operations ***/
+
+/**
+ * Inserts a character at the cursor position.
+ * If the cursor is at the end of the file, a new empty row is appended before inserting the character.
+ *
+ * @param c The character to be inserted.
+ * @return None
+ */
+void editorInsertChar(int c)
+{
+    if (E.buf->cy == E.buf->numrows)
+        editorInsertRow(E.buf->numrows, "", 0);
+
+    editorRowInsertChar(editorRowAt(E.buf->cy), E.buf->cx, c);
+    E.buf->cx++;
+}
+
+/**
+ * Deletes a character at the cursor position.
+ * If the cursor is at the end of the file, nothing happens.
+ * If the cursor is not at the beginning of the line, the character to the left of the cursor is deleted.
+ * Otherwise the row is joined to the previous one by deleting the newline between them.
+ * After deleting the character, the cursor is moved one position to the left.
+ *
+ * @param None
+ * @return None
+ */
+void editorDelChar()
+{
+    if (E.buf->cy == E.buf->numrows)
+        return;
+    if (E.buf->cx == 0 && E.buf->cy == 0)
+        return;
+    erow *row = editorRowAt(E.buf->cy);
+    if (E.buf->cx > 0)
+    {
+        editorRowDelChar(row, E.buf->cx - 1);
+        E.buf->cx--;
+    }
+    else
+    {
+        E.buf->cx = editorRowAt(E.buf->cy - 1)->size;
+        editorBufferDelete(E.buf->cy - 1, E.buf->cx, 1);
+        E.buf->cy--;
+    }
+}
+
+/**
+ * Inserts text at the cursor position as one change of the buffer, and moves the cursor
+ * to its end. Terminals send the line breaks of pasted text as carriage returns, which
+ * become newlines; the text is converted where it is.
+ *
+ * @param s The text.
+ * @param len The length of the text.
+ * @return None
+ */
+void editorInsertText(char *s, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '\r')
+        {
+            s[n++] = '\n';
+            if (i + 1 < len && s[i + 1] == '\n')
+                i++;
+        }
+        else
+            s[n++] = s[i];
+    }
+    if (n == 0)
+        return;
+
+    if (E.buf->cy == E.buf->numrows)
+        editorInsertRow(E.buf->numrows, "", 0);
+
+    size_t end = ptLineStart(&E.buf->pt, E.buf->cy) + E.buf->cx + n;
+    editorBufferInsert(E.buf->cy, E.buf->cx, s, n);
+    E.buf->cy = ptLineOf(&E.buf->pt, end);
+    E.buf->cx = end - ptLineStart(&E.buf->pt, E.buf->cy);
+}
+
+/*** undo ***/
+
+/**
+ * Empties the undo journal, for when the text it recorded the changes of goes away.
+ *
+ * @param None
+ * @return None
+ */
+void editorUndoReset()
+{
+    struct undoJournal *u = &E.buf->undo;
+    u->len = u->cur = 0;
+    u->loglen = 0;
+}
+
+/**
+ * Makes room for more bytes at the end of the log of the undo journal.
+ *
+ * @param n The number of bytes.
+ * @return None
+ */
+void undoReserve(size_t n)
+{
+    struct undoJournal *u = &E.buf->undo;
+    if (u->loglen + n <= u->logcap)
+        return;
+    size_t cap = u->logcap ? u->logcap : 4096;
+    while (cap < u->loglen + n)
+        cap *= 2;
+    u->log = realloc(u->log, cap);
+    if (u->log == NULL)
+        die("realloc");
+    u->logcap = cap;
+}
+
+/**
+ * Drops the oldest records of the undo journal when a new one would take it past
+ * EDITOR_UNDO_BYTES. It drops down to half the budget, so the log only moves once in
+ * a while.
+ *
+ * @param need The number of bytes of the new record.
+ * @return None
+ */
+void undoTrim(size_t need)
+{
+    struct undoJournal *u = &E.buf->undo;
+    size_t weight = u->loglen + (u->len + 1) * sizeof(struct undoRecord) + need;
+    if (weight <= EDITOR_UNDO_BYTES)
+        return;
+
+    int k = 0;
+    size_t cut = 0;
+    while (k < u->len && weight > EDITOR_UNDO_BYTES / 2)
+    {
+        weight -= u->recs[k].len + sizeof(struct undoRecord);
+        cut = u->recs[k].pos + u->recs[k].len;
+        k++;
+    }
+
+    memmove(u->recs, &u->recs[k], (u->len - k) * sizeof(struct undoRecord));
+    u->len -= k;
+    u->cur = u->cur > k ? u->cur - k : 0;
+    memmove(u->log, &u->log[cut], u->loglen - cut);
+    u->loglen -= cut;
+    for (int j = 0; j < u->len; j++)
+        u->recs[j].pos -= cut;
+}
+
+/**
+ * Ends the run of keystrokes the last record of the undo journal is extended with.
+ *
+ * @param None
+ * @return None
+ */
+void editorUndoBreak()
+{
+    if (E.buf->undo.len > 0)
+        E.buf->undo.recs[E.buf->undo.len - 1].open = 0;
+}
+
+/**
+ * Records a change of the text in the undo journal, before the change is made. Typing
+ * extends the record of the keystrokes before it: characters inserted one after the
+ * other, or deleted one after the other with backspace or delete, are undone at once.
+ * A newline, or a cursor move, ends the run.
+ *
+ * @param insert Set for an insertion, clear for a deletion.
+ * @param off The offset of the change in the text.
+ * @param s The text inserted, or NULL for a deletion.
+ * @param len The number of bytes inserted or deleted.
+ * @return None
+ */
+void editorUndoRecord(int insert, size_t off, const char *s, size_t len)
+{
+    struct undoJournal *u = &E.buf->undo;
+    if (u->replaying || len == 0)
+        return;
+
+    // a change made after undoing drops the changes that could have been redone, and starts a record
+    if (u->cur < u->len)
+    {
+        u->loglen = u->recs[u->cur].pos;
+        u->len = u->cur;
+        editorUndoBreak();
+    }
+
+    if (len + sizeof(struct undoRecord) > EDITOR_UNDO_BYTES / 2)
+    {
+        // the older changes can not be undone without undoing this one first
+        editorUndoReset();
+        editorSetStatusMessage("Change too large to undo");
+        return;
+    }
+
+    char c = 0;
+    if (len == 1)
+    {
+        if (insert)
+            c = s[0];
+        else
+            ptCopy(&E.buf->pt, off, 1, &c);
+    }
+    int typing = (len == 1 && c != '\n');
+
+    struct undoRecord *last = u->len > 0 ? &u->recs[u->len - 1] : NULL;
+    if (last && last->open && typing && last->insert == insert)
+    {
+        // the bytes of the last record are at the end of the log
+        if ((insert && off == last->off + last->len) || (!insert && off == last->off))
+        {
+            undoReserve(1);
+            u->log[u->loglen++] = c;
+            last->len++;
+            return;
+        }
+        if (!insert && off + 1 == last->off)
+        {
+            undoReserve(1);
+            memmove(&u->log[last->pos + 1], &u->log[last->pos], last->len);
+            u->log[last->pos] = c;
+            u->loglen++;
+            last->len++;
+            last->off--;
+            return;
+        }
+    }
+    if (last)
+        last->open = 0;
+
+    undoTrim(len);
+    if (u->len == u->cap)
+    {
+        u->cap = u->cap ? u->cap * 2 : 64;
+        u->recs = realloc(u->recs, u->cap * sizeof(struct undoRecord));
+        if (u->recs == NULL)
+            die("realloc");
+    }
+    undoReserve(len);
+
+    u->recs[u->len] = (struct undoRecord){off, u->loglen, len, insert, typing};
+    if (insert)
+        memcpy(&u->log[u->loglen], s, len);
+    else
+        ptCopy(&E.buf->pt, off, len, &u->log[u->loglen]);
+    u->loglen += len;
+    u->len++;
+    u->cur = u->len;
+}
+
+/**
+ * Takes back or makes again a change recorded in the undo journal, and puts the cursor
+ * where the change ends. Only the bytes of the change are copied.
+ *
+ * @param r The record of the change.
+ * @param redo Set to make the change again, clear to take it back.
+ * @return None
+ */
+void editorUndoApply(struct undoRecord *r, int redo)
+{
+    int insert = (r->insert == redo);
+    int at = ptLineOf(&E.buf->pt, r->off);
+    int col = r->off - ptLineStart(&E.buf->pt, at);
+
+    E.buf->undo.replaying = 1;
+    if (insert)
+        editorBufferInsert(at, col, &E.buf->undo.log[r->pos], r->len);
+    else
+        editorBufferDelete(at, col, r->len);
+    E.buf->undo.replaying = 0;
+
+    size_t cursor = insert ? r->off + r->len : r->off;
+    E.buf->cy = ptLineOf(&E.buf->pt, cursor);
+    E.buf->cx = cursor - ptLineStart(&E.buf->pt, E.buf->cy);
+}
+
+/**
+ * Takes back the last change of the text that was not undone yet.
+ *
+ * @param None
+ * @return None
+ */
+void editorUndo()
+{
+    struct undoJournal *u = &E.buf->undo;
+    if (u->cur == 0)
+    {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    editorUndoBreak();
+    editorUndoApply(&u->recs[--u->cur], 0);
+}
+
+/**
+ * Makes again the last change of the text that was undone.
+ *
+ * @param None
+ * @return None
+ */
+void editorRedo()
+{
+    struct undoJournal *u = &E.buf->undo;
+    if (u->cur == u->len)
+    {
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    editorUndoApply(&u->recs[u->cur++], 1);
+}
+
+/*** file i/o ***/
+
+/**
+ * @struct editorSaveRun
+ * @brief Consecutive changed bytes of the file, written in place with one pwritev.
+ */
+struct editorSaveRun
+{
+    off_t off;  ///< The offset of the bytes in the file.
+    size_t len; ///< The number of bytes.
+    int first;  ///< The index of their first buffer in the wiov of the job.
+    int count;  ///< The number of buffers.
+};
+
+/**
+ * @struct editorSaveJob
+ * @brief A save running on a background thread. The thread writes a snapshot of
+ * the document to a temporary file next to the file, flushes it to the disk and
+ * renames it over the file, so the file is never seen half written, and the
+ * original buffer, which may be a mapping of the old file, stays readable.
+ * When only a small part of the file changed, the thread writes that part in
+ * place instead.
+ */
+struct editorSaveJob
+{
+    char *path;                 ///< The file to replace, with its symbolic links resolved.
+    struct pieceSnapshot snap;  ///< The document being saved.
+    unsigned long version;      ///< The version of the document in the snapshot.
+    mode_t mode;                ///< The permissions of the file.
+    int inplace;                ///< Set when only the changed bytes are written, into the file itself.
+    struct iovec *wiov;         ///< The changed bytes of an in-place save.
+    int nwiov;                  ///< The number of buffers in wiov.
+    int wiovcap;                ///< The capacity of wiov.
+    struct editorSaveRun *runs; ///< The runs of wiov, by increasing offset.
+    int nruns;                  ///< The number of runs.
+    int runcap;                 ///< The capacity of runs.
+    size_t written;             ///< The number of bytes written to the file.
+    struct stat st;             ///< The file once written.
+    int err;                    ///< The errno of the step that failed, 0 if none did.
+    int done;                   ///< Set by the thread once it is finished, read atomically.
+    int threaded;               ///< Set when the save runs on its own thread, to be joined.
+    pthread_t thread;           ///< The thread.
+};
+
+/**
+ * Writes every byte of a list of buffers, in batches of at most IOV_MAX of them,
+ * going on after short writes.
+ *
+ * @param fd The file descriptor.
+ * @param iov The buffers, which are consumed.
+ * @param count The number of buffers.
+ * @param off The offset to write them at, or -1 for the current position.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int editorWriteAll(int fd, struct iovec *iov, int count, off_t off)
+{
+    while (count > 0)
+    {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t n = off < 0 ? writev(fd, iov, batch) : pwritev(fd, iov, batch, off);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (off >= 0)
+            off += n;
+
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes the snapshot of a save job to a temporary file and renames it over the
+ * file. The directory is flushed too, so the rename itself survives a crash.
+ *
+ * @param job The save job.
+ * @return None
+ */
+void editorSaveReplace(struct editorSaveJob *job)
+{
+    size_t plen = strlen(job->path);
+    char *tmp = malloc(plen + 8);
+    memcpy(tmp, job->path, plen);
+    memcpy(&tmp[plen], ".XXXXXX", 8);
+
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+    {
+        job->err = errno;
+        free(tmp);
+        return;
+    }
+
+    if (fchmod(fd, job->mode) == -1 ||
+        editorWriteAll(fd, job->snap.iov, job->snap.count, -1) == -1 ||
+        fsync(fd) == -1 || fstat(fd, &job->st) == -1)
+        job->err = errno;
+    if (close(fd) == -1 && job->err == 0)
+        job->err = errno;
+    if (job->err == 0 && rename(tmp, job->path) == -1)
+        job->err = errno;
+
+    if (job->err)
+    {
+        unlink(tmp);
+    }
+    else
+    {
+        job->written = job->snap.len;
+        char *slash = strrchr(job->path, '/');
+        char *dir = slash ? strndup(job->path, slash == job->path ? 1 : slash - job->path) : strdup(".");
+        int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (dfd != -1)
+        {
+            fsync(dfd);
+            close(dfd);
+        }
+        free(dir);
+    }
+    free(tmp);
+}
+
+/**
+ * Writes the changed bytes of a save job into the file itself, and truncates the
+ * file when the document got shorter.
+ *
+ * @param job The save job.
+ * @return None
+ */
+void editorSaveInPlace(struct editorSaveJob *job)
+{
+    int fd = open(job->path, O_WRONLY);
+    if (fd == -1)
+    {
+        job->err = errno;
+        return;
+    }
+
+    for (int i = 0; i < job->nruns && job->err == 0; i++)
+    {
+        struct editorSaveRun *r = &job->runs[i];
+        if (editorWriteAll(fd, &job->wiov[r->first], r->count, r->off) == -1)
+            job->err = errno;
+    }
+    if (job->err == 0 && (ftruncate(fd, job->snap.len) == -1 || fsync(fd) == -1 || fstat(fd, &job->st) == -1))
+        job->err = errno;
+    if (close(fd) == -1 && job->err == 0)
+        job->err = errno;
+}
+
+/**
+ * Runs a save job, on its own thread unless none could be started.
+ *
+ * @param arg The editorSaveJob.
+ * @return NULL.
+ */
+void *editorSaveWorker(void *arg)
+{
+    struct editorSaveJob *job = arg;
+    if (job->inplace)
+        editorSaveInPlace(job);
+    else
+        editorSaveReplace(job);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    editorWake();
+    return NULL;
+}
+
+/**
+ * Adds changed bytes of the document to the ones an in-place save writes.
+ *
+ * @param job The save job.
+ * @param base The bytes.
+ * @param off Their offset in the document, which is where they go in the file.
+ * @param len Their length.
+ * @return None
+ */
+void editorSaveAddRange(struct editorSaveJob *job, char *base, size_t off, size_t len)
+{
+    struct editorSaveRun *last = job->nruns ? &job->runs[job->nruns - 1] : NULL;
+    if (last == NULL || (size_t)last->off + last->len != off)
+    {
+        if (job->nruns == job->runcap)
+        {
+            job->runcap = job->runcap ? job->runcap * 2 : 16;
+            job->runs = realloc(job->runs, job->runcap * sizeof(struct editorSaveRun));
+        }
+        last = &job->runs[job->nruns++];
+        *last = (struct editorSaveRun){(off_t)off, 0, job->nwiov, 0};
+    }
+
+    if (job->nwiov == job->wiovcap)
+    {
+        job->wiovcap = job->wiovcap ? job->wiovcap * 2 : 16;
+        job->wiov = realloc(job->wiov, job->wiovcap * sizeof(struct iovec));
+    }
+    job->wiov[job->nwiov].iov_base = base;
+    job->wiov[job->nwiov].iov_len = len;
+    job->nwiov++;
+    last->len += len;
+    last->count++;
+    job->written += len;
+}
+
+/**
+ * Compares the ranges of the original buffer pieces point into by their start.
+ *
+ * @param a The first pieceExtent.
+ * @param b The second pieceExtent.
+ * @return A negative, zero or positive value like strcmp.
+ */
+int editorExtentCompare(const void *a, const void *b)
+{
+    size_t x = ((const struct pieceExtent *)a)->start, y = ((const struct pieceExtent *)b)->start;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Checks whether a range of the file is read from by the pieces of a snapshot,
+ * through the mapping of the file that the original buffer is.
+ *
+ * @param refs The original buffer pieces of the snapshot, sorted by start.
+ * @param reach For each of them, the furthest end among it and the ones before.
+ * @param n The number of pieces.
+ * @param off The offset of the range.
+ * @param len The length of the range.
+ * @return 1 if it is, 0 otherwise.
+ */
+int editorExtentUsed(const struct pieceExtent *refs, const size_t *reach, int n, size_t off, size_t len)
+{
+    // the pieces starting before the end of the range
+    int lo = 0, hi = n;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (refs[mid].start < off + len)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && reach[lo - 1] > off;
+}
+
+/**
+ * Frees the changed bytes collected for an in-place save.
+ *
+ * @param job The save job.
+ * @return None
+ */
+void editorSaveDropRanges(struct editorSaveJob *job)
+{
+    free(job->wiov);
+    free(job->runs);
+    job->wiov = NULL;
+    job->runs = NULL;
+    job->nwiov = job->wiovcap = job->nruns = job->runcap = 0;
+    job->written = 0;
+}
+
+/**
+ * Decides whether a save only writes the bytes that changed, into the file itself.
+ * The part of a piece that the file already holds at its offset is left alone, so
+ * editing a line in place or appending to the file writes just the new bytes.
+ * The pieces come from the edits, so nothing has to track what they changed.
+ * The file is rewritten in full instead when it changed on disk, when more than
+ * 1 / EDITOR_SAVE_INPLACE of the document has to be written, which takes about as
+ * long and is atomic, when a byte to overwrite or to truncate is still read
+ * from the mapping of the file by the document, and when another buffer maps the file.
+ *
+ * @param job The save job, with its snapshot taken.
+ * @return None
+ */
+void editorSavePlan(struct editorSaveJob *job)
+{
+    struct editorDisk *dk = &E.buf->disk;
+    struct pieceSnapshot *ps = &job->snap;
+    struct stat st;
+
+    if (!dk->valid || stat(job->path, &st) == -1 || st.st_dev != dk->dev || st.st_ino != dk->ino ||
+        (size_t)st.st_size != dk->size || st.st_mtim.tv_sec != dk->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != dk->mtime.tv_nsec)
+        return;
+
+    // another buffer reading the file through a mapping, shared or its own, would see the bytes change
+    for (int i = 0; i < E.nbufs; i++)
+        if (E.bufs[i] != E.buf && E.bufs[i]->disk.mapped && E.bufs[i]->disk.dev == dk->dev &&
+            E.bufs[i]->disk.ino == dk->ino)
+            return;
+
+    int k = 0;
+    for (int i = 0; i < ps->count; i++)
+    {
+        struct pieceExtent *p = &ps->ext[i];
+        for (size_t x = p->off, end = p->off + p->len, y; x < end; x = y)
+        {
+            while (k < dk->count && dk->ext[k].off + dk->ext[k].len <= x)
+                k++;
+
+            char *text = (char *)ps->iov[i].iov_base + (x - p->off);
+            int clean = 0;
+            if (k < dk->count && dk->ext[k].off <= x)
+            {
+                // the same bytes, or other bytes that happen to be equal, like a moved newline
+                struct pieceExtent *d = &dk->ext[k];
+                y = (d->off + d->len < end) ? d->off + d->len : end;
+                clean = (d->buf == p->buf && d->start + (x - d->off) == p->start + (x - p->off)) ||
+                        !memcmp(&E.buf->pt.buf[d->buf][d->start + (x - d->off)], text, y - x);
+            }
+            else
+            {
+                y = (k < dk->count && dk->ext[k].off < end) ? dk->ext[k].off : end;
+            }
+            if (!clean)
+                editorSaveAddRange(job, text, x, y - x);
+
+            if (job->written * EDITOR_SAVE_INPLACE > ps->len)
+            {
+                editorSaveDropRanges(job);
+                return;
+            }
+        }
+    }
+
+    if (dk->mapped)
+    {
+        int n = 0;
+        struct pieceExtent *refs = malloc((ps->count + 1) * sizeof(struct pieceExtent));
+        size_t *reach = malloc((ps->count + 1) * sizeof(size_t));
+        for (int i = 0; i < ps->count; i++)
+            if (ps->ext[i].buf == PT_ORIGINAL)
+                refs[n++] = ps->ext[i];
+        qsort(refs, n, sizeof(struct pieceExtent), editorExtentCompare);
+        for (int i = 0; i < n; i++)
+            reach[i] = (i > 0 && reach[i - 1] > refs[i].start + refs[i].len) ? reach[i - 1] : refs[i].start + refs[i].len;
+
+        int used = ps->len < dk->size && editorExtentUsed(refs, reach, n, ps->len, dk->size - ps->len);
+        for (int i = 0; i < job->nruns && !used; i++)
+            used = editorExtentUsed(refs, reach, n, job->runs[i].off, job->runs[i].len);
+        free(refs);
+        free(reach);
+        if (used)
+        {
+            editorSaveDropRanges(job);
+            return;
+        }
+    }
+
+    job->inplace = 1;
+}
+
+/**
+ * Completes the running save, if any: waits for its thread, releases its snapshot
+ * and reports how it went. The document is only marked as saved when it was not
+ * edited since the snapshot was taken.
+ *
+ * @param None
+ * @return None
+ */
+void editorSaveWait()
+{
+    struct editorSaveJob *job = E.buf->save;
+    if (job == NULL)
+        return;
+
+    if (job->threaded)
+        pthread_join(job->thread, NULL);
+
+    if (job->err)
+    {
+        // a failed rename leaves the file as it was, a failed write in place does not
+        if (job->inplace)
+            E.buf->disk.valid = 0;
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+    }
+    else
+    {
+        if (E.buf->pt.version == job->version)
+            E.buf->modified = 0;
+        if (job->inplace)
+            editorSetStatusMessage("%zu of %zu bytes written to disk in place", job->written, job->snap.len);
+        else
+            editorSetStatusMessage("%zu bytes written to disk", job->written);
+
+        // the file now holds the pieces of the snapshot, each at its offset
+        free(E.buf->disk.ext);
+        E.buf->disk.ext = job->snap.ext;
+        E.buf->disk.count = job->snap.count;
+        job->snap.ext = NULL;
+        E.buf->disk.size = job->snap.len;
+        E.buf->disk.dev = job->st.st_dev;
+        E.buf->disk.ino = job->st.st_ino;
+        E.buf->disk.mtime = job->st.st_mtim;
+        E.buf->disk.valid = 1;
+        if (!job->inplace)
+            E.buf->disk.mapped = 0;
+        if (E.buf->follow.on)
+            editorFollowOpen();
+    }
+
+    ptRelease(&E.buf->pt, &job->snap);
+    editorSaveDropRanges(job);
+    free(job->path);
+    free(job);
+    E.buf->save = NULL;
+}
+
+/**
+ * Completes the running save once its thread is finished, while the editor is idle.
+ *
+ * @param None
+ * @return None
+ */
+void editorSaveIdle()
+{
+    if (E.buf->save && __atomic_load_n(&E.buf->save->done, __ATOMIC_ACQUIRE))
+    {
+        editorSaveWait();
+        editorRefreshScreen();
+    }
+}
+
+/**
+ * Reads everything left in a file descriptor into a newly allocated buffer.
+ *
+ * @param fd The file descriptor to read from.
+ * @param len A pointer to a variable that will store the number of bytes read.
+ * @return A pointer to the dynamically allocated buffer holding the contents, or NULL
+ * with errno set if reading failed.
+ */
+char *editorReadFile(int fd, size_t *len)
+{
+    size_t cap = 4096;
+    char *buf = malloc(cap);
+    ssize_t nread;
+
+    *len = 0;
+    while ((nread = read(fd, &buf[*len], cap - *len)) != 0)
+    {
+        if (nread == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            int err = errno;
+            free(buf);
+            errno = err;
+            return NULL;
+        }
+        *len += nread;
+        if (*len == cap)
+        {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (buf == NULL)
+                die("realloc");
+        }
+    }
+    return buf;
+}
+
+/**
+ * Thread entry point indexing the file being opened, from where the document ends.
+ * The chunks start small, so the first screen is indexed at once, and grow up to
+ * EDITOR_LOAD_CHUNK.
+ *
+ * @param arg The editorLoad.
+ * @return NULL
+ */
+void *editorLoadWorker(void *arg)
+{
+    struct editorLoad *ld = arg;
+    liScanFn scan = liScanner();
+    size_t off = ld->loaded;
+    size_t step = EDITOR_LOAD_FIRST;
+
+    while (off < ld->len && !__atomic_load_n(&ld->cancel, __ATOMIC_RELAXED))
+    {
+        size_t n = ld->len - off < step ? ld->len - off : step;
+        struct lineIndex li = {0};
+        scan(&li, &ld->buf[off], n, off);
+
+        pthread_mutex_lock(&ld->lock);
+        if (ld->count + li.count > ld->cap)
+        {
+            ld->cap = ld->cap ? ld->cap : 1024;
+            while (ld->cap < ld->count + li.count)
+                ld->cap *= 2;
+            ld->nl = realloc(ld->nl, ld->cap * sizeof(size_t));
+            if (ld->nl == NULL)
+                die("realloc");
+        }
+        if (li.count)
+            memcpy(&ld->nl[ld->count], li.nl, li.count * sizeof(size_t));
+        ld->count += li.count;
+        ld->cr |= li.cr;
+        ld->scanned = off + n;
+        pthread_cond_broadcast(&ld->cond);
+        pthread_mutex_unlock(&ld->lock);
+
+        free(li.nl);
+        editorWake();
+        off += n;
+        if (step < EDITOR_LOAD_CHUNK)
+            step *= 2;
+    }
+
+    pthread_mutex_lock(&ld->lock);
+    ld->done = 1;
+    pthread_cond_broadcast(&ld->cond);
+    pthread_mutex_unlock(&ld->lock);
+    editorWake();
+    return NULL;
+}
+
+/**
+ * Adds the lines found by the loader to the document, after its last line. The
+ * document only takes whole lines, and the last one of the file once the loader
+ * is finished, when it is also joined.
+ *
+ * @param None
+ * @return 1 when the document grew or the loading ended, 0 otherwise.
+ */
+int editorLoadTake()
+{
+    struct editorLoad *ld = &E.buf->load;
+    struct pieceTable *pt = &E.buf->pt;
+    if (!ld->active)
+        return 0;
+
+    pthread_mutex_lock(&ld->lock);
+    size_t n = ld->count;
+    if (pt->nlcount[PT_ORIGINAL] + n > ld->nlcap)
+    {
+        ld->nlcap = ld->nlcap ? ld->nlcap : 1024;
+        while (ld->nlcap < pt->nlcount[PT_ORIGINAL] + n)
+            ld->nlcap *= 2;
+        pt->nl[PT_ORIGINAL] = realloc(pt->nl[PT_ORIGINAL], ld->nlcap * sizeof(size_t));
+        if (pt->nl[PT_ORIGINAL] == NULL)
+            die("realloc");
+    }
+    if (n)
+        memcpy(&pt->nl[PT_ORIGINAL][pt->nlcount[PT_ORIGINAL]], ld->nl, n * sizeof(size_t));
+    pt->nlcount[PT_ORIGINAL] += n;
+    ld->count = 0;
+    int cr = ld->cr;
+    int done = ld->done;
+    pthread_mutex_unlock(&ld->lock);
+
+    size_t count = pt->nlcount[PT_ORIGINAL];
+    size_t to = done ? ld->len : (count ? pt->nl[PT_ORIGINAL][count - 1] + 1 : 0);
+    if (to > ld->loaded)
+    {
+        int oldrows = E.buf->numrows;
+        ptLoadRange(pt, ld->loaded, to, cr);
+        ld->loaded = to;
+        pt->version++;
+        E.buf->numrows = ptLineCount(pt);
+        editorRowsChanged(oldrows, E.buf->numrows - oldrows);
+    }
+
+    if (done)
+    {
+        pthread_join(ld->thread, NULL);
+        pthread_mutex_destroy(&ld->lock);
+        pthread_cond_destroy(&ld->cond);
+        free(ld->nl);
+        ld->nl = NULL;
+        ld->count = ld->cap = 0;
+        ld->active = 0;
+    }
+    return n > 0 || done;
+}
+
+/**
+ * Waits until the document holds a given row, or the whole file, taking the lines
+ * from the loader as they come.
+ *
+ * @param at The index of the row.
+ * @return None
+ */
+void editorLoadUpto(int at)
+{
+    struct editorLoad *ld = &E.buf->load;
+    while (ld->active && at >= E.buf->numrows)
+    {
+        pthread_mutex_lock(&ld->lock);
+        while (ld->count == 0 && !ld->done)
+            pthread_cond_wait(&ld->cond, &ld->lock);
+        pthread_mutex_unlock(&ld->lock);
+        editorLoadTake();
+    }
+}
+
+/**
+ * Waits until the whole file is in the document.
+ *
+ * @param None
+ * @return None
+ */
+void editorLoadFinish()
+{
+    editorLoadUpto(INT_MAX);
+}
+
+/**
+ * Stops the loader and drops what it did not add to the document yet, before the
+ * buffers it reads go.
+ *
+ * @param None
+ * @return None
+ */
+void editorLoadCancel()
+{
+    struct editorLoad *ld = &E.buf->load;
+    if (!ld->active)
+        return;
+    __atomic_store_n(&ld->cancel, 1, __ATOMIC_RELAXED);
+    pthread_join(ld->thread, NULL);
+    pthread_mutex_destroy(&ld->lock);
+    pthread_cond_destroy(&ld->cond);
+    free(ld->nl);
+    memset(ld, 0, sizeof(*ld));
+}
+
+/**
+ * Adds the lines the loader found to the document and shows them, while the
+ * editor is idle.
+ *
+ * @param None
+ * @return None
+ */
+void editorLoadIdle()
+{
+    if (editorLoadTake())
+        editorRefreshScreen();
+}
+
+/**
+ * Starts indexing a mapped file on a background thread, the document holding the
+ * lines before a given offset of it, or none of it. The thread is not used when it
+ * can't be started.
+ *
+ * @param buf The mapping of the file, which the piece table owns.
+ * @param len The length of the file.
+ * @param from The offset the loader starts at, which starts a line.
+ * @return 1 when the loader runs, 0 otherwise.
+ */
+int editorLoadStart(char *buf, size_t len, size_t from)
+{
+    struct editorLoad *ld = &E.buf->load;
+    memset(ld, 0, sizeof(*ld));
+    ld->buf = buf;
+    ld->len = len;
+    ld->loaded = from;
+    pthread_mutex_init(&ld->lock, NULL);
+    pthread_cond_init(&ld->cond, NULL);
+    if (pthread_create(&ld->thread, NULL, editorLoadWorker, ld) != 0)
+    {
+        pthread_mutex_destroy(&ld->lock);
+        pthread_cond_destroy(&ld->cond);
+        return 0;
+    }
+    ld->active = 1;
+    return 1;
+}
+
+/**
+ * Looks for another buffer whose original buffer maps a file as it is on disk, all
+ * of it indexed. The file has to hold the original buffer and nothing else, so the
+ * mapping is not shared once the file was saved in place.
+ *
+ * @param st The status of the file.
+ * @return The buffer, or NULL if there is none.
+ */
+struct editorBuffer *editorFindMapping(struct stat *st)
+{
+    for (int i = 0; i < E.nbufs; i++)
+    {
+        struct editorBuffer *b = E.bufs[i];
+        struct editorDisk *dk = &b->disk;
+        if (b != E.buf && b->pt.mapped && !b->load.active && dk->valid && dk->mapped &&
+            dk->dev == st->st_dev && dk->ino == st->st_ino && dk->size == (size_t)st->st_size &&
+            dk->mtime.tv_sec == st->st_mtim.tv_sec && dk->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+            dk->count == 1 && dk->ext[0].buf == PT_ORIGINAL && dk->ext[0].start == 0 &&
+            b->pt.len[PT_ORIGINAL] == dk->size)
+            return b;
+    }
+    return NULL;
+}
+
+/**
+ * Opens a file and loads its contents as the original buffer of the piece table.
+ * Regular files are mapped instead of read, so opening only costs the scan that builds
+ * the newline index and the rows are read straight from the mapping until they are edited.
+ * Other files, like pipes, are read into memory. A mapping above EDITOR_LOAD_ASYNC is
+ * indexed on a background thread: this only waits for the first screen of lines, and
+ * the rest of the file joins the document while the editor runs. A file another buffer
+ * has open unchanged shares its mapping and newline index instead, and a file whose
+ * index is in the index cache maps it, with its highlighting checkpoints.
+ * A file that can't be opened or read, or a directory, leaves the document as it was.
+ *
+ * @param filename The name of the file to be opened.
+ * @return 0 on success, -1 with errno set and the error in the status bar otherwise.
+ */
+int editorOpen(char *filename)
+{
+    double start = editorNow();
+
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd != -1 && fstat(fd, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        close(fd);
+        fd = -1;
+        errno = EISDIR;
+    }
+    if (fd == -1)
+    {
+        int err = errno;
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    // the buffers are about to go, and the save, the loader and the highlighting may still be reading them
+    editorSaveWait();
+    editorLoadCancel();
+    hlJobCancel();
+
+    char *buf = NULL;
+    size_t len = 0;
+    int mapped = 0, copied = 0;
+
+    // MAP_PRIVATE - the editor never writes through the mapping
+    // a mapped file truncated by someone else while it is open reads as zeros past its new
+    // end, see editorHandleBus; saving in place only overwrites the bytes no piece reads anymore
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    int follow = E.buf->follow.on;
+    struct editorBuffer *twin = regular && st.st_size > 0 && !follow ? editorFindMapping(&st) : NULL;
+    if (twin)
+    {
+        len = st.st_size;
+        mapped = 1;
+    }
+    else if (regular && follow)
+    {
+        // a followed file may well be truncated, so what it holds is read instead of
+        // mapped; a file truncated meanwhile is followed from where the reading stopped
+        buf = malloc(st.st_size + 1);
+        if (buf == NULL)
+            die("malloc");
+        while (buf && len < (size_t)st.st_size)
+        {
+            ssize_t got = pread(fd, buf + len, st.st_size - len, len);
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got == -1)
+            {
+                int err = errno;
+                free(buf);
+                buf = NULL;
+                errno = err;
+            }
+            else if (got == 0)
+                break;
+            else
+                len += got;
+        }
+        st.st_size = len;
+        copied = 1;
+    }
+    else if (regular && st.st_size > 0)
+    {
+        buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED)
+        {
+            len = st.st_size;
+            mapped = 1;
+        }
+    }
+    if (!mapped && !copied)
+        buf = editorReadFile(fd, &len);
+    if (!mapped && buf == NULL)
+    {
+        int err = errno;
+        close(fd);
+        editorSetStatusMessage("Can't read %s: %s", filename, strerror(err));
+        errno = err;
+        return -1;
+    }
+    close(fd);
+
+    free(E.buf->filename);
+    E.buf->filename = strdup(filename);
+
+    editorRowCacheClear();
+    ptFree(&E.buf->pt);
+    memset(&E.buf->index, 0, sizeof(E.buf->index));
+    if (twin)
+        ptShare(&E.buf->pt, &twin->pt);
+    else if (mapped && editorIndexOpen(buf, len, &st))
+    {
+        // the lines the index cache holds are in the document, the loader may be adding the others
+    }
+    else if (mapped && len > EDITOR_LOAD_ASYNC && editorLoadStart(buf, len, 0))
+    {
+        E.buf->pt.version++;
+        E.buf->pt.buf[PT_ORIGINAL] = buf;
+        E.buf->pt.len[PT_ORIGINAL] = len;
+        E.buf->pt.mapped = mapped;
+    }
+    else
+        ptLoad(&E.buf->pt, buf, len, mapped);
+    E.buf->numrows = ptLineCount(&E.buf->pt);
+    editorUndoReset();
+
+    // the file holds the original buffer
+    free(E.buf->disk.ext);
+    memset(&E.buf->disk, 0, sizeof(E.buf->disk));
+    if (regular && len == (size_t)st.st_size)
+    {
+        if (len > 0)
+        {
+            E.buf->disk.ext = malloc(sizeof(struct pieceExtent));
+            E.buf->disk.ext[0] = (struct pieceExtent){0, len, PT_ORIGINAL, 0};
+            E.buf->disk.count = 1;
+        }
+        E.buf->disk.valid = 1;
+        E.buf->disk.mapped = mapped;
+        E.buf->disk.size = len;
+        E.buf->disk.dev = st.st_dev;
+        E.buf->disk.ino = st.st_ino;
+        E.buf->disk.mtime = st.st_mtim;
+    }
+
+    E.buf->hlstatecap = E.buf->numrows;
+    E.buf->hlstate = realloc(E.buf->hlstate, E.buf->hlstatecap ? E.buf->hlstatecap : 1);
+    memset(E.buf->hlstate, 0, E.buf->numrows);
+
+    // a screen of lines, and the rows after it for the rows a screen down
+    if (E.buf->load.active)
+        editorLoadUpto(E.screenrows * 2);
+
+    editorSelectSyntaxHighlight();
+    editorIndexStates();
+    E.buf->modified = 0;
+    if (E.buf->numrows > EDITOR_SYNTAX_BATCH)
+        hlJobStart();
+    editorIndexIdle();
+
+    E.stats.open = editorNow() - start;
+    return 0;
+}
+
+/**
+ * Tells of the buffers whose mapped file was truncated under them, see editorHandleBus.
+ * The text that was past the new end of the file reads as zeros; the document is
+ * flagged modified and the file no longer taken to hold it, so a save writes it all anew.
+ *
+ * @param None
+ * @return None
+ */
+void editorTruncatedIdle()
+{
+    int found = 0;
+    for (int i = 0; i < E.nbufs; i++)
+    {
+        struct editorBuffer *b = E.bufs[i];
+        if (!b->truncated)
+            continue;
+        b->truncated = 0;
+        b->modified = 1;
+        b->disk.valid = 0;
+        b->index.save = 0;
+        editorSetStatusMessage("%s was truncated by someone else; the text past its end is lost",
+                               b->filename ? b->filename : "The file");
+        found = 1;
+    }
+    if (found)
+        editorRefreshScreen();
+}
+
+/**
+ * Follows the file the document was loaded from or saved to: it is opened once more
+ * to read what is appended to it, and watched with inotify, or polled every
+ * EDITOR_FOLLOW_POLL milliseconds where there is no inotify. The directory is watched
+ * too, for a new file taking the name of the followed one. A file that can't be
+ * opened ends follow mode, with the error in the status bar.
+ *
+ * @param None
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int editorFollowOpen()
+{
+    struct editorFollow *f = &E.buf->follow;
+    editorLoadFinish();
+
+    if (f->fd != -1)
+        close(f->fd);
+    f->fd = open(E.buf->filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (f->fd == -1 || fstat(f->fd, &st) == -1)
+    {
+        int err = errno;
+        if (f->fd != -1)
+            close(f->fd);
+        f->fd = -1;
+        f->on = 0;
+        editorSetStatusMessage("Can't follow %s: %s", E.buf->filename, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    // the file as it was loaded, which it still is unless it changed meanwhile
+    f->on = 1;
+    f->size = E.buf->disk.size;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->partial = 0;
+    if (f->size > 0)
+    {
+        char last;
+        f->partial = pread(f->fd, &last, 1, f->size - 1) == 1 && last != '\n';
+    }
+    f->next = editorNow() + EDITOR_FOLLOW_POLL;
+
+#ifdef __linux__
+    if (f->notify == -1)
+    {
+        f->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (f->notify != -1)
+        {
+            char *path = strdup(E.buf->filename);
+            inotify_add_watch(f->notify, dirname(path), IN_CREATE | IN_MOVED_TO);
+            free(path);
+        }
+    }
+    else
+        inotify_rm_watch(f->notify, f->wd);
+    if (f->notify != -1)
+        f->wd = inotify_add_watch(f->notify, E.buf->filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#endif
+    return 0;
+}
+
+/**
+ * Opens a file to follow it, with the cursor at its end. A file that can't be
+ * opened leaves the document as it was, and follow mode off.
+ *
+ * @param filename The file.
+ * @return 0 on success, -1 with errno set and the error in the status bar otherwise.
+ */
+int editorFollowStart(char *filename)
+{
+    // set before the file is opened, for it to be read rather than mapped
+    E.buf->follow.on = 1;
+    if (editorOpen(filename) == -1)
+    {
+        E.buf->follow.on = 0;
+        return -1;
+    }
+    if (editorFollowOpen() == -1)
+        return -1;
+    E.buf->cy = E.buf->numrows > 0 ? E.buf->numrows - 1 : 0;
+    E.buf->cx = 0;
+    return 0;
+}
+
+/**
+ * Appends bytes that were added to the followed file to the document. Carriage
+ * returns before a newline are left out, as when a file is loaded, and a missing
+ * final newline is added, as when a file is loaded. This is not an edit: it can't
+ * be undone and leaves the document as modified as it was. A cursor on the last row
+ * stays on the last row.
+ *
+ * @param s The bytes, which are converted where they are, with room for one more.
+ * @param len The number of bytes.
+ * @return None
+ */
+void editorFollowAppend(char *s, size_t len)
+{
+    struct editorFollow *f = &E.buf->follow;
+
+    size_t n = 0, cr = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '\n')
+            while (n > 0 && s[n - 1] == '\r')
+                n--, cr = 1;
+        s[n++] = s[i];
+    }
+
+    int pinned = E.buf->cy >= E.buf->numrows - 1;
+    int modified = E.buf->modified;
+    int oldrows = E.buf->numrows;
+    size_t start = E.buf->pt.len[PT_ADD];
+
+    // not a change of the user, so there is nothing to undo
+    E.buf->undo.replaying = 1;
+    if (f->partial)
+    {
+        // the text goes before the newline added to the last line, which its own replaces
+        int at = E.buf->numrows - 1;
+        editorBufferInsert(at, editorRowAt(at)->size, s, n);
+        if (s[n - 1] == '\n')
+            editorBufferDelete(E.buf->numrows - 1, 0, 1);
+    }
+    else if (s[n - 1] == '\n')
+        editorBufferInsert(E.buf->numrows, 0, s, n);
+    else
+    {
+        s[n] = '\n';
+        editorBufferInsert(E.buf->numrows, 0, s, n + 1);
+    }
+    E.buf->undo.replaying = 0;
+    E.buf->modified = modified;
+    f->partial = s[n - 1] != '\n';
+
+    // the file now holds the text at its end, unless carriage returns were left out
+    if (cr || !E.buf->disk.valid)
+        E.buf->disk.valid = 0;
+    else
+    {
+        E.buf->disk.ext = realloc(E.buf->disk.ext, (E.buf->disk.count + 1) * sizeof(struct pieceExtent));
+        if (E.buf->disk.ext == NULL)
+            die("realloc");
+        E.buf->disk.ext[E.buf->disk.count++] = (struct pieceExtent){f->size, len, PT_ADD, start};
+        E.buf->disk.size = f->size + len;
+    }
+    f->size += len;
+
+    if (pinned && E.buf->numrows > oldrows)
+    {
+        E.buf->cy = E.buf->numrows - 1;
+        E.buf->cx = 0;
+    }
+}
+
+/**
+ * Appends to the document what was added to the followed file. A file that got
+ * shorter was truncated, and a new file under its name means it was rotated: both
+ * are opened again, unless the document has changes that would be lost. When the
+ * file can't be opened again, the document stays as it is and is no longer followed.
+ *
+ * @param None
+ * @return None
+ */
+void editorFollowCheck()
+{
+    struct editorFollow *f = &E.buf->follow;
+    struct stat st, fst;
+    if (fstat(f->fd, &fst) == -1)
+        return;
+
+    // the search workers read the document, so it is left alone until the search is over
+    if (E.buf->search.active)
+    {
+        E.events.woken = 1;
+        return;
+    }
+    // a save replaces the file, which is followed again once the save is done
+    if (E.buf->save)
+        return;
+
+    // until a new file takes the name, what is left to read is read from the old one
+    int rotated = stat(E.buf->filename, &st) == 0 && (st.st_ino != f->ino || st.st_dev != f->dev);
+    int truncated = (size_t)fst.st_size < f->size;
+    if (rotated || truncated)
+    {
+        if (E.buf->modified)
+        {
+            editorSetStatusMessage("File was %s; not following it, to keep the changes",
+                                   rotated ? "rotated" : "truncated");
+            f->on = 0;
+            return;
+        }
+        // editorOpen frees the name it is given
+        char *path = strdup(E.buf->filename);
+        if (editorFollowStart(path) == -1)
+            editorSetStatusMessage("File was %s and can't be opened again: %s; not following it",
+                                   rotated ? "rotated" : "truncated", strerror(errno));
+        free(path);
+        editorRefreshScreen();
+        return;
+    }
+    if ((size_t)fst.st_size == f->size)
+        return;
+
+    // the document is extended past the end of the loaded file
+    editorLoadFinish();
+    char *buf = malloc(EDITOR_FOLLOW_CHUNK + 1);
+    if (buf == NULL)
+        die("malloc");
+    while (f->size < (size_t)fst.st_size)
+    {
+        size_t want = (size_t)fst.st_size - f->size;
+        ssize_t got = pread(f->fd, buf, want < EDITOR_FOLLOW_CHUNK ? want : EDITOR_FOLLOW_CHUNK, f->size);
+        if (got <= 0)
+            break;
+
+        // a carriage return may be followed by a newline yet to come
+        size_t len = got;
+        while (len > 0 && buf[len - 1] == '\r')
+            len--;
+        if (len == 0)
+            break;
+        editorFollowAppend(buf, len);
+    }
+    free(buf);
+    E.buf->disk.mtime = fst.st_mtim;
+    editorRefreshScreen();
+}
+
+/**
+ * Saves the contents of the editor buffer to a file.
+ * If the file doesn't exist, it will be created. The file is written by a
+ * background thread from a snapshot of the document, so editing goes on meanwhile.
+ *
+ * @param None
+ * @return None
+ */
+void editorSave()
+{
+    if (E.buf->filename == NULL)
+    {
+        E.buf->filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (E.buf->filename == NULL)
+        {
+            editorSetStatusMessage("Operation aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    // one save at a time, so they reach the disk in order, and of the whole file
+    editorSaveWait();
+    editorLoadFinish();
+
+    struct editorSaveJob *job = calloc(1, sizeof(struct editorSaveJob));
+    job->path = realpath(E.buf->filename, NULL);
+    if (job->path == NULL)
+        job->path = strdup(E.buf->filename);
+    job->version = E.buf->pt.version;
+
+    struct stat st;
+    if (stat(job->path, &st) == 0)
+    {
+        job->mode = st.st_mode & 07777;
+    }
+    else
+    {
+        mode_t mask = umask(0);
+        umask(mask);
+        job->mode = 0666 & ~mask;
+    }
+
+    ptSnapshot(&E.buf->pt, &job->snap);
+    editorSavePlan(job);
+    E.buf->save = job;
+
+    if (pthread_create(&job->thread, NULL, editorSaveWorker, job) == 0)
+    {
+        job->threaded = 1;
+        editorSetStatusMessage("Saving %zu bytes...", job->snap.len);
+    }
+    else
+    {
+        editorSaveWorker(job);
+        editorSaveWait();
+    }
+}
+
+/*** syntax definitions ***/
+
+/**
+ * @struct syntaxImage
+ * @brief The header of a compiled syntax as the cache stores it.
+ *
+ * It is followed by the offsets of the file match patterns, the displacements and the
+ * slots of the keyword table, and the pool of the strings. A string is stored as its offset in the pool plus
+ * one, 0 standing for NULL; the name of the file type comes first in the pool.
+ */
+struct syntaxImage
+{
+    uint32_t flags;         ///< The flags of the syntax.
+    uint32_t seed;          ///< The seed of the keyword table.
+    uint32_t mask;          ///< The number of slots of the keyword table minus one.
+    uint32_t bmask;         ///< The number of buckets of the keyword table minus one.
+    uint32_t maxlen;        ///< The length of the longest keyword.
+    uint32_t nmatch;        ///< The number of file match patterns.
+    uint32_t poollen;       ///< The length of the pool.
+    uint32_t filetype;      ///< The name of the file type.
+    uint32_t delims[3];     ///< The single-line comment start, multi-line comment start and end.
+    uint32_t separators;    ///< The separators the syntax adds.
+    uint32_t quotes;        ///< The quotes of the syntax.
+    unsigned char cls[256]; ///< The class of every byte.
+};
+
+/**
+ * @struct syntaxImageSlot
+ * @brief A slot of a keyword table as the cache stores it.
+ */
+struct syntaxImageSlot
+{
+    uint32_t word; ///< The keyword, as a string of the pool, 0 for an empty slot.
+    uint32_t len;  ///< The length of the keyword.
+    uint32_t hl;   ///< The highlight of the keyword.
+};
+
+/**
+ * @struct syntaxCacheEntry
+ * @brief The header of a definition file in the cache, followed by its path and the image of its syntax.
+ */
+struct syntaxCacheEntry
+{
+    int64_t mtime;     ///< The modification time of the file, in seconds.
+    int64_t mtimensec; ///< The nanoseconds of the modification time.
+    int64_t size;      ///< The size of the file.
+    uint32_t pathlen;  ///< The length of the path.
+    uint32_t imagelen; ///< The length of the image.
+};
+
+/**
+ * @struct syntaxFile
+ * @brief A definition file found at startup, with the image of its syntax.
+ */
+struct syntaxFile
+{
+    char *path;      ///< The path of the file.
+    struct stat st;  ///< The file, when it was compiled.
+    char *image;     ///< The image, in the cache that was read or owned.
+    size_t imagelen; ///< The length of the image.
+    int owned;       ///< Set when the image was compiled rather than read from the cache.
+};
+
+/**
+ * @struct syntaxPool
+ * @brief The strings of an image being built.
+ */
+struct syntaxPool
+{
+    char *b;    ///< The strings, each followed by a NUL.
+    size_t len; ///< The length of the pool.
+    size_t cap; ///< The capacity of b.
+};
+
+/**
+ * Adds a string to the pool of an image being built.
+ *
+ * @param p The pool.
+ * @param s The string, or NULL.
+ * @param len The length of the string.
+ * @return The string as stored in the image: its offset in the pool plus one, 0 for NULL.
+ */
+uint32_t hlPoolAdd(struct syntaxPool *p, const char *s, size_t len)
+{
+    if (s == NULL)
+        return 0;
+    if (p->len + len + 1 > p->cap)
+    {
+        p->cap = (p->len + len + 1) * 2;
+        p->b = realloc(p->b, p->cap);
+        if (p->b == NULL)
+            die("realloc");
+    }
+    memcpy(&p->b[p->len], s, len);
+    p->b[p->len + len] = '\0';
+    p->len += len + 1;
+    return p->len - len;
+}
+
+/**
+ * Adds a NUL-terminated string to the pool of an image being built.
+ *
+ * @param p The pool.
+ * @param s The string, or NULL.
+ * @return The string as stored in the image.
+ */
+uint32_t hlPoolString(struct syntaxPool *p, const char *s)
+{
+    return hlPoolAdd(p, s, s ? strlen(s) : 0);
+}
+
+/**
+ * Returns a string of the pool of an image.
+ *
+ * @param pool The pool.
+ * @param len The length of the pool.
+ * @param off The string as stored in the image.
+ * @return The string, or NULL for 0 or an offset out of the pool.
+ */
+char *hlPoolAt(char *pool, uint32_t len, uint32_t off)
+{
+    return (off == 0 || off > len) ? NULL : &pool[off - 1];
+}
+
+/**
+ * Serializes a compiled syntax into the image the cache stores.
+ *
+ * @param s The syntax, compiled with hlCompile.
+ * @param len Set to the length of the image.
+ * @return The image, to be freed by the caller.
+ */
+char *hlImageBuild(struct editorSyntax *s, size_t *len)
+{
+    struct keywordTable *kt = s->kwtable;
+    struct syntaxPool pool = {NULL, 0, 0};
+    struct syntaxImage im;
+    memset(&im, 0, sizeof(im));
+
+    im.filetype = hlPoolString(&pool, s->filetype);
+    im.flags = s->flags;
+    im.seed = kt->seed;
+    im.mask = kt->mask;
+    im.bmask = kt->bmask;
+    im.maxlen = kt->maxlen;
+    im.delims[0] = hlPoolString(&pool, s->singleline_comment_start);
+    im.delims[1] = hlPoolString(&pool, s->multiline_comment_start);
+    im.delims[2] = hlPoolString(&pool, s->multiline_comment_end);
+    im.separators = hlPoolString(&pool, s->separators);
+    im.quotes = hlPoolString(&pool, s->quotes);
+    memcpy(im.cls, s->cls, sizeof(im.cls));
+
+    while (s->filematch[im.nmatch])
+        im.nmatch++;
+    uint32_t *match = malloc(im.nmatch * sizeof(uint32_t) + 1);
+    for (uint32_t i = 0; i < im.nmatch; i++)
+        match[i] = hlPoolString(&pool, s->filematch[i]);
+
+    size_t nslots = (size_t)kt->mask + 1, nbuckets = (size_t)kt->bmask + 1;
+    uint32_t *disp = malloc(nbuckets * sizeof(uint32_t));
+    for (size_t i = 0; disp && i < nbuckets; i++)
+        disp[i] = kt->disp[i];
+    struct syntaxImageSlot *slots = malloc(nslots * sizeof(struct syntaxImageSlot));
+    for (size_t i = 0; i < nslots; i++)
+    {
+        struct keywordEntry *e = &kt->slots[i];
+        slots[i] = (struct syntaxImageSlot){hlPoolAdd(&pool, e->word, e->len), e->len, e->hl};
+    }
+    im.poollen = pool.len;
+
+    *len = sizeof(im) + (im.nmatch + nbuckets) * sizeof(uint32_t) + nslots * sizeof(struct syntaxImageSlot) + pool.len;
+    char *out = malloc(*len);
+    if (match == NULL || disp == NULL || slots == NULL || out == NULL)
+        die("malloc");
+    char *p = out;
+    memcpy(p, &im, sizeof(im));
+    p += sizeof(im);
+    memcpy(p, match, im.nmatch * sizeof(uint32_t));
+    p += im.nmatch * sizeof(uint32_t);
+    memcpy(p, disp, nbuckets * sizeof(uint32_t));
+    p += nbuckets * sizeof(uint32_t);
+    memcpy(p, slots, nslots * sizeof(struct syntaxImageSlot));
+    p += nslots * sizeof(struct syntaxImageSlot);
+    if (pool.len)
+        memcpy(p, pool.b, pool.len);
+
+    free(match);
+    free(disp);
+    free(slots);
+    free(pool.b);
+    return out;
+}
+
+/**
+ * Frees a syntax made out of an image.
+ *
+ * @param s The syntax.
+ * @return None
+ */
+void hlImageFree(struct editorSyntax *s)
+{
+    free(s->filetype);
+    free(s->filematch);
+    free(s->kwtable->slots);
+    free(s->kwtable->disp);
+    free(s->kwtable);
+    s->filetype = NULL;
+    s->filematch = NULL;
+    s->kwtable = NULL;
+}
+
+/**
+ * Makes a syntax out of its image. Its strings point into a copy of the pool, which
+ * starts with the name of the file type.
+ *
+ * @param img The image.
+ * @param len The length of the image.
+ * @param s The syntax to fill in, freed with hlImageFree.
+ * @return 0 on success, -1 if the image is not a valid one.
+ */
+int hlImageLoad(const char *img, size_t len, struct editorSyntax *s)
+{
+    struct syntaxImage im;
+    if (len < sizeof(im))
+        return -1;
+    memcpy(&im, img, sizeof(im));
+
+    size_t nslots = (size_t)im.mask + 1, nbuckets = (size_t)im.bmask + 1;
+    if ((nslots & im.mask) != 0 || (nbuckets & im.bmask) != 0 || nbuckets > nslots || im.nmatch == 0 ||
+        im.filetype != 1 ||
+        len != sizeof(im) + ((size_t)im.nmatch + nbuckets) * sizeof(uint32_t) + nslots * sizeof(struct syntaxImageSlot) +
+                   im.poollen)
+        return -1;
+
+    // the image may sit anywhere in the cache, so its fields are copied out
+    const char *match = img + sizeof(im);
+    const char *disp = match + im.nmatch * sizeof(uint32_t);
+    const char *slots = disp + nbuckets * sizeof(uint32_t);
+    char *pool = malloc(im.poollen + 1);
+    if (pool == NULL)
+        die("malloc");
+    memcpy(pool, slots + nslots * sizeof(struct syntaxImageSlot), im.poollen);
+    pool[im.poollen] = '\0';
+
+    memset(s, 0, sizeof(*s));
+    s->filetype = pool;
+    s->flags = im.flags;
+    s->singleline_comment_start = hlPoolAt(pool, im.poollen, im.delims[0]);
+    s->multiline_comment_start = hlPoolAt(pool, im.poollen, im.delims[1]);
+    s->multiline_comment_end = hlPoolAt(pool, im.poollen, im.delims[2]);
+    s->separators = hlPoolAt(pool, im.poollen, im.separators);
+    s->quotes = hlPoolAt(pool, im.poollen, im.quotes);
+    memcpy(s->cls, im.cls, sizeof(s->cls));
+    hlClassify(s);
+
+    s->filematch = malloc((im.nmatch + 1) * sizeof(char *));
+    for (uint32_t i = 0; i < im.nmatch; i++)
+    {
+        uint32_t off;
+        memcpy(&off, match + i * sizeof(uint32_t), sizeof(off));
+        s->filematch[i] = hlPoolAt(pool, im.poollen, off);
+    }
+    s->filematch[im.nmatch] = NULL;
+
+    struct keywordTable *kt = malloc(sizeof(struct keywordTable));
+    if (s->filematch == NULL || kt == NULL || (kt->slots = calloc(nslots, sizeof(struct keywordEntry))) == NULL ||
+        (kt->disp = malloc(nbuckets * sizeof(unsigned int))) == NULL)
+        die("malloc");
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        uint32_t d;
+        memcpy(&d, disp + i * sizeof(d), sizeof(d));
+        kt->disp[i] = d;
+    }
+    kt->mask = im.mask;
+    kt->bmask = im.bmask;
+    kt->seed = im.seed;
+    kt->maxlen = im.maxlen;
+    for (size_t i = 0; i < nslots; i++)
+    {
+        struct syntaxImageSlot sl;
+        memcpy(&sl, slots + i * sizeof(sl), sizeof(sl));
+        kt->slots[i] = (struct keywordEntry){hlPoolAt(pool, im.poollen, sl.word), sl.len, sl.hl};
+    }
+    s->kwtable = kt;
+
+    for (uint32_t i = 0; i < im.nmatch; i++)
+    {
+        if (s->filematch[i] == NULL)
+        {
+            hlImageFree(s);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Appends a string to a NULL-terminated list.
+ *
+ * @param list The list.
+ * @param n The number of strings in the list, incremented.
+ * @param str The string, which the list takes.
+ * @return None
+ */
+void hlListAdd(char ***list, int *n, char *str)
+{
+    *list = realloc(*list, (*n + 2) * sizeof(char *));
+    if (*list == NULL)
+        die("realloc");
+    (*list)[(*n)++] = str;
+    (*list)[*n] = NULL;
+}
+
+/**
+ * Duplicates a word of a definition file.
+ *
+ * @param word The word, or NULL when it is missing.
+ * @return The copy, or NULL.
+ */
+char *hlDup(const char *word)
+{
+    return word ? strdup(word) : NULL;
+}
+
+/**
+ * Frees a syntax read from a definition file.
+ *
+ * @param s The syntax.
+ * @return None
+ */
+void hlFreeDefinition(struct editorSyntax *s)
+{
+    for (int i = 0; s->filematch && s->filematch[i]; i++)
+        free(s->filematch[i]);
+    for (int i = 0; s->keywords && s->keywords[i]; i++)
+        free(s->keywords[i]);
+    free(s->filematch);
+    free(s->keywords);
+    free(s->filetype);
+    free(s->singleline_comment_start);
+    free(s->multiline_comment_start);
+    free(s->multiline_comment_end);
+    free(s->separators);
+    free(s->quotes);
+    if (s->kwtable)
+    {
+        free(s->kwtable->slots);
+        free(s->kwtable->disp);
+        free(s->kwtable);
+    }
+    memset(s, 0, sizeof(*s));
+}
+
+/**
+ * Reads a syntax definition. Every line holds a key and its words, separated by
+ * blanks; lines starting with '#' are comments, and unknown keys are skipped:
+ *
+ *   filetype   the name of the file type, shown in the status bar
+ *   match      file extensions, starting with a dot, or parts of file names
+ *   keywords   words highlighted as HL_KEYWORD1
+ *   types      words highlighted as HL_KEYWORD2
+ *   comment    the start of a single-line comment
+ *   block      the start and the end of a multi-line comment
+ *   quotes     the characters that start and end a string, " and ' by default
+ *   separators the characters ending a word besides blanks and EDITOR_SEPARATORS
+ *   numbers    highlights numbers
+ *   strings    highlights strings
+ *
+ * @param text The text of the definition, NUL-terminated; it is modified.
+ * @param s The syntax to fill in, freed with hlFreeDefinition.
+ * @return 0 on success, -1 if the definition has no file type or nothing to match.
+ */
+int hlParseDefinition(char *text, struct editorSyntax *s)
+{
+    int nmatch = 0, nkeywords = 0;
+    memset(s, 0, sizeof(*s));
+
+    for (char *line = text; line;)
+    {
+        char *eol = strchr(line, '\n');
+        if (eol)
+            *eol++ = '\0';
+
+        char *save;
+        char *key = strtok_r(line, " \t\r", &save);
+        char *word;
+        line = eol;
+        if (key == NULL || key[0] == '#')
+            continue;
+
+        if (!strcmp(key, "filetype") && s->filetype == NULL)
+            s->filetype = hlDup(strtok_r(NULL, " \t\r", &save));
+        else if (!strcmp(key, "match"))
+        {
+            while ((word = strtok_r(NULL, " \t\r", &save)))
+                hlListAdd(&s->filematch, &nmatch, strdup(word));
+        }
+        else if (!strcmp(key, "keywords") || !strcmp(key, "types"))
+        {
+            // the keyword list of kwCompile marks the types with a trailing '|'
+            int type = key[0] == 't';
+            while ((word = strtok_r(NULL, " \t\r", &save)))
+            {
+                char *kw = malloc(strlen(word) + 2);
+                strcpy(kw, word);
+                if (type)
+                    strcat(kw, "|");
+                hlListAdd(&s->keywords, &nkeywords, kw);
+            }
+        }
+        else if (!strcmp(key, "comment") && s->singleline_comment_start == NULL)
+            s->singleline_comment_start = hlDup(strtok_r(NULL, " \t\r", &save));
+        else if (!strcmp(key, "block") && s->multiline_comment_start == NULL)
+        {
+            s->multiline_comment_start = hlDup(strtok_r(NULL, " \t\r", &save));
+            s->multiline_comment_end = hlDup(strtok_r(NULL, " \t\r", &save));
+        }
+        else if (!strcmp(key, "quotes") && s->quotes == NULL)
+            s->quotes = hlDup(strtok_r(NULL, " \t\r", &save));
+        else if (!strcmp(key, "separators") && s->separators == NULL)
+            s->separators = hlDup(strtok_r(NULL, " \t\r", &save));
+        else if (!strcmp(key, "numbers"))
+            s->flags |= HL_HIGHLIGHT_NUMBERS;
+        else if (!strcmp(key, "strings"))
+            s->flags |= HL_HIGHLIGHT_STRINGS;
+    }
+
+    if (s->keywords == NULL)
+        s->keywords = calloc(1, sizeof(char *));
+    if (s->filetype == NULL || nmatch == 0)
+    {
+        hlFreeDefinition(s);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads and compiles a syntax definition file.
+ *
+ * @param path The path of the file.
+ * @param len Set to the length of the image.
+ * @return The image of the syntax, to be freed by the caller, or NULL if the file
+ * can't be read or is not a definition.
+ */
+char *hlCompileFile(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    size_t n;
+    char *text = editorReadFile(fd, &n);
+    close(fd);
+    if (text == NULL)
+        return NULL;
+    text = realloc(text, n + 1);
+    if (text == NULL)
+        die("realloc");
+    text[n] = '\0';
+
+    struct editorSyntax s;
+    char *image = NULL;
+    if (hlParseDefinition(text, &s) == 0)
+    {
+        hlCompile(&s);
+        image = hlImageBuild(&s, len);
+        hlFreeDefinition(&s);
+    }
+    free(text);
+    return image;
+}
+
+/**
+ * Builds a path under a directory of the user, as given by an XDG variable or,
+ * without it, under the home directory.
+ *
+ * @param buf The buffer receiving the path.
+ * @param size The size of the buffer.
+ * @param env The XDG variable naming the directory.
+ * @param fallback The directory relative to the home directory without it.
+ * @param name The path under the directory.
+ * @return 0 on success, -1 without a home directory or if the path does not fit.
+ */
+int hlUserPath(char *buf, size_t size, const char *env, const char *fallback, const char *name)
+{
+    const char *base = getenv(env);
+    const char *home = getenv("HOME");
+    int n;
+    if (base && base[0])
+        n = snprintf(buf, size, "%s/%s", base, name);
+    else if (home && home[0])
+        n = snprintf(buf, size, "%s/%s/%s", home, fallback, name);
+    else
+        return -1;
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+/**
+ * Reads the cache of the compiled syntax definitions.
+ *
+ * @param path The path of the cache.
+ * @param len Set to the length of the cache.
+ * @return The cache, to be freed by the caller, or NULL if there is no valid one.
+ */
+char *hlCacheRead(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    char *cache = editorReadFile(fd, len);
+    close(fd);
+    if (cache == NULL)
+        return NULL;
+    if (*len < sizeof(EDITOR_SYNTAX_MAGIC) - 1 + sizeof(uint32_t) ||
+        memcmp(cache, EDITOR_SYNTAX_MAGIC, sizeof(EDITOR_SYNTAX_MAGIC) - 1) != 0)
+    {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/**
+ * Looks a definition file up in the cache. The image is only taken if the file has
+ * the size and the modification time it had when it was compiled.
+ *
+ * @param cache The cache, or NULL.
+ * @param len The length of the cache.
+ * @param path The path of the file.
+ * @param st The file.
+ * @param imagelen Set to the length of the image.
+ * @return The image of the syntax of the file, inside the cache, or NULL.
+ */
+char *hlCacheFind(char *cache, size_t len, const char *path, struct stat *st, size_t *imagelen)
+{
+    if (cache == NULL)
+        return NULL;
+
+    uint32_t count;
+    size_t pos = sizeof(EDITOR_SYNTAX_MAGIC) - 1;
+    memcpy(&count, &cache[pos], sizeof(count));
+    pos += sizeof(count);
+
+    size_t pathlen = strlen(path);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct syntaxCacheEntry e;
+        if (len - pos < sizeof(e))
+            break;
+        memcpy(&e, &cache[pos], sizeof(e));
+        pos += sizeof(e);
+        if (len - pos < (size_t)e.pathlen + e.imagelen)
+            break;
+
+        if (e.pathlen == pathlen && memcmp(&cache[pos], path, pathlen) == 0 &&
+            e.mtime == st->st_mtim.tv_sec && e.mtimensec == st->st_mtim.tv_nsec && e.size == st->st_size)
+        {
+            *imagelen = e.imagelen;
+            return &cache[pos + e.pathlen];
+        }
+        pos += e.pathlen + e.imagelen;
+    }
+    return NULL;
+}
+
+/**
+ * Makes the directories leading to a path that are missing.
+ *
+ * @param path The path, which is changed and restored meanwhile.
+ * @return None
+ */
+void hlMakeDirs(char *path)
+{
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+}
+
+/**
+ * Writes the cache of the compiled syntax definitions, replacing the old one at
+ * once so that another editor starting meanwhile reads either of them. The
+ * directories of the cache are made if they are missing.
+ *
+ * @param path The path of the cache.
+ * @param files The definition files.
+ * @param n The number of files.
+ * @return None
+ */
+void hlCacheWrite(char *path, struct syntaxFile *files, int n)
+{
+    hlMakeDirs(path);
+
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+        return;
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+        return;
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL)
+    {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+
+    uint32_t count = n;
+    int ok = fwrite(EDITOR_SYNTAX_MAGIC, sizeof(EDITOR_SYNTAX_MAGIC) - 1, 1, fp) == 1 &&
+             fwrite(&count, sizeof(count), 1, fp) == 1;
+    for (int i = 0; i < n && ok; i++)
+    {
+        struct syntaxFile *f = &files[i];
+        struct syntaxCacheEntry e = {f->st.st_mtim.tv_sec, f->st.st_mtim.tv_nsec, f->st.st_size,
+                                     strlen(f->path), f->imagelen};
+        ok = fwrite(&e, sizeof(e), 1, fp) == 1 && fwrite(f->path, e.pathlen, 1, fp) == 1 &&
+             fwrite(f->image, e.imagelen, 1, fp) == 1;
+    }
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) == -1)
+        unlink(tmp);
+}
+
+/**
+ * Tells whether a directory entry is a syntax definition file, named *.syntax.
+ *
+ * @param d The directory entry.
+ * @return Whether it is one.
+ */
+int hlIsDefinition(const struct dirent *d)
+{
+    size_t len = strlen(d->d_name);
+    return d->d_name[0] != '.' && len > 7 && !strcmp(&d->d_name[len - 7], ".syntax");
+}
+
+/**
+ * Adds a syntax to E.langs, unless one of the same file type came first.
+ *
+ * @param s The syntax.
+ * @return 1 when it was added, 0 otherwise.
+ */
+int hlAddSyntax(struct editorSyntax *s)
+{
+    for (int j = 0; j < E.nlangs; j++)
+    {
+        if (!strcmp(E.langs[j].filetype, s->filetype))
+            return 0;
+    }
+    E.langs = realloc(E.langs, (E.nlangs + 1) * sizeof(struct editorSyntax));
+    if (E.langs == NULL)
+        die("realloc");
+    E.langs[E.nlangs++] = *s;
+    return 1;
+}
+
+/**
+ * Hashes the file extensions of E.langs into E.langext, each taken by the first
+ * syntax matching it.
+ *
+ * @param None
+ * @return None
+ */
+void hlIndexSyntaxes()
+{
+    unsigned int count = 0;
+    for (int j = 0; j < E.nlangs; j++)
+    {
+        for (int i = 0; E.langs[j].filematch[i]; i++)
+            count++;
+    }
+    unsigned int size = 8;
+    while (size < count * 2)
+        size <<= 1;
+
+    free(E.langext);
+    E.langext = calloc(size, sizeof(struct syntaxMatch));
+    if (E.langext == NULL)
+        die("calloc");
+    E.langextmask = size - 1;
+
+    for (int j = 0; j < E.nlangs; j++)
+    {
+        for (int i = 0; E.langs[j].filematch[i]; i++)
+        {
+            const char *ext = E.langs[j].filematch[i];
+            if (ext[0] != '.')
+                continue;
+            for (unsigned int h = kwHash(0, ext, strlen(ext));; h++)
+            {
+                struct syntaxMatch *m = &E.langext[h & E.langextmask];
+                if (m->ext && !strcmp(m->ext, ext))
+                    break;
+                if (m->ext == NULL)
+                {
+                    *m = (struct syntaxMatch){ext, j};
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Loads the syntaxes into E.langs: those of the definition files of the user, then
+ * those of EDITOR_SYNTAX_DIR, then the built-in ones of HLDB, a file type defined
+ * twice keeping its first definition. The files are compiled into images cached in
+ * $XDG_CACHE_HOME/simple-text-editor/syntax.cache; a file is compiled again only if
+ * its size or modification time changed, and the cache is written again then.
+ *
+ * @param None
+ * @return None
+ */
+void editorLoadSyntaxes()
+{
+    char cachepath[PATH_MAX], userdir[PATH_MAX];
+    int cached = hlUserPath(cachepath, sizeof(cachepath), "XDG_CACHE_HOME", ".cache",
+                            EDITOR_NAME "/syntax.cache") == 0;
+    int user = hlUserPath(userdir, sizeof(userdir), "XDG_CONFIG_HOME", ".config", EDITOR_NAME "/syntax") == 0;
+    size_t cachelen = 0;
+    char *cache = cached ? hlCacheRead(cachepath, &cachelen) : NULL;
+    uint32_t count = 0;
+    if (cache)
+        memcpy(&count, &cache[sizeof(EDITOR_SYNTAX_MAGIC) - 1], sizeof(count));
+
+    const char *dirs[] = {user ? userdir : NULL, EDITOR_SYNTAX_DIR};
+    struct syntaxFile *files = NULL;
+    int nfiles = 0, stale = 0;
+    for (int d = 0; d < 2; d++)
+    {
+        struct dirent **names;
+        int n = dirs[d] ? scandir(dirs[d], &names, hlIsDefinition, alphasort) : -1;
+        for (int i = 0; i < n; i++)
+        {
+            struct syntaxFile f = {NULL, {0}, NULL, 0, 0};
+            size_t len = strlen(dirs[d]) + strlen(names[i]->d_name) + 2;
+            f.path = malloc(len);
+            snprintf(f.path, len, "%s/%s", dirs[d], names[i]->d_name);
+            free(names[i]);
+
+            if (stat(f.path, &f.st) == 0)
+            {
+                f.image = hlCacheFind(cache, cachelen, f.path, &f.st, &f.imagelen);
+                if (f.image == NULL && (f.image = hlCompileFile(f.path, &f.imagelen)))
+                {
+                    f.owned = 1;
+                    stale = 1;
+                }
+            }
+            if (f.image == NULL)
+            {
+                free(f.path);
+                continue;
+            }
+            files = realloc(files, (nfiles + 1) * sizeof(struct syntaxFile));
+            if (files == NULL)
+                die("realloc");
+            files[nfiles++] = f;
+        }
+        if (n >= 0)
+            free(names);
+    }
+
+    for (int i = 0; i < nfiles; i++)
+    {
+        struct editorSyntax s;
+        if (hlImageLoad(files[i].image, files[i].imagelen, &s) == 0 && !hlAddSyntax(&s))
+            hlImageFree(&s);
+    }
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
+    {
+        struct editorSyntax s = HLDB[j];
+        if (hlAddSyntax(&s))
+            hlCompile(&E.langs[E.nlangs - 1]);
+    }
+    hlIndexSyntaxes();
+
+    // a file gone from the directories is left out of the cache too
+    if (cached && (stale || count != (uint32_t)nfiles))
+        hlCacheWrite(cachepath, files, nfiles);
+    for (int i = 0; i < nfiles; i++)
+    {
+        if (files[i].owned)
+            free(files[i].image);
+        free(files[i].path);
+    }
+    free(files);
+    free(cache);
+}
+
+/*** index cache ***/
+
+/**
+ * @struct indexCacheHeader
+ * @brief The start of an entry of the index cache, for one file. It is followed by
+ * the offsets of the newlines of the file, as the size_t array the piece table maps
+ * in place, then by the checkpoint of each of the first rows, then by the path of
+ * the file, which the name of the entry is a hash of.
+ */
+struct indexCacheHeader
+{
+    char magic[8];      ///< EDITOR_INDEX_MAGIC.
+    uint32_t word;      ///< sizeof(size_t), the width of the offsets.
+    uint32_t pathlen;   ///< The length of the path.
+    uint64_t size;      ///< The length of the file.
+    int64_t mtime;      ///< The last change of the file, in seconds.
+    int64_t mtimensec;  ///< The nanoseconds of the last change.
+    uint64_t dev;       ///< The device of the file.
+    uint64_t ino;       ///< The inode of the file.
+    uint64_t count;     ///< The number of newlines of the file.
+    uint64_t rows;      ///< The number of rows with a checkpoint.
+    uint64_t tail;      ///< The hash of the EDITOR_INDEX_TAIL bytes at the end of the file.
+    uint64_t sum;       ///< The checksum of the offsets of the newlines.
+    char filetype[40];  ///< The syntax the checkpoints were computed with, empty for none.
+};
+
+/**
+ * Returns the path of the cache entry of a file.
+ *
+ * @param filename The name of the file.
+ * @param path Set to the path of the entry.
+ * @param size The size of path.
+ * @return The path of the file with its symbolic links resolved, to be freed by the caller, or NULL.
+ */
+char *editorIndexPath(const char *filename, char *path, size_t size)
+{
+    char *real = realpath(filename, NULL);
+    if (real == NULL)
+        return NULL;
+
+    int len = strlen(real);
+    char name[64];
+    snprintf(name, sizeof(name), EDITOR_NAME "/index/%08x%08x", kwHash(0, real, len), kwHash(0x9e3779b9u, real, len));
+    if (hlUserPath(path, size, "XDG_CACHE_HOME", ".cache", name) == -1)
+    {
+        free(real);
+        return NULL;
+    }
+    return real;
+}
+
+/**
+ * Hashes the EDITOR_INDEX_TAIL bytes before an offset of a file, or the bytes before it if they are fewer.
+ *
+ * @param buf The contents of the file.
+ * @param end The offset.
+ * @return The hash.
+ */
+uint64_t editorIndexTail(const char *buf, size_t end)
+{
+    size_t n = end < EDITOR_INDEX_TAIL ? end : EDITOR_INDEX_TAIL;
+    const char *s = &buf[end - n];
+    return (uint64_t)kwHash(0, s, n) << 32 | kwHash(0x9e3779b9u, s, n);
+}
+
+/**
+ * Computes the checksum of the newline offsets of a cache entry (FNV-1a, a word at a time).
+ *
+ * @param nl The offsets.
+ * @param count The number of offsets.
+ * @return The checksum.
+ */
+uint64_t editorIndexSum(const size_t *nl, size_t count)
+{
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < count; i++)
+        h = (h ^ nl[i]) * 1099511628211u;
+    return h;
+}
+
+/**
+ * Checks that the newline offsets of a cache entry are those of newlines of a file,
+ * in order, before the end of the part of the file the entry is for. A file that was
+ * rewritten with the same inode and the same last bytes has its newlines elsewhere.
+ *
+ * @param nl The offsets.
+ * @param count The number of offsets.
+ * @param buf The contents of the file.
+ * @param size The length of the part of the file the entry is for.
+ * @return 1 when they are, 0 otherwise.
+ */
+int editorIndexLines(const size_t *nl, size_t count, const char *buf, size_t size)
+{
+    for (size_t i = 0; i < count; i++)
+        if (nl[i] >= size || (i > 0 && nl[i] <= nl[i - 1]) || buf[nl[i]] != '\n')
+            return 0;
+    return 1;
+}
+
+/**
+ * Maps the cache entry of a file, if it has one that holds for the file as it is:
+ * the entry of the same file, with the same length and modification time, or of the
+ * file before it was appended to, whose last bytes are still the same. The newline
+ * offsets must match the checksum of the entry, and for a file that was appended to,
+ * which only its last bytes vouch for, the newlines of the file too.
+ *
+ * @param filename The name of the file.
+ * @param st The status of the file.
+ * @param buf The contents of the file.
+ * @param len The length of the contents.
+ * @param maplen Set to the length of the mapping.
+ * @return The mapping of the entry, or NULL.
+ */
+struct indexCacheHeader *editorIndexFind(const char *filename, struct stat *st, const char *buf, size_t len,
+                                         size_t *maplen)
+{
+    char path[PATH_MAX];
+    char *real = editorIndexPath(filename, path, sizeof(path));
+    if (real == NULL)
+        return NULL;
+
+    struct indexCacheHeader *h = NULL;
+    struct stat cst;
+    int fd = open(path, O_RDONLY);
+    if (fd != -1 && fstat(fd, &cst) == 0 && (size_t)cst.st_size >= sizeof(*h))
+    {
+        void *map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+            h = map;
+    }
+    if (fd != -1)
+        close(fd);
+    if (h == NULL)
+    {
+        free(real);
+        return NULL;
+    }
+    *maplen = cst.st_size;
+
+    // the counts are bounded by the length before they are multiplied
+    size_t pathlen = strlen(real);
+    const size_t *nl = (const size_t *)(h + 1);
+    int ok = !memcmp(h->magic, EDITOR_INDEX_MAGIC, sizeof(h->magic)) && h->word == sizeof(size_t) &&
+             h->dev == (uint64_t)st->st_dev && h->ino == (uint64_t)st->st_ino && h->size <= len &&
+             h->count <= h->size && h->rows <= h->count + 1 && h->pathlen == pathlen &&
+             *maplen == sizeof(*h) + h->count * sizeof(size_t) + h->rows + pathlen &&
+             !memcmp((char *)h + *maplen - pathlen, real, pathlen) && (h->count == 0 || nl[h->count - 1] < h->size);
+    ok = ok && editorIndexSum(nl, h->count) == h->sum;
+    if (ok && h->size == len)
+        ok = h->mtime == st->st_mtim.tv_sec && h->mtimensec == st->st_mtim.tv_nsec;
+    else if (ok)
+        ok = h->size > 0 && editorIndexTail(buf, h->size) == h->tail && editorIndexLines(nl, h->count, buf, h->size);
+    free(real);
+
+    if (!ok)
+    {
+        munmap(h, *maplen);
+        return NULL;
+    }
+    return h;
+}
+
+/**
+ * Loads a mapped file into the empty piece table of the buffer shown from its cache
+ * entry, with no scan: the newline index is mapped from the entry. For a file that
+ * was appended to, the index of the entry is copied and the loader indexes the
+ * lines after it. The file only has an entry from EDITOR_INDEX_CACHE bytes on, and
+ * one is written later if it has none that holds. A file with carriage returns has
+ * none: it is loaded as a piece for each of its lines, which is better left to the
+ * loader.
+ *
+ * @param buf The mapping of the file, which the piece table takes when it is loaded.
+ * @param len The length of the file.
+ * @param st The status of the file.
+ * @return 1 when the document is loaded, 0 when the file has to be indexed.
+ */
+int editorIndexOpen(char *buf, size_t len, struct stat *st)
+{
+    struct editorIndex *ix = &E.buf->index;
+    struct pieceTable *pt = &E.buf->pt;
+    if (EDITOR_INDEX_CACHE == 0 || len < EDITOR_INDEX_CACHE)
+        return 0;
+    ix->save = 1;
+    ix->st = *st;
+
+    size_t maplen;
+    struct indexCacheHeader *h = editorIndexFind(E.buf->filename, st, buf, len, &maplen);
+    if (h == NULL)
+        return 0;
+
+    size_t *nl = (size_t *)(h + 1);
+    size_t to = len;
+    if (h->size == len)
+    {
+        pt->nl[PT_ORIGINAL] = nl;
+        pt->nlmap = (char *)h;
+        pt->nlmaplen = maplen;
+    }
+    else
+    {
+        // what follows the last line of the entry is indexed as a file loading
+        size_t from = h->count ? nl[h->count - 1] + 1 : 0;
+        if (!editorLoadStart(buf, len, from))
+        {
+            munmap(h, maplen);
+            return 0;
+        }
+        pt->nl[PT_ORIGINAL] = malloc(h->count ? h->count * sizeof(size_t) : 1);
+        if (pt->nl[PT_ORIGINAL] == NULL)
+            die("malloc");
+        memcpy(pt->nl[PT_ORIGINAL], nl, h->count * sizeof(size_t));
+        E.buf->load.nlcap = h->count;
+        to = from;
+    }
+    pt->version++;
+    pt->buf[PT_ORIGINAL] = buf;
+    pt->len[PT_ORIGINAL] = len;
+    pt->nlcount[PT_ORIGINAL] = h->count;
+    pt->mapped = 1;
+    ptLoadRange(pt, 0, to, 0);
+
+    ix->map = (char *)h;
+    ix->maplen = maplen;
+    return 1;
+}
+
+/**
+ * Takes the highlighting checkpoints of the cache entry the buffer shown was loaded
+ * from, once its syntax is known: they hold when they were computed with the same
+ * syntax, for the rows that are whole lines of the file as it is. The entry is then
+ * unmapped, unless the newline index is read from it.
+ *
+ * @param None
+ * @return None
+ */
+void editorIndexStates()
+{
+    struct editorIndex *ix = &E.buf->index;
+    struct indexCacheHeader *h = (struct indexCacheHeader *)ix->map;
+    if (h == NULL)
+        return;
+
+    const char *filetype = E.buf->syntax ? E.buf->syntax->filetype : "";
+    int whole = h->size == E.buf->pt.len[PT_ORIGINAL];
+    if (strncmp(h->filetype, filetype, sizeof(h->filetype)) == 0)
+    {
+        size_t rows = (whole || h->rows < h->count) ? h->rows : h->count;
+        if (rows > (size_t)E.buf->numrows)
+            rows = E.buf->numrows;
+        memcpy(E.buf->hlstate, &ix->map[sizeof(*h) + h->count * sizeof(size_t)], rows);
+        E.buf->hlvalid = rows;
+        if (whole && (E.buf->syntax == NULL || h->rows > 0))
+            ix->save = 0;
+    }
+
+    if (ix->map != E.buf->pt.nlmap)
+        munmap(ix->map, ix->maplen);
+    ix->map = NULL;
+}
+
+/**
+ * Writes the cache entry of the file of the buffer shown, replacing the old one at
+ * once. The checkpoints are left out once the document was edited.
+ *
+ * @param None
+ * @return None
+ */
+void editorIndexWrite()
+{
+    struct editorBuffer *b = E.buf;
+    struct pieceTable *pt = &b->pt;
+    char path[PATH_MAX];
+    char *real = editorIndexPath(b->filename, path, sizeof(path));
+    if (real == NULL)
+        return;
+
+    struct indexCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EDITOR_INDEX_MAGIC, sizeof(h.magic));
+    h.word = sizeof(size_t);
+    h.size = pt->len[PT_ORIGINAL];
+    h.mtime = b->index.st.st_mtim.tv_sec;
+    h.mtimensec = b->index.st.st_mtim.tv_nsec;
+    h.dev = b->index.st.st_dev;
+    h.ino = b->index.st.st_ino;
+    h.count = pt->nlcount[PT_ORIGINAL];
+    h.rows = (b->syntax && !b->index.edited) ? b->hlvalid : 0;
+    h.tail = editorIndexTail(pt->buf[PT_ORIGINAL], h.size);
+    h.sum = editorIndexSum(pt->nl[PT_ORIGINAL], h.count);
+    h.pathlen = strlen(real);
+    if (b->syntax)
+        snprintf(h.filetype, sizeof(h.filetype), "%s", b->syntax->filetype);
+
+    hlMakeDirs(path);
+    char tmp[PATH_MAX];
+    int fd = -1;
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) < (int)sizeof(tmp))
+        fd = mkstemp(tmp);
+    FILE *fp = fd == -1 ? NULL : fdopen(fd, "w");
+    if (fp == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tmp);
+        }
+        free(real);
+        return;
+    }
+
+    int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+             fwrite(pt->nl[PT_ORIGINAL], sizeof(size_t), h.count, fp) == h.count &&
+             fwrite(b->hlstate, 1, h.rows, fp) == h.rows && fwrite(real, 1, h.pathlen, fp) == h.pathlen;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) == -1)
+        unlink(tmp);
+    free(real);
+}
+
+/**
+ * Writes the cache entry of the file of the buffer shown when it is due, once the
+ * file is indexed and the background highlighting is over, while the editor is idle.
+ *
+ * @param None
+ * @return None
+ */
+void editorIndexIdle()
+{
+    struct editorBuffer *b = E.buf;
+    if (!b->index.save || b->load.active || b->hljob)
+        return;
+    if (b->pt.cr)
+    {
+        b->index.save = 0;
+        return;
+    }
+    if (b->syntax && !b->index.edited && b->hlvalid + EDITOR_SYNTAX_BATCH < b->numrows)
+        return;
+    b->index.save = 0;
+    editorIndexWrite();
+}
+
+/*** regex ***/
+
+/*
+ * Regular expressions are compiled into a Thompson NFA and matched with DFAs that
+ * are built lazily, one transition at a time, in a cache of at most
+ * EDITOR_DFA_STATES states, so the time taken stays linear in the length of the
+ * text for any pattern. Matches never cross a line: besides the 256 bytes the NFA
+ * reads RE_BOL before a line and RE_EOL after it, which is how ^ and $ match.
+ */
+
+#define RE_EOL 256
+#define RE_BOL 257
+#define RE_SYMBOLS 258
+#define RE_DEAD (-1)
+#define RE_UNKNOWN (-2)
+
+/**
+ * @brief The instructions of a compiled regular expression.
+ */
+enum regexOp
+{
+    RE_SET = 0, /**< Reads a symbol of its set and goes on with the next instruction */
+    RE_SPLIT,   /**< Goes on with both x and y */
+    RE_JMP,     /**< Goes on with x */
+    RE_MATCH    /**< A match ends here */
+};
+
+/**
+ * @brief The nodes of a parsed regular expression.
+ */
+enum regexNodeType
+{
+    RN_EMPTY = 0, /**< Matches the empty string */
+    RN_SET,       /**< Matches one symbol of a set */
+    RN_CAT,       /**< Matches l followed by r */
+    RN_ALT,       /**< Matches l or r */
+    RN_STAR,      /**< Matches l any number of times */
+    RN_PLUS,      /**< Matches l at least once */
+    RN_QUEST      /**< Matches l at most once */
+};
+
+/**
+ * @struct regexNode
+ * @brief A node of the syntax tree of a regular expression.
+ */
+struct regexNode
+{
+    int type;                                ///< The regexNodeType.
+    struct regexNode *l;                     ///< The first operand.
+    struct regexNode *r;                     ///< The second operand of RN_CAT and RN_ALT.
+    unsigned char set[(RE_SYMBOLS + 7) / 8]; ///< The symbols of RN_SET, as a bitmap.
+};
+
+/**
+ * @struct regexParser
+ * @brief The state of the parsing of a regular expression.
+ */
+struct regexParser
+{
+    const char *s;           ///< The expression.
+    size_t len;              ///< Its length.
+    size_t i;                ///< The offset of the next character to parse.
+    struct regexNode *nodes; ///< The nodes, allocated in one block.
+    int nnodes;              ///< The number of nodes used.
+    int cap;                 ///< The number of nodes allocated, enough for any expression of len characters.
+    const char *error;       ///< The reason the expression is invalid, NULL while it is not.
+};
+
+/**
+ * @struct regexInst
+ * @brief An instruction of a compiled regular expression.
+ */
+struct regexInst
+{
+    int op;                                  ///< The regexOp.
+    int x;                                   ///< The target of RE_JMP, or the first branch of RE_SPLIT.
+    int y;                                   ///< The second branch of RE_SPLIT.
+    unsigned char set[(RE_SYMBOLS + 7) / 8]; ///< The symbols RE_SET reads, as a bitmap.
+};
+
+/**
+ * @struct regexProgram
+ * @brief A regular expression compiled into NFA instructions. The symbols that
+ * every instruction treats alike share a class, so the DFA tables have one column
+ * per class instead of one per symbol.
+ */
+struct regexProgram
+{
+    struct regexInst *inst;         ///< The instructions, starting at 0 and ending with RE_MATCH.
+    int len;                        ///< The number of instructions.
+    unsigned short cls[RE_SYMBOLS]; ///< The class of each symbol.
+    int ncls;                       ///< The number of classes.
+};
+
+/**
+ * @struct regex
+ * @brief A compiled regular expression. It is never changed once compiled, so
+ * the threads of a search share it, each with its own DFAs.
+ */
+struct regex
+{
+    struct regexProgram fwd; ///< Matches the expression.
+    struct regexProgram rev; ///< Matches the expression read backwards, which finds where matches start.
+};
+
+/**
+ * @struct regexDFA
+ * @brief A DFA built lazily from a program. Each state is a set of instructions,
+ * kept sorted so equal sets are found in the hash table; when the cache is full it
+ * is emptied and built again from the current state.
+ */
+struct regexDFA
+{
+    const struct regexProgram *prog; ///< The program.
+    int anchored;      ///< Unset when a match may start at any symbol, not only at the start.
+    int nstates;       ///< The number of states.
+    int cap;           ///< The number of states allocated, at most EDITOR_DFA_STATES.
+    int *trans;        ///< The transitions, ncls per state, RE_UNKNOWN until they are computed.
+    unsigned char *accept; ///< Set for the states holding RE_MATCH.
+    int *setoff;       ///< The offset in pool of the instructions of each state.
+    int *setlen;       ///< The number of instructions of each state.
+    int *pool;         ///< The instruction sets of the states.
+    size_t poollen;    ///< The length of pool.
+    size_t poolcap;    ///< The capacity of pool.
+    int *hash;         ///< The states by instruction set, as indices plus one, 0 for an empty bucket.
+    int *mark;         ///< The generation in which each instruction was last added to a set.
+    int gen;           ///< The current generation.
+    int *stack;        ///< Room for the closure of a set.
+    int *list;         ///< Room for a set being built.
+    int *saved;        ///< Room for the set of the current state while the cache is emptied.
+    int start;         ///< The start state, RE_UNKNOWN until it is built.
+    int startbol;      ///< The start state at the start of a line.
+};
+
+/**
+ * @struct regexMatcher
+ * @brief The DFAs a thread uses to find the matches of a regular expression.
+ */
+struct regexMatcher
+{
+    struct regexDFA scan;   ///< Unanchored, which finds the lines holding a match.
+    struct regexDFA fwd;    ///< Anchored, which finds where a match starting at a given offset ends.
+    struct regexDFA rev;    ///< Unanchored on the reversed program, which finds where matches start.
+    unsigned char *starts;  ///< Set for each offset of a line where a match starts.
+    size_t startscap;       ///< The capacity of starts.
+    char *line;             ///< Room for a line that does not lie in a single piece.
+    size_t linecap;         ///< The capacity of line.
+};
+
+/**
+ * Adds a symbol to a set.
+ *
+ * @param set The set.
+ * @param c The symbol.
+ * @return None
+ */
+void reSetAdd(unsigned char *set, int c)
+{
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+/**
+ * Checks whether a set holds a symbol.
+ *
+ * @param set The set.
+ * @param c The symbol.
+ * @return 1 if it does, 0 otherwise.
+ */
+int reSetHas(const unsigned char *set, int c)
+{
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+/**
+ * Replaces a set of bytes by the bytes it does not hold. Newlines never appear
+ * in a line, so they are left out either way.
+ *
+ * @param set The set.
+ * @return None
+ */
+void reSetInvert(unsigned char *set)
+{
+    for (int i = 0; i < 32; i++)
+        set[i] = ~set[i];
+    set['\n' >> 3] &= ~(1 << ('\n' & 7));
+}
+
+/**
+ * Allocates a node of the syntax tree.
+ *
+ * @param rp The parser.
+ * @param type The regexNodeType.
+ * @param l The first operand.
+ * @param r The second operand.
+ * @return The node.
+ */
+struct regexNode *reNode(struct regexParser *rp, int type, struct regexNode *l, struct regexNode *r)
+{
+    struct regexNode *n = &rp->nodes[rp->nnodes++];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->l = l;
+    n->r = r;
+    return n;
+}
+
+/**
+ * Adds the bytes matched by an escape sequence to a set.
+ *
+ * @param set The set.
+ * @param c The character following the backslash.
+ * @return None
+ */
+void reEscape(unsigned char *set, int c)
+{
+    unsigned char tmp[(RE_SYMBOLS + 7) / 8];
+    memset(tmp, 0, sizeof(tmp));
+
+    switch (c)
+    {
+    case 'd':
+    case 'D':
+        for (int b = '0'; b <= '9'; b++)
+            reSetAdd(tmp, b);
+        break;
+    case 'w':
+    case 'W':
+        for (int b = 0; b < 256; b++)
+            if (isalnum(b) || b == '_')
+                reSetAdd(tmp, b);
+        break;
+    case 's':
+    case 'S':
+        for (int b = 0; b < 256; b++)
+            if (isspace(b))
+                reSetAdd(tmp, b);
+        break;
+    case 't':
+        reSetAdd(tmp, '\t');
+        break;
+    default:
+        reSetAdd(tmp, c);
+        break;
+    }
+
+    if (c == 'D' || c == 'W' || c == 'S')
+        reSetInvert(tmp);
+    for (int i = 0; i < 32; i++)
+        set[i] |= tmp[i];
+}
+
+/**
+ * Parses a bracket expression, the opening bracket already read.
+ *
+ * @param rp The parser.
+ * @return The RN_SET node.
+ */
+struct regexNode *reParseClass(struct regexParser *rp)
+{
+    struct regexNode *n = reNode(rp, RN_SET, NULL, NULL);
+    int negate = 0;
+    if (rp->i < rp->len && rp->s[rp->i] == '^')
+    {
+        negate = 1;
+        rp->i++;
+    }
+
+    // a bracket right after the opening one stands for itself
+    for (int first = 1; rp->i < rp->len && (first || rp->s[rp->i] != ']'); first = 0)
+    {
+        int lo = (unsigned char)rp->s[rp->i++];
+        if (lo == '\\')
+        {
+            if (rp->i == rp->len)
+                break;
+            int c = (unsigned char)rp->s[rp->i++];
+            if (strchr("dDwWsS", c))
+            {
+                reEscape(n->set, c);
+                continue;
+            }
+            lo = c == 't' ? '\t' : c;
+        }
+
+        int hi = lo;
+        if (rp->i + 1 < rp->len && rp->s[rp->i] == '-' && rp->s[rp->i + 1] != ']')
+        {
+            hi = (unsigned char)rp->s[rp->i + 1];
+            rp->i += 2;
+            if (hi == '\\' && rp->i < rp->len)
+                hi = (unsigned char)rp->s[rp->i++];
+            if (hi < lo)
+            {
+                rp->error = "bad range";
+                return n;
+            }
+        }
+        for (int c = lo; c <= hi; c++)
+            reSetAdd(n->set, c);
+    }
+
+    if (rp->i == rp->len)
+    {
+        rp->error = "missing ]";
+        return n;
+    }
+    rp->i++;
+    if (negate)
+        reSetInvert(n->set);
+    return n;
+}
+
+struct regexNode *reParseAlt(struct regexParser *rp);
+
+/**
+ * Parses an atom: a character, a class, an anchor or a parenthesized expression.
+ *
+ * @param rp The parser.
+ * @return The node.
+ */
+struct regexNode *reParseAtom(struct regexParser *rp)
+{
+    int c = (unsigned char)rp->s[rp->i++];
+    struct regexNode *n;
+
+    switch (c)
+    {
+    case '(':
+        n = reParseAlt(rp);
+        if (rp->i == rp->len || rp->s[rp->i] != ')')
+            rp->error = "missing )";
+        else
+            rp->i++;
+        return n;
+    case '[':
+        return reParseClass(rp);
+    case '*':
+    case '+':
+    case '?':
+        rp->error = "nothing to repeat";
+        return reNode(rp, RN_EMPTY, NULL, NULL);
+    }
+
+    n = reNode(rp, RN_SET, NULL, NULL);
+    if (c == '.')
+    {
+        reSetInvert(n->set);
+    }
+    else if (c == '^')
+    {
+        reSetAdd(n->set, RE_BOL);
+    }
+    else if (c == '$')
+    {
+        reSetAdd(n->set, RE_EOL);
+    }
+    else if (c == '\\')
+    {
+        if (rp->i == rp->len)
+            rp->error = "trailing \\";
+        else
+            reEscape(n->set, (unsigned char)rp->s[rp->i++]);
+    }
+    else
+    {
+        reSetAdd(n->set, c);
+    }
+    return n;
+}
+
+/**
+ * Parses an atom followed by any number of repetition operators.
+ *
+ * @param rp The parser.
+ * @return The node.
+ */
+struct regexNode *reParseRepeat(struct regexParser *rp)
+{
+    struct regexNode *n = reParseAtom(rp);
+    while (rp->i < rp->len && strchr("*+?", rp->s[rp->i]))
+    {
+        char op = rp->s[rp->i++];
+        n = reNode(rp, op == '*' ? RN_STAR : (op == '+' ? RN_PLUS : RN_QUEST), n, NULL);
+    }
+    return n;
+}
+
+/**
+ * Parses a concatenation, up to the next | or ) or the end of the expression.
+ *
+ * @param rp The parser.
+ * @return The node.
+ */
+struct regexNode *reParseCat(struct regexParser *rp)
+{
+    struct regexNode *n = NULL;
+    while (rp->i < rp->len && rp->s[rp->i] != '|' && rp->s[rp->i] != ')' && !rp->error)
+    {
+        struct regexNode *r = reParseRepeat(rp);
+        n = n ? reNode(rp, RN_CAT, n, r) : r;
+    }
+    return n ? n : reNode(rp, RN_EMPTY, NULL, NULL);
+}
+
+/**
+ * Parses an alternation of concatenations.
+ *
+ * @param rp The parser.
+ * @return The node.
+ */
+struct regexNode *reParseAlt(struct regexParser *rp)
+{
+    struct regexNode *n = reParseCat(rp);
+    while (rp->i < rp->len && rp->s[rp->i] == '|' && !rp->error)
+    {
+        rp->i++;
+        n = reNode(rp, RN_ALT, n, reParseCat(rp));
+    }
+    return n;
+}
+
+/**
+ * Returns the number of instructions a subtree compiles to.
+ *
+ * @param n The subtree.
+ * @return The number of instructions.
+ */
+int reSize(const struct regexNode *n)
+{
+    switch (n->type)
+    {
+    case RN_SET:
+        return 1;
+    case RN_CAT:
+        return reSize(n->l) + reSize(n->r);
+    case RN_ALT:
+        return 2 + reSize(n->l) + reSize(n->r);
+    case RN_STAR:
+        return 2 + reSize(n->l);
+    case RN_PLUS:
+    case RN_QUEST:
+        return 1 + reSize(n->l);
+    }
+    return 0;
+}
+
+/**
+ * Compiles a subtree into instructions.
+ *
+ * @param p The program.
+ * @param n The subtree.
+ * @param pc The index of its first instruction.
+ * @param reverse Set to compile the subtree read backwards.
+ * @return The index following its last instruction.
+ */
+int reEmit(struct regexProgram *p, const struct regexNode *n, int pc, int reverse)
+{
+    struct regexInst *in = &p->inst[pc];
+    int end;
+
+    switch (n->type)
+    {
+    case RN_SET:
+        in->op = RE_SET;
+        in->x = pc + 1;
+        memcpy(in->set, n->set, sizeof(in->set));
+        return pc + 1;
+    case RN_CAT:
+        if (reverse)
+            return reEmit(p, n->l, reEmit(p, n->r, pc, reverse), reverse);
+        return reEmit(p, n->r, reEmit(p, n->l, pc, reverse), reverse);
+    case RN_ALT:
+        end = reEmit(p, n->l, pc + 1, reverse);
+        in->op = RE_SPLIT;
+        in->x = pc + 1;
+        in->y = end + 1;
+        p->inst[end].op = RE_JMP;
+        p->inst[end].x = reEmit(p, n->r, end + 1, reverse);
+        return p->inst[end].x;
+    case RN_STAR:
+        end = reEmit(p, n->l, pc + 1, reverse);
+        in->op = RE_SPLIT;
+        in->x = pc + 1;
+        in->y = end + 1;
+        p->inst[end].op = RE_JMP;
+        p->inst[end].x = pc;
+        return end + 1;
+    case RN_PLUS:
+        end = reEmit(p, n->l, pc, reverse);
+        p->inst[end].op = RE_SPLIT;
+        p->inst[end].x = pc;
+        p->inst[end].y = end + 1;
+        return end + 1;
+    case RN_QUEST:
+        end = reEmit(p, n->l, pc + 1, reverse);
+        in->op = RE_SPLIT;
+        in->x = pc + 1;
+        in->y = end;
+        return end;
+    }
+    return pc;
+}
+
+/**
+ * Compiles a syntax tree into a program and splits its symbols into classes.
+ *
+ * @param p The program to fill in.
+ * @param root The syntax tree.
+ * @param reverse Set to compile the expression read backwards.
+ * @return None
+ */
+void reProgram(struct regexProgram *p, const struct regexNode *root, int reverse)
+{
+    p->len = reSize(root) + 1;
+    p->inst = calloc(p->len, sizeof(struct regexInst));
+    reEmit(p, root, 0, reverse);
+    p->inst[p->len - 1].op = RE_MATCH;
+
+    // each set splits the classes into the symbols it holds and the others
+    int map[2 * RE_SYMBOLS];
+    memset(p->cls, 0, sizeof(p->cls));
+    p->ncls = 1;
+    for (int pc = 0; pc < p->len; pc++)
+    {
+        if (p->inst[pc].op != RE_SET)
+            continue;
+        for (int k = 0; k < 2 * p->ncls; k++)
+            map[k] = -1;
+        int n = 0;
+        for (int c = 0; c < RE_SYMBOLS; c++)
+        {
+            int key = p->cls[c] * 2 + reSetHas(p->inst[pc].set, c);
+            if (map[key] < 0)
+                map[key] = n++;
+            p->cls[c] = map[key];
+        }
+        p->ncls = n;
+    }
+}
+
+/**
+ * Compiles a regular expression. The syntax is the POSIX extended one without
+ * intervals and back-references: . [] [^] * + ? | () ^ $, and the escapes
+ * \d \w \s \D \W \S \t.
+ *
+ * @param s The expression.
+ * @param len Its length.
+ * @param error Set to the reason the expression is invalid.
+ * @return The compiled expression, or NULL if it is invalid.
+ */
+struct regex *reCompile(const char *s, size_t len, const char **error)
+{
+    struct regexParser rp = {s, len, 0, NULL, 0, 0, NULL};
+    // every character adds at most two nodes, and | adds two empty ones
+    rp.cap = 4 * len + 4;
+    rp.nodes = malloc(rp.cap * sizeof(struct regexNode));
+
+    struct regexNode *root = reParseAlt(&rp);
+    if (!rp.error && rp.i < rp.len)
+        rp.error = "unmatched )";
+    if (rp.error)
+    {
+        *error = rp.error;
+        free(rp.nodes);
+        return NULL;
+    }
+
+    struct regex *re = malloc(sizeof(struct regex));
+    reProgram(&re->fwd, root, 0);
+    reProgram(&re->rev, root, 1);
+    free(rp.nodes);
+    *error = NULL;
+    return re;
+}
+
+/**
+ * Frees a compiled regular expression.
+ *
+ * @param re The expression, or NULL.
+ * @return None
+ */
+void reFree(struct regex *re)
+{
+    if (re == NULL)
+        return;
+    free(re->fwd.inst);
+    free(re->rev.inst);
+    free(re);
+}
+
+/**
+ * Prepares an empty DFA for a program.
+ *
+ * @param d The DFA.
+ * @param prog The program.
+ * @param anchored Unset for a DFA looking for matches starting anywhere.
+ * @return None
+ */
+void reDFAInit(struct regexDFA *d, const struct regexProgram *prog, int anchored)
+{
+    memset(d, 0, sizeof(*d));
+    d->prog = prog;
+    d->anchored = anchored;
+    d->hash = calloc(2 * EDITOR_DFA_STATES, sizeof(int));
+    d->mark = calloc(prog->len, sizeof(int));
+    d->stack = malloc((2 * prog->len + 1) * sizeof(int));
+    d->list = malloc(prog->len * sizeof(int));
+    d->saved = malloc(prog->len * sizeof(int));
+    d->start = d->startbol = RE_UNKNOWN;
+}
+
+/**
+ * Frees the memory of a DFA.
+ *
+ * @param d The DFA.
+ * @return None
+ */
+void reDFAFree(struct regexDFA *d)
+{
+    free(d->trans);
+    free(d->accept);
+    free(d->setoff);
+    free(d->setlen);
+    free(d->pool);
+    free(d->hash);
+    free(d->mark);
+    free(d->stack);
+    free(d->list);
+    free(d->saved);
+}
+
+/**
+ * Empties the state cache of a DFA.
+ *
+ * @param d The DFA.
+ * @return None
+ */
+void reFlush(struct regexDFA *d)
+{
+    d->nstates = 0;
+    d->poollen = 0;
+    memset(d->hash, 0, 2 * EDITOR_DFA_STATES * sizeof(int));
+    d->start = d->startbol = RE_UNKNOWN;
+}
+
+/**
+ * Adds an instruction and the ones it leads to without reading a symbol to the
+ * set of the current generation.
+ *
+ * @param d The DFA.
+ * @param pc The instruction.
+ * @return None
+ */
+void reClosure(struct regexDFA *d, int pc)
+{
+    int top = 0;
+    d->stack[top++] = pc;
+    while (top > 0)
+    {
+        pc = d->stack[--top];
+        if (d->mark[pc] == d->gen)
+            continue;
+        d->mark[pc] = d->gen;
+
+        const struct regexInst *in = &d->prog->inst[pc];
+        if (in->op == RE_SPLIT)
+        {
+            d->stack[top++] = in->y;
+            d->stack[top++] = in->x;
+        }
+        else if (in->op == RE_JMP)
+        {
+            d->stack[top++] = in->x;
+        }
+    }
+}
+
+/**
+ * Lists the instructions of the set of the current generation that read a symbol
+ * or end a match, which are the only ones telling states apart, in order.
+ *
+ * @param d The DFA.
+ * @return The number of instructions, stored in d->list.
+ */
+int reCollect(struct regexDFA *d)
+{
+    int n = 0;
+    for (int pc = 0; pc < d->prog->len; pc++)
+    {
+        int op = d->prog->inst[pc].op;
+        if (d->mark[pc] == d->gen && (op == RE_SET || op == RE_MATCH))
+            d->list[n++] = pc;
+    }
+    return n;
+}
+
+/**
+ * Lets the threads of the set of the current generation go past an anchor. An
+ * anchor takes no room, so the threads it lets through may read it again, as in
+ * $$, until no thread moves anymore.
+ *
+ * @param d The DFA.
+ * @param c RE_BOL or RE_EOL.
+ * @return The number of instructions of the set, listed in d->list.
+ */
+int reAnchor(struct regexDFA *d, int c)
+{
+    int n = 0, m;
+    while ((m = reCollect(d)) != n)
+    {
+        n = m;
+        for (int k = 0; k < n; k++)
+        {
+            const struct regexInst *in = &d->prog->inst[d->list[k]];
+            if (in->op == RE_SET && reSetHas(in->set, c))
+                reClosure(d, in->x);
+        }
+    }
+    return n;
+}
+
+/**
+ * Returns the state of a set of instructions, adding it to the cache if needed.
+ *
+ * @param d The DFA.
+ * @param set The instructions, as listed by reCollect.
+ * @param n The number of instructions.
+ * @return The state, RE_DEAD for the empty set, or RE_UNKNOWN if the cache is full.
+ */
+int reState(struct regexDFA *d, const int *set, int n)
+{
+    if (n == 0)
+        return RE_DEAD;
+
+    unsigned int h = 2166136261u;
+    for (int k = 0; k < n; k++)
+        h = (h ^ (unsigned int)set[k]) * 16777619u;
+
+    unsigned int mask = 2 * EDITOR_DFA_STATES - 1;
+    for (h &= mask; d->hash[h]; h = (h + 1) & mask)
+    {
+        int s = d->hash[h] - 1;
+        if (d->setlen[s] == n && !memcmp(&d->pool[d->setoff[s]], set, n * sizeof(int)))
+            return s;
+    }
+    if (d->nstates == EDITOR_DFA_STATES)
+        return RE_UNKNOWN;
+
+    if (d->nstates == d->cap)
+    {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->trans = realloc(d->trans, (size_t)d->cap * d->prog->ncls * sizeof(int));
+        d->accept = realloc(d->accept, d->cap);
+        d->setoff = realloc(d->setoff, d->cap * sizeof(int));
+        d->setlen = realloc(d->setlen, d->cap * sizeof(int));
+    }
+    if (d->poollen + n > d->poolcap)
+    {
+        d->poolcap = (d->poollen + n) * 2;
+        d->pool = realloc(d->pool, d->poolcap * sizeof(int));
+    }
+
+    int s = d->nstates++;
+    memcpy(&d->pool[d->poollen], set, n * sizeof(int));
+    d->setoff[s] = d->poollen;
+    d->setlen[s] = n;
+    d->poollen += n;
+    d->accept[s] = d->prog->inst[set[n - 1]].op == RE_MATCH;
+    for (int c = 0; c < d->prog->ncls; c++)
+        d->trans[(size_t)s * d->prog->ncls + c] = RE_UNKNOWN;
+    d->hash[h] = s + 1;
+    return s;
+}
+
+/**
+ * Returns the state a DFA starts in.
+ *
+ * @param d The DFA.
+ * @param bol Set when the text starts at the start of a line, where RE_BOL is read.
+ * @return The state.
+ */
+int reStart(struct regexDFA *d, int bol)
+{
+    int *slot = bol ? &d->startbol : &d->start;
+    if (*slot != RE_UNKNOWN)
+        return *slot;
+
+    d->gen++;
+    reClosure(d, 0);
+    // the threads reading RE_BOL go past it, and the others stay where they are
+    int n = bol ? reAnchor(d, RE_BOL) : reCollect(d);
+    int s = reState(d, d->list, n);
+    if (s == RE_UNKNOWN)
+    {
+        reFlush(d);
+        s = reState(d, d->list, n);
+    }
+    *slot = s;
+    return s;
+}
+
+/**
+ * Computes a transition of a DFA that is not in its cache yet.
+ *
+ * @param d The DFA.
+ * @param s The state, which is not RE_DEAD.
+ * @param c The symbol read.
+ * @return The next state, or RE_DEAD when no match can go on.
+ */
+int reCompute(struct regexDFA *d, int s, int c)
+{
+    const struct regexProgram *p = d->prog;
+    int n = d->setlen[s];
+    memcpy(d->saved, &d->pool[d->setoff[s]], n * sizeof(int));
+
+    d->gen++;
+    for (int k = 0; k < n; k++)
+    {
+        const struct regexInst *in = &p->inst[d->saved[k]];
+        if (in->op == RE_SET && reSetHas(in->set, c))
+            reClosure(d, in->x);
+    }
+    if (!d->anchored)
+        reClosure(d, 0);
+
+    int len = c >= 256 ? reAnchor(d, c) : reCollect(d);
+    int t = reState(d, d->list, len);
+    if (t == RE_UNKNOWN)
+    {
+        // the cache is full: start it over from the current state
+        reFlush(d);
+        s = reState(d, d->saved, n);
+        t = reState(d, d->list, len);
+    }
+    d->trans[(size_t)s * p->ncls + p->cls[c]] = t;
+    return t;
+}
+
+/**
+ * Returns the state a DFA goes to when reading a symbol.
+ *
+ * @param d The DFA.
+ * @param s The state, which is not RE_DEAD.
+ * @param c The symbol.
+ * @return The next state, or RE_DEAD when no match can go on.
+ */
+int reNext(struct regexDFA *d, int s, int c)
+{
+    int t = d->trans[(size_t)s * d->prog->ncls + d->prog->cls[c]];
+    return t != RE_UNKNOWN ? t : reCompute(d, s, c);
+}
+
+/**
+ * Prepares the DFAs of a thread for a regular expression.
+ *
+ * @param m The matcher.
+ * @param re The expression.
+ * @return None
+ */
+void reMatcherInit(struct regexMatcher *m, const struct regex *re)
+{
+    memset(m, 0, sizeof(*m));
+    reDFAInit(&m->scan, &re->fwd, 0);
+    reDFAInit(&m->fwd, &re->fwd, 1);
+    reDFAInit(&m->rev, &re->rev, 0);
+}
+
+/**
+ * Frees the memory of a matcher.
+ *
+ * @param m The matcher.
+ * @return None
+ */
+void reMatcherFree(struct regexMatcher *m)
+{
+    reDFAFree(&m->scan);
+    reDFAFree(&m->fwd);
+    reDFAFree(&m->rev);
+    free(m->starts);
+    free(m->line);
+}
+
+/**
+ * Returns where the longest match starting at an offset of a line ends.
+ *
+ * @param d The anchored DFA.
+ * @param s The line, without its newline.
+ * @param n The length of the line.
+ * @param at The offset the match starts at.
+ * @return The offset the match ends at, or (size_t)-1 if none starts there.
+ */
+size_t reLongest(struct regexDFA *d, const char *s, size_t n, size_t at)
+{
+    int st = reStart(d, at == 0);
+    size_t end = d->accept[st] ? at : (size_t)-1;
+
+    for (size_t i = at; i < n && st != RE_DEAD; i++)
+    {
+        st = reNext(d, st, (unsigned char)s[i]);
+        if (st != RE_DEAD && d->accept[st])
+            end = i + 1;
+    }
+    if (st != RE_DEAD)
+    {
+        st = reNext(d, st, RE_EOL);
+        if (st != RE_DEAD && d->accept[st])
+            end = n;
+    }
+    return end;
+}
+
+/**
+ * Finds the offsets of a line where a match starts, reading the line backwards
+ * with the reversed program, in a single pass.
+ *
+ * @param m The matcher, whose starts receives one flag per offset, n included.
+ * @param s The line, without its newline.
+ * @param n The length of the line.
+ * @return None
+ */
+void reStarts(struct regexMatcher *m, const char *s, size_t n)
+{
+    if (n + 1 > m->startscap)
+    {
+        m->startscap = (n + 1) * 2;
+        m->starts = realloc(m->starts, m->startscap);
+    }
+
+    struct regexDFA *d = &m->rev;
+    int st = reNext(d, reStart(d, 0), RE_EOL);
+    m->starts[n] = d->accept[st];
+    for (size_t i = n; i-- > 0;)
+    {
+        st = reNext(d, st, (unsigned char)s[i]);
+        m->starts[i] = d->accept[st];
+    }
+    st = reNext(d, st, RE_BOL);
+    m->starts[0] |= d->accept[st];
+}
+
+/*** search ***/
+
+/**
+ * @struct searchPattern
+ * @brief A query prepared for searching, with its Horspool shift table.
+ */
+struct searchPattern
+{
+    const char *s;        ///< The query.
+    size_t len;           ///< The length of the query.
+    size_t shift[256];    ///< How far the window moves when its last byte is a given one.
+};
+
+/**
+ * Prepares a query for searching.
+ *
+ * @param p The pattern to fill in.
+ * @param s The query.
+ * @param len The length of the query, at least 1.
+ * @return None
+ */
+void srCompile(struct searchPattern *p, const char *s, size_t len)
+{
+    p->s = s;
+    p->len = len;
+    for (int c = 0; c < 256; c++)
+        p->shift[c] = len;
+    for (size_t i = 0; i + 1 < len; i++)
+        p->shift[(unsigned char)s[i]] = len - 1 - i;
+}
+
+/**
+ * Finds the first match of a pattern in a buffer with Boyer-Moore-Horspool.
+ *
+ * @param p The pattern.
+ * @param hay The buffer.
+ * @param n The length of the buffer.
+ * @param from The offset the search starts at.
+ * @return The offset of the match, or n if there is none.
+ */
+size_t srFindBMH(const struct searchPattern *p, const char *hay, size_t n, size_t from)
+{
+    size_t m = p->len;
+    char last = p->s[m - 1];
+    for (size_t i = from; i + m <= n; i += p->shift[(unsigned char)hay[i + m - 1]])
+    {
+        if (hay[i + m - 1] == last && !memcmp(&hay[i], p->s, m - 1))
+            return i;
+    }
+    return n;
+}
+
+#ifdef __SSE2__
+/**
+ * Finds the first match of a pattern in a buffer 16 positions at a time with SSE2:
+ * only the positions where both the first and the last byte of the pattern are
+ * found are compared in full. The end of the buffer goes to srFindBMH.
+ *
+ * @param p The pattern.
+ * @param hay The buffer.
+ * @param n The length of the buffer.
+ * @param from The offset the search starts at.
+ * @return The offset of the match, or n if there is none.
+ */
+size_t srFindSSE2(const struct searchPattern *p, const char *hay, size_t n, size_t from)
+{
+    size_t m = p->len;
+    const __m128i first = _mm_set1_epi8(p->s[0]);
+    const __m128i last = _mm_set1_epi8(p->s[m - 1]);
+    size_t i = from;
+
+    for (; i + m - 1 + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)&hay[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&hay[i + m - 1]);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask)
+        {
+            size_t j = i + __builtin_ctz(mask);
+            if (m <= 2 || !memcmp(&hay[j + 1], &p->s[1], m - 2))
+                return j;
+            mask &= mask - 1;
+        }
+    }
+
+    return srFindBMH(p, hay, n, i);
+}
+#endif
+
+/**
+ * Finds the first match of a pattern in a buffer. Short patterns go to the SIMD
+ * filter when there is one; from EDITOR_BMH_MIN bytes on, Horspool skips are longer
+ * than a vector and win.
+ *
+ * @param p The pattern.
+ * @param hay The buffer.
+ * @param n The length of the buffer.
+ * @param from The offset the search starts at.
+ * @return The offset of the match, or n if there is none.
+ */
+size_t srFind(const struct searchPattern *p, const char *hay, size_t n, size_t from)
+{
+#ifdef __SSE2__
+    if (p->len < EDITOR_BMH_MIN)
+        return srFindSSE2(p, hay, n, from);
+#endif
+    return srFindBMH(p, hay, n, from);
+}
+
+/**
+ * Appends a match to a list.
+ *
+ * @param l The list.
+ * @param pos The offset of the match.
+ * @return None
+ */
+void srPush(struct searchList *l, size_t pos)
+{
+    if (l->len == l->cap)
+    {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->pos = realloc(l->pos, l->cap * sizeof(size_t));
+        if (l->pos == NULL)
+            die("realloc");
+    }
+    l->pos[l->len++] = pos;
+}
+
+/**
+ * @struct searchScan
+ * @brief The state of a scan of the pieces of a range of the document for a pattern.
+ */
+struct searchScan
+{
+    struct pieceTable *pt;         ///< The piece table scanned.
+    const struct searchPattern *p; ///< The pattern.
+    struct searchList *list;       ///< The list receiving the matches.
+    size_t from;                   ///< The offset the scan starts at.
+    size_t end;                    ///< The offset the scan ends at.
+    const int *cancel;             ///< Set by the main thread to stop the scan.
+    int canceled;                  ///< Set when the scan stopped before the end.
+    char *tail;                    ///< The last bytes before the current piece, one less than the pattern.
+    size_t taillen;                ///< The length of tail.
+    size_t tailoff;                ///< The offset of tail in the document.
+    char *window;                  ///< Room for tail followed by the start of the current piece.
+    struct regexMatcher *rm;       ///< The DFAs of a regular expression scan, NULL for a literal one.
+    int state;                     ///< The state of the line scanning DFA.
+    size_t linestart;              ///< The offset of the line being scanned.
+    int matched;                   ///< Set once the line being scanned is known to hold a match.
+};
+
+/**
+ * Scans a piece for a pattern, first looking for the matches that start in the
+ * bytes before it and end in it.
+ *
+ * @param arg The searchScan.
+ * @param s The text of the piece.
+ * @param len The length of the piece.
+ * @param off The offset of the piece in the document.
+ * @return 1 when the scan reached its end or was canceled, 0 otherwise.
+ */
+int srScanPiece(void *arg, const char *s, size_t len, size_t off)
+{
+    struct searchScan *sc = arg;
+    struct searchList *l = sc->list;
+    size_t m = sc->p->len;
+    size_t start = sc->from > off ? sc->from - off : 0;
+
+    if (off >= sc->end)
+        return 1;
+    if (__atomic_load_n(sc->cancel, __ATOMIC_RELAXED))
+    {
+        sc->canceled = 1;
+        return 1;
+    }
+    if (len > sc->end - off)
+        len = sc->end - off;
+
+    if (sc->taillen)
+    {
+        size_t head = (len - start < m - 1) ? len - start : m - 1;
+        memcpy(sc->window, sc->tail, sc->taillen);
+        memcpy(&sc->window[sc->taillen], &s[start], head);
+        size_t wlen = sc->taillen + head;
+        for (size_t j = srFind(sc->p, sc->window, wlen, 0); j < sc->taillen; j = srFind(sc->p, sc->window, wlen, j + 1))
+            srPush(l, sc->tailoff + j);
+    }
+
+    for (size_t j = srFind(sc->p, s, len, start); j < len; j = srFind(sc->p, s, len, j + 1))
+        srPush(l, off + j);
+
+    // keep the last m - 1 bytes scanned, which may come from several short pieces
+    size_t keep = m - 1, plen = len - start;
+    if (plen >= keep)
+    {
+        memcpy(sc->tail, &s[len - keep], keep);
+        sc->taillen = keep;
+        sc->tailoff = off + len - keep;
+    }
+    else
+    {
+        if (sc->taillen == 0)
+            sc->tailoff = off + start;
+        size_t drop = (sc->taillen + plen > keep) ? sc->taillen + plen - keep : 0;
+        memmove(sc->tail, &sc->tail[drop], sc->taillen - drop);
+        memcpy(&sc->tail[sc->taillen - drop], &s[start], plen);
+        sc->taillen += plen - drop;
+        sc->tailoff += drop;
+    }
+    return 0;
+}
+
+/**
+ * Adds the matches of a line known to hold one to the list of a scan: the
+ * reversed program finds where matches start, and from the first start on, each
+ * match is the longest one there, the next one starting where it ends.
+ *
+ * @param sc The searchScan.
+ * @param lineend The offset of the newline of the line.
+ * @return None
+ */
+void srRegexLine(struct searchScan *sc, size_t lineend)
+{
+    struct regexMatcher *m = sc->rm;
+    size_t n = lineend - sc->linestart;
+    const char *s = ptContiguous(sc->pt, sc->linestart, n);
+    if (s == NULL)
+    {
+        if (n > m->linecap)
+        {
+            m->linecap = n * 2;
+            m->line = realloc(m->line, m->linecap);
+        }
+        ptCopy(sc->pt, sc->linestart, n, m->line);
+        s = m->line;
+    }
+
+    reStarts(m, s, n);
+    for (size_t at = 0; at <= n;)
+    {
+        const unsigned char *next = memchr(&m->starts[at], 1, n + 1 - at);
+        if (next == NULL)
+            break;
+        at = next - m->starts;
+
+        size_t end = reLongest(&m->fwd, s, n, at);
+        srPush(sc->list, sc->linestart + at);
+        // an empty match is kept once, and the next match starts after it
+        at = (end != (size_t)-1 && end > at) ? end : at + 1;
+    }
+}
+
+/**
+ * Scans a piece for a regular expression. The lines are read with the unanchored
+ * DFA, and the rest of a line is skipped as soon as it is known to hold a match,
+ * its newline being where the matches are extracted.
+ *
+ * @param arg The searchScan.
+ * @param s The text of the piece.
+ * @param len The length of the piece.
+ * @param off The offset of the piece in the document.
+ * @return 1 when the scan reached its end or was canceled, 0 otherwise.
+ */
+int srScanRegexPiece(void *arg, const char *s, size_t len, size_t off)
+{
+    struct searchScan *sc = arg;
+    struct regexDFA *d = &sc->rm->scan;
+    size_t start = sc->from > off ? sc->from - off : 0;
+
+    if (off >= sc->end)
+        return 1;
+    if (__atomic_load_n(sc->cancel, __ATOMIC_RELAXED))
+    {
+        sc->canceled = 1;
+        return 1;
+    }
+    if (len > sc->end - off)
+        len = sc->end - off;
+
+    int st = sc->state;
+    for (size_t i = start; i < len; i++)
+    {
+        unsigned char c = s[i];
+        if (c == '\n')
+        {
+            if (!sc->matched && d->accept[reNext(d, st, RE_EOL)])
+                sc->matched = 1;
+            if (sc->matched)
+                srRegexLine(sc, off + i);
+            sc->linestart = off + i + 1;
+            st = reStart(d, 1);
+            sc->matched = d->accept[st];
+        }
+        else if (sc->matched)
+        {
+            const char *nl = memchr(&s[i], '\n', len - i);
+            if (nl == NULL)
+                break;
+            i = nl - s - 1;
+        }
+        else
+        {
+            // the unanchored DFA can always start a new match, so it never dies
+            st = reNext(d, st, c);
+            sc->matched = d->accept[st];
+        }
+    }
+    sc->state = st;
+    return 0;
+}
+
+/**
+ * @struct searchChunk
+ * @brief A range of the document scanned by one worker of a search job. Chunks
+ * start and end on line boundaries, and a query never holds a newline, so no
+ * match crosses from one chunk into the next.
+ */
+struct searchChunk
+{
+    size_t start;             ///< The offset of the chunk.
+    size_t end;               ///< The offset the chunk ends at.
+    struct searchList found;  ///< The matches in the chunk.
+    int done;                 ///< Set by the main thread once it took the chunk off the finished stack.
+    struct searchChunk *next; ///< The next chunk on the finished stack.
+};
+
+/**
+ * @struct searchJob
+ * @brief A scan of the end of the document run by a pool of worker threads.
+ *
+ * The workers take the chunks in order and push the ones they finish on a
+ * lock-free stack, which the main thread empties to merge the results into the
+ * list, in document order, as far as the chunks are finished.
+ */
+struct searchJob
+{
+    struct pieceTable *pt;                ///< The document scanned, which is not always the one shown.
+    struct searchPattern p;               ///< The pattern, pointing to query.
+    char *query;                          ///< A copy of the query.
+    const struct regex *re;               ///< The compiled query of a regular expression search, or NULL.
+    struct searchChunk *chunks;           ///< The chunks, in document order.
+    size_t nchunks;                       ///< The number of chunks.
+    size_t next;                          ///< The next chunk to take, taken atomically.
+    size_t found;                         ///< The matches of the finished chunks, counted atomically.
+    size_t base;                          ///< The length of the list when the job started.
+    size_t limit;                         ///< The workers stop taking chunks once found reaches it.
+    int cancel;                           ///< Set by the main thread to stop the workers.
+    int running;                          ///< The number of workers still running.
+    struct searchChunk *finished;         ///< The stack of finished chunks not taken by the main thread yet.
+    size_t merged;                        ///< The number of chunks merged into the list.
+    pthread_t threads[EDITOR_SCAN_THREADS]; ///< The workers.
+    int nthreads;                         ///< The number of workers.
+};
+
+/**
+ * Scans chunks of a search job until none is left, the job found its limit of
+ * matches, or it is canceled. A chunk is only handed back once it is scanned in full.
+ *
+ * @param arg The searchJob.
+ * @return NULL.
+ */
+void *srWorker(void *arg)
+{
+    struct searchJob *job = arg;
+    char *tail = malloc(3 * job->p.len);
+    struct regexMatcher *rm = NULL;
+    if (job->re)
+    {
+        rm = malloc(sizeof(struct regexMatcher));
+        reMatcherInit(rm, job->re);
+    }
+
+    while (!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED) &&
+           __atomic_load_n(&job->found, __ATOMIC_RELAXED) < job->limit)
+    {
+        size_t k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (k >= job->nchunks)
+            break;
+
+        struct searchChunk *c = &job->chunks[k];
+        struct searchScan sc = {job->pt, &job->p, &c->found, c->start, c->end, &job->cancel, 0,
+                                tail, 0, 0, &tail[job->p.len], NULL, 0, 0, 0};
+        if (rm)
+        {
+            // chunks start on a line
+            sc.rm = rm;
+            sc.linestart = c->start;
+            sc.state = reStart(&rm->scan, 1);
+            sc.matched = rm->scan.accept[sc.state];
+        }
+        ptVisit(job->pt, c->start, rm ? srScanRegexPiece : srScanPiece, &sc);
+        if (sc.canceled)
+            break;
+
+        __atomic_fetch_add(&job->found, c->found.len, __ATOMIC_RELAXED);
+        c->next = __atomic_load_n(&job->finished, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&job->finished, &c->next, c, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        editorWake();
+    }
+
+    free(tail);
+    if (rm)
+    {
+        reMatcherFree(rm);
+        free(rm);
+    }
+    __atomic_fetch_sub(&job->running, 1, __ATOMIC_RELEASE);
+    editorWake();
+    return NULL;
+}
+
+/**
+ * Starts a background scan of the document after the end of a list, cut into
+ * chunks of about EDITOR_SEARCH_CHUNK bytes shared by up to EDITOR_SCAN_THREADS
+ * workers. Nothing is started if the list is complete or already being extended.
+ *
+ * @param l The list, which has to be one of E.buf->search.lists.
+ * @param limit The number of matches after which the workers stop.
+ * @return None
+ */
+void srStart(struct searchList *l, size_t limit)
+{
+    size_t doclen = ptLength(&E.buf->pt);
+    if (l->job || l->scanned >= doclen)
+        return;
+
+    struct searchJob *job = calloc(1, sizeof(struct searchJob));
+    job->pt = &E.buf->pt;
+    job->query = malloc(l->querylen);
+    memcpy(job->query, E.buf->search.query, l->querylen);
+    srCompile(&job->p, job->query, l->querylen);
+    job->re = E.buf->search.re;
+    job->base = l->len;
+    job->limit = limit;
+
+    size_t cap = 0;
+    for (size_t start = l->scanned, end; start < doclen; start = end)
+    {
+        end = start + EDITOR_SEARCH_CHUNK;
+        if (end >= doclen)
+            end = doclen;
+        else
+        {
+            size_t line = ptLineOf(&E.buf->pt, end);
+            if (ptLineStart(&E.buf->pt, line) < end)
+                end = ptLineStart(&E.buf->pt, line + 1);
+        }
+
+        if (job->nchunks == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            job->chunks = realloc(job->chunks, cap * sizeof(struct searchChunk));
+        }
+        struct searchChunk *c = &job->chunks[job->nchunks++];
+        memset(c, 0, sizeof(*c));
+        c->start = start;
+        c->end = end;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = cpus < 1 ? 1 : (cpus > EDITOR_SCAN_THREADS ? EDITOR_SCAN_THREADS : cpus);
+    if ((size_t)want > job->nchunks)
+        want = job->nchunks;
+
+    job->running = want;
+    for (int i = 0; i < want; i++)
+    {
+        if (pthread_create(&job->threads[job->nthreads], NULL, srWorker, job) == 0)
+            job->nthreads++;
+        else
+            __atomic_fetch_sub(&job->running, 1, __ATOMIC_RELAXED);
+    }
+    // without any thread the scan is done right away
+    if (job->nthreads == 0)
+    {
+        job->running = 1;
+        srWorker(job);
+    }
+
+    l->job = job;
+}
+
+/**
+ * Merges the chunks a job finished into its list, for as far as they follow each
+ * other, and frees the job once its workers are all gone.
+ *
+ * @param l The list.
+ * @return 1 when the list grew or its job ended, 0 otherwise.
+ */
+int srPoll(struct searchList *l)
+{
+    struct searchJob *job = l->job;
+    if (job == NULL)
+        return 0;
+
+    // read before the stack: a worker pushes its last chunk before it counts itself out
+    int ended = __atomic_load_n(&job->running, __ATOMIC_ACQUIRE) == 0;
+    for (struct searchChunk *c = __atomic_exchange_n(&job->finished, NULL, __ATOMIC_ACQUIRE); c; c = c->next)
+        c->done = 1;
+
+    int changed = 0;
+    while (job->merged < job->nchunks && job->chunks[job->merged].done)
+    {
+        struct searchChunk *c = &job->chunks[job->merged++];
+        for (size_t i = 0; i < c->found.len; i++)
+            srPush(l, c->found.pos[i]);
+        free(c->found.pos);
+        c->found.pos = NULL;
+        l->scanned = c->end;
+        changed = 1;
+    }
+
+    if (!ended)
+        return changed;
+
+    l->paused = job->merged < job->nchunks && !job->cancel;
+    for (int i = 0; i < job->nthreads; i++)
+        pthread_join(job->threads[i], NULL);
+    for (size_t i = job->merged; i < job->nchunks; i++)
+        free(job->chunks[i].found.pos);
+    free(job->chunks);
+    free(job->query);
+    free(job);
+    l->job = NULL;
+    return 1;
+}
+
+/**
+ * Stops the job extending a list, keeping the chunks it finished.
+ *
+ * @param l The list.
+ * @return None
+ */
+void srCancel(struct searchList *l)
+{
+    if (l->job == NULL)
+        return;
+    __atomic_store_n(&l->job->cancel, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < l->job->nthreads; i++)
+        pthread_join(l->job->threads[i], NULL);
+    l->job->nthreads = 0;
+    srPoll(l);
+}
+
+/**
+ * Returns the number of matches of a list, counting those its job found but that
+ * are not merged yet.
+ *
+ * @param l The list.
+ * @return The number of matches found so far.
+ */
+size_t srCount(struct searchList *l)
+{
+    if (l->job == NULL)
+        return l->len;
+    return l->job->base + __atomic_load_n(&l->job->found, __ATOMIC_RELAXED);
+}
+
+/**
+ * @struct searchNarrow
+ * @brief The state of the narrowing of a list to the matches of a longer query.
+ */
+struct searchNarrow
+{
+    const char *query;          ///< The longer query.
+    size_t len;                 ///< Its length.
+    struct searchList *parent;  ///< The list for a prefix of the query.
+    struct searchList *child;   ///< The list receiving the matches that remain.
+    size_t next;                ///< The index of the next match of parent to check.
+};
+
+/**
+ * Checks which matches of the parent list that start in a piece still match.
+ *
+ * @param arg The searchNarrow.
+ * @param s The text of the piece.
+ * @param len The length of the piece.
+ * @param off The offset of the piece in the document.
+ * @return 1 when every match of the parent was checked, 0 otherwise.
+ */
+int srNarrowPiece(void *arg, const char *s, size_t len, size_t off)
+{
+    struct searchNarrow *sn = arg;
+    struct searchList *parent = sn->parent;
+    size_t doclen = ptLength(&E.buf->pt);
+    char buf[256];
+
+    while (sn->next < parent->len && parent->pos[sn->next] < off + len)
+    {
+        size_t pos = parent->pos[sn->next++];
+        int match;
+        if (pos + sn->len <= off + len)
+            match = !memcmp(&s[pos - off], sn->query, sn->len);
+        else if (pos + sn->len > doclen)
+            match = 0;
+        else
+        {
+            // the match runs into the next pieces
+            char *tmp = sn->len <= sizeof(buf) ? buf : malloc(sn->len);
+            ptCopy(&E.buf->pt, pos, sn->len, tmp);
+            match = !memcmp(tmp, sn->query, sn->len);
+            if (tmp != buf)
+                free(tmp);
+        }
+        if (match)
+            srPush(sn->child, pos);
+    }
+    return sn->next == parent->len;
+}
+
+/**
+ * Frees the compiled regular expression of the search engine, which no scan may
+ * be using anymore.
+ *
+ * @param None
+ * @return None
+ */
+void srFreeRegex()
+{
+    if (E.buf->search.matcher)
+    {
+        reMatcherFree(E.buf->search.matcher);
+        free(E.buf->search.matcher);
+        E.buf->search.matcher = NULL;
+    }
+    reFree(E.buf->search.re);
+    E.buf->search.re = NULL;
+}
+
+/**
+ * Stops the background scans and frees the match lists of the search engine.
+ *
+ * @param None
+ * @return None
+ */
+void srReset()
+{
+    for (int i = 0; i < E.buf->search.depth; i++)
+    {
+        srCancel(&E.buf->search.lists[i]);
+        free(E.buf->search.lists[i].pos);
+    }
+    E.buf->search.depth = 0;
+    free(E.buf->search.query);
+    E.buf->search.query = NULL;
+    srFreeRegex();
+}
+
+/**
+ * Returns the match list of a query. The lists built for the prefixes the query
+ * shares with the previous one are kept: the list of the longest of them is
+ * narrowed to the new query instead of scanning the document again, and a query
+ * that only lost characters at its end gets its list back as it was. The part of
+ * the document a list does not cover yet is scanned in the background, and the
+ * scans of the lists that are left behind are canceled. An edit of the document
+ * drops every list. A regular expression has no such prefixes: its list is only
+ * kept while the query stays the same, and it is compiled again otherwise.
+ *
+ * @param query The query.
+ * @param len The length of the query.
+ * @return The list, or NULL for an empty query.
+ */
+struct searchList *srQuery(const char *query, int len)
+{
+    struct searchEngine *se = &E.buf->search;
+    if (se->version != E.buf->pt.version)
+    {
+        srReset();
+        se->version = E.buf->pt.version;
+    }
+
+    int common = 0;
+    int oldlen = se->query ? (int)strlen(se->query) : 0;
+    while (common < len && common < oldlen && se->query[common] == query[common])
+        common++;
+    if (se->regex && (common < len || common < oldlen))
+        common = 0;
+    while (se->depth > 0 && se->lists[se->depth - 1].querylen > common)
+    {
+        srCancel(&se->lists[se->depth - 1]);
+        free(se->lists[--se->depth].pos);
+    }
+
+    free(se->query);
+    se->query = malloc(len + 1);
+    memcpy(se->query, query, len);
+    se->query[len] = '\0';
+
+    se->reerror = NULL;
+    if (len == 0)
+        return NULL;
+
+    if (se->regex && se->depth == 0)
+    {
+        // the lists are all gone, and their scans with them
+        srFreeRegex();
+        se->re = reCompile(query, len, &se->reerror);
+        if (se->re == NULL)
+            return NULL;
+        se->matcher = malloc(sizeof(struct regexMatcher));
+        reMatcherInit(se->matcher, se->re);
+    }
+
+    struct searchList *l;
+    if (se->depth > 0 && se->lists[se->depth - 1].querylen == len)
+    {
+        l = &se->lists[se->depth - 1];
+    }
+    else
+    {
+        if (se->depth == se->cap)
+        {
+            se->cap = se->cap ? se->cap * 2 : 16;
+            se->lists = realloc(se->lists, se->cap * sizeof(struct searchList));
+        }
+        l = &se->lists[se->depth];
+        memset(l, 0, sizeof(*l));
+        l->querylen = len;
+
+        if (se->depth > 0)
+        {
+            struct searchList *parent = &se->lists[se->depth - 1];
+            srCancel(parent);
+            struct searchNarrow sn = {query, len, parent, l, 0};
+            if (parent->len > 0)
+                ptVisit(&E.buf->pt, parent->pos[0], srNarrowPiece, &sn);
+            l->scanned = parent->scanned;
+        }
+        se->depth++;
+    }
+
+    if (!l->paused)
+        srStart(l, EDITOR_SEARCH_BATCH);
+    return l;
+}
+
+/**
+ * Returns the index of the first match of a list at or after an offset. When the
+ * list does not reach that far yet, its background scan is given up to
+ * EDITOR_SEARCH_WAIT milliseconds to get there.
+ *
+ * @param l The list.
+ * @param off The offset.
+ * @return The index of the match, the length of the list if there is none, or
+ * (size_t)-1 if the scan has not reached it yet.
+ */
+size_t srSeek(struct searchList *l, size_t off)
+{
+    double deadline = editorNow() + EDITOR_SEARCH_WAIT;
+    for (;;)
+    {
+        srPoll(l);
+        size_t i = ptLowerBound(l->pos, l->len, off);
+        if (i < l->len || l->scanned >= ptLength(&E.buf->pt))
+            return i;
+
+        // the match is needed, so this scan is not held to a batch of matches
+        srStart(l, (size_t)-1);
+        if (editorNow() > deadline)
+            return (size_t)-1;
+
+        struct timespec ts = {0, 200000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+/*** find ***/
+
+/**
+ * This function is called when the user wants to find a specific text in the editor.
+ * It looks the query up in the match list of the search engine and moves the cursor
+ * to the match at or after the current one; the arrow keys move to the next or the
+ * previous match, wrapping around the document. If the user presses the enter key or
+ * the escape key, the function returns without performing any action.
+ *
+ * @param query The text to search for.
+ * @param key The key that triggered the callback.
+ * @return None
+ */
+void editorFindCallback(char *query, int key)
+{
+    static size_t anchor = 0;
+    static int pending = 0;
+
+    // new results only matter when the scan had not reached the match looked for
+    if (key == SEARCH_MORE)
+    {
+        if (!pending)
+            return;
+        key = pending;
+    }
+    pending = 0;
+    E.buf->search.matchlen = 0;
+
+    if (key == '\r' || key == '\x1b')
+    {
+        anchor = 0;
+        return;
+    }
+
+    int len = strlen(query);
+    struct searchList *l = srQuery(query, len);
+    if (l == NULL)
+        return;
+
+    size_t i;
+    if (key == ARROW_RIGHT || key == ARROW_DOWN)
+    {
+        i = srSeek(l, anchor + 1);
+        if (i == l->len)
+            i = srSeek(l, 0);
+    }
+    else if (key == ARROW_LEFT || key == ARROW_UP)
+    {
+        i = srSeek(l, anchor);
+        if (i == 0)
+            i = srSeek(l, ptLength(&E.buf->pt));
+        if (i != (size_t)-1 && i > 0)
+            i--;
+    }
+    else
+    {
+        // the match under the cursor stays current while it still matches
+        i = srSeek(l, anchor);
+        if (i == l->len)
+            i = srSeek(l, 0);
+    }
+
+    if (i == (size_t)-1)
+    {
+        pending = key;
+        return;
+    }
+    if (l->len == 0)
+        return;
+
+    anchor = l->pos[i];
+    E.buf->cy = ptLineOf(&E.buf->pt, anchor);
+    E.buf->cx = anchor - ptLineStart(&E.buf->pt, E.buf->cy);
+    E.buf->rowoff = E.buf->numrows;
+
+    erow *row = editorRowAt(E.buf->cy);
+    editorRowRender(row);
+    if (E.buf->search.regex)
+    {
+        // the list only holds where matches start
+        size_t end = reLongest(&E.buf->search.matcher->fwd, row->chars, row->size, E.buf->cx);
+        len = end == (size_t)-1 ? 0 : (int)end - E.buf->cx;
+    }
+    if (len > row->size - E.buf->cx)
+        len = row->size - E.buf->cx;
+    int rx = editorRowCxToRx(row, E.buf->cx);
+    len = editorRowCxToRx(row, E.buf->cx + len) - rx;
+
+    E.buf->search.matchline = E.buf->cy;
+    E.buf->search.matchrx = rx;
+    E.buf->search.matchlen = len;
+}
+
+/**
+ * Merges the results of the background search of the open search prompt. When the
+ * prompt was waiting for them, the cursor moves to the match, and the screen is
+ * refreshed so the match counter keeps up.
+ *
+ * @param None
+ * @return None
+ */
+void editorSearchIdle()
+{
+    if (!E.buf->search.active || E.buf->search.depth == 0)
+        return;
+    if (!srPoll(&E.buf->search.lists[E.buf->search.depth - 1]))
+        return;
+
+    editorFindCallback(E.buf->search.query, SEARCH_MORE);
+    editorRefreshScreen();
+}
+
+/**
+ * This function prompts the user to enter a search query and searches for that query in the text editor.
+ * If the user cancels the search by pressing ESC, the function restores the editor's previous state.
+ *
+ * @param regex Set to search for a regular expression instead of a literal text.
+ * @return None
+ */
+void editorFind(int regex)
+{
+    int saved_cx = E.buf->cx;
+    int saved_cy = E.buf->cy;
+    int saved_coloff = E.buf->coloff;
+    int saved_rowoff = E.buf->rowoff;
+
+    // the matches are looked for in the whole file
+    editorLoadFinish();
+
+    // the lists built for the other kind of query mean nothing for this one
+    if (E.buf->search.regex != regex)
+    {
+        srReset();
+        E.buf->search.regex = regex;
+    }
+
+    E.buf->search.active = 1;
+    char *query = editorPrompt(regex ? "Regex: %s (ESC | Arrows | Enter)" : "Search: %s (ESC | Arrows | Enter)",
+                               editorFindCallback);
+    E.buf->search.active = 0;
+
+    // the document may change from now on, so no scan can keep reading it
+    for (int i = 0; i < E.buf->search.depth; i++)
+        srCancel(&E.buf->search.lists[i]);
+
+    if (query)
+        free(query);
+    else
+    {
+        E.buf->cx = saved_cx;
+        E.buf->cy = saved_cy;
+        E.buf->coloff = saved_coloff;
+        E.buf->rowoff = saved_rowoff;
+    }
+}
+
+/*** buffers ***/
+
+/**
+ * Allocates an empty buffer and adds it to the buffer list, after the others.
+ *
+ * @param None
+ * @return The buffer, which is not shown yet.
+ */
+struct editorBuffer *editorBufferNew()
+{
+    struct editorBuffer *b = calloc(1, sizeof(struct editorBuffer));
+    if (b == NULL)
+        die("calloc");
+    ptInit(&b->pt);
+    b->follow.fd = -1;
+    b->follow.notify = -1;
+
+    E.bufs = realloc(E.bufs, (E.nbufs + 1) * sizeof(struct editorBuffer *));
+    if (E.bufs == NULL)
+        die("realloc");
+    E.bufs[E.nbufs++] = b;
+    return b;
+}
+
+/**
+ * Returns the index of a buffer in the buffer list.
+ *
+ * @param b The buffer.
+ * @return Its index.
+ */
+int editorBufferIndex(struct editorBuffer *b)
+{
+    int k = 0;
+    while (E.bufs[k] != b)
+        k++;
+    return k;
+}
+
+/**
+ * Shows another buffer. The rows cached are those of the buffer left, so they go.
+ * The loader and the follow mode of a buffer that is not shown keep their results
+ * until it is shown again; its save is completed and its background highlighting,
+ * which lexes with the syntax of the buffer shown, is stopped, to start again later.
+ *
+ * @param b The buffer.
+ * @return None
+ */
+void editorBufferShow(struct editorBuffer *b)
+{
+    if (b == E.buf)
+        return;
+
+    editorSaveWait();
+    hlJobCancel();
+    editorRowCacheClear();
+    E.buf = b;
+
+    E.shadowvalid = 0;
+    // what the workers of the buffer left waiting is taken at the next frame
+    E.events.woken = 1;
+}
+
+/**
+ * Shows the buffer list in the status message, the buffer shown in brackets and
+ * those with unsaved changes marked with a '+'.
+ *
+ * @param None
+ * @return None
+ */
+void editorBufferList()
+{
+    char list[sizeof(E.statusmsg)];
+    size_t len = 0;
+    list[0] = '\0';
+
+    for (int i = 0; i < E.nbufs && len < sizeof(list); i++)
+    {
+        struct editorBuffer *b = E.bufs[i];
+        const char *name = b->filename ? b->filename : "[No Name]";
+        const char *slash = strrchr(name, '/');
+        if (slash && slash[1])
+            name = slash + 1;
+        int cur = b == E.buf;
+        int n = snprintf(&list[len], sizeof(list) - len, "%s%s%d:%s%s%s", i ? " " : "", cur ? "[" : "", i + 1,
+                         name, b->modified ? "+" : "", cur ? "]" : "");
+        if (n < 0)
+            break;
+        len += n;
+    }
+    editorSetStatusMessage("%s", list);
+}
+
+/**
+ * Shows the buffer after the one shown in the buffer list, or the first one after the last.
+ *
+ * @param None
+ * @return None
+ */
+void editorBufferNext()
+{
+    editorBufferShow(E.bufs[(editorBufferIndex(E.buf) + 1) % E.nbufs]);
+    editorBufferList();
+}
+
+/**
+ * Closes the buffer shown and frees it, and shows the buffer before it in the
+ * buffer list. Closing the last buffer leaves an empty one.
+ *
+ * @param None
+ * @return None
+ */
+void editorBufferClose()
+{
+    struct editorBuffer *b = E.buf;
+
+    // the workers still reading the buffer go first
+    editorSaveWait();
+    editorLoadCancel();
+    hlJobCancel();
+    srReset();
+    editorRowCacheClear();
+
+    if (b->follow.fd != -1)
+        close(b->follow.fd);
+    if (b->follow.notify != -1)
+        close(b->follow.notify);
+    ptFree(&b->pt);
+    free(b->hlstate);
+    free(b->search.lists);
+    free(b->undo.recs);
+    free(b->undo.log);
+    free(b->disk.ext);
+    free(b->filename);
+
+    int k = editorBufferIndex(b);
+    memmove(&E.bufs[k], &E.bufs[k + 1], (E.nbufs - k - 1) * sizeof(struct editorBuffer *));
+    E.nbufs--;
+    free(b);
+
+    if (E.nbufs == 0)
+        editorBufferNew();
+    E.buf = E.bufs[k > 0 ? k - 1 : 0];
+    E.shadowvalid = 0;
+    E.events.woken = 1;
+    editorBufferList();
+}
+
+/**
+ * Prompts for a file and opens it in a buffer of its own, which is then shown. The
+ * buffer shown is used instead when it is empty, without a file and unmodified.
+ *
+ * @param None
+ * @return None
+ */
+void editorBufferOpen()
+{
+    char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (filename == NULL)
+    {
+        editorSetStatusMessage("Operation aborted");
+        return;
+    }
+
+    struct editorBuffer *shown = NULL;
+    if (E.buf->filename || E.buf->modified)
+    {
+        shown = E.buf;
+        editorBufferShow(editorBufferNew());
+    }
+    if (editorOpen(filename) == -1)
+    {
+        // the buffer made for the file goes, the error stays in the status bar
+        if (shown)
+        {
+            char msg[sizeof(E.statusmsg)];
+            memcpy(msg, E.statusmsg, sizeof(msg));
+            editorBufferClose();
+            editorBufferShow(shown);
+            editorSetStatusMessage("%s", msg);
+        }
+        free(filename);
+        return;
+    }
+    free(filename);
+    editorBufferList();
+}
+
+/**
+ * Counts the buffers with unsaved changes.
+ *
+ * @param None
+ * @return The number of buffers.
+ */
+int editorBuffersModified()
+{
+    int n = 0;
+    for (int i = 0; i < E.nbufs; i++)
+        n += E.bufs[i]->modified != 0;
+    return n;
+}
+
+/*** append buffer ***/
+
+struct abuf
+{
+    char *b;
+    int len;
+    int cap;
+};
+
+// buffer constructor
+#define ABUF_INIT  \
+    {              \
+        NULL, 0, 0 \
+    }
+
+/**
+ * This function copies the new string to the end of the buffer. The buffer grows
+ * by doubling, so a buffer that is emptied and reused reaches its final size after
+ * a few appends and stops reallocating.
+ *
+ * @param ab The buffer to append the string to.
+ * @param s The string to append.
+ * @param len The length of the string to append.
+ * @return None
+ */
+void abAppend(struct abuf *ab, const char *s, int len)
+{
+    if (ab->len + len > ab->cap)
+    {
+        int cap = ab->cap ? ab->cap : 1024;
+        while (cap < ab->len + len)
+            cap *= 2;
+
+        char *new = realloc(ab->b, cap);
+        if (new == NULL)
+            return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+
+    memcpy(&ab->b[ab->len], s, len);
+    ab->len += len;
+}
+
+/**
+ * Frees the memory allocated for the abuf structure.
+ *
+ * @param ab The abuf structure to be freed.
+ * @return None
+ */
+void abFree(struct abuf *ab)
+{
+    free(ab->b);
+}
+
+/*** output ***/
+
+/**
+ * Scrolls the editor to keep the cursor in view.
+ *
+ * @param None
+ * @return None
+ */
+void editorScroll()
+{
+    E.buf->rx = 0;
+    if (E.buf->cy < E.buf->numrows)
+    {
+        E.buf->rx = editorRowCxToRx(editorRowAt(E.buf->cy), E.buf->cx);
+    }
+
+    if (E.buf->cy < E.buf->rowoff)
+    {
+        E.buf->rowoff = E.buf->cy;
+    }
+    if (E.buf->cy >= E.buf->rowoff + E.screenrows)
+    {
+        E.buf->rowoff = E.buf->cy - E.screenrows + 1;
+    }
+    if (E.buf->rx < E.buf->coloff)
+    {
+        E.buf->coloff = E.buf->rx;
+    }
+    if (E.buf->rx >= E.buf->coloff + E.screencols)
+    {
+        E.buf->coloff = E.buf->rx - E.screencols + 1;
+    }
+}
+
+/**
+ * Allocates the frame and shadow cells for the current screen size. The shadow
+ * is marked invalid, so the next refresh clears the terminal and paints it all.
+ *
+ * @param None
+ * @return None
+ */
+void editorScreenAlloc()
+{
+    size_t cells = (size_t)(E.screenrows + 2) * E.screencols;
+    E.screen.ch = realloc(E.screen.ch, cells);
+    E.screen.attr = realloc(E.screen.attr, cells);
+    E.shadow.ch = realloc(E.shadow.ch, cells);
+    E.shadow.attr = realloc(E.shadow.attr, cells);
+    if ((!E.screen.ch || !E.screen.attr || !E.shadow.ch || !E.shadow.attr) && cells)
+        die("realloc");
+    E.shadowvalid = 0;
+}
+
+/**
+ * Fills the cells of screen rows from a column onwards with blanks.
+ *
+ * @param cells The cells of the screen.
+ * @param y The first row to blank.
+ * @param x The first column to blank.
+ * @param rows The number of rows to blank, the first one starting at x.
+ * @return None
+ */
+void editorScreenBlank(struct screenCells *cells, int y, int x, int rows)
+{
+    size_t at = (size_t)y * E.screencols + x;
+    size_t n = (size_t)rows * E.screencols - x;
+    memset(&cells->ch[at], ' ', n);
+    memset(&cells->attr[at], HL_NORMAL, n);
+}
+
+/**
+ * Writes text into the cells of the frame being composed, clipped to the screen width.
+ *
+ * @param y The row of the screen.
+ * @param x The column of the first character.
+ * @param s The text to write.
+ * @param len The length of the text.
+ * @param attr The attribute the text is drawn with.
+ * @return None
+ */
+void editorScreenPut(int y, int x, const char *s, int len, unsigned char attr)
+{
+    if (x >= E.screencols)
+        return;
+    if (len > E.screencols - x)
+        len = E.screencols - x;
+
+    size_t at = (size_t)y * E.screencols + x;
+    memcpy(&E.screen.ch[at], s, len);
+    memset(&E.screen.attr[at], attr, len);
+}
+
+/**
+ * Paints a run of columns of a row onto the cells of a screen line, clipped to the columns shown.
+ *
+ * @param attr The cells of the screen line.
+ * @param len The number of columns shown, from E.buf->coloff.
+ * @param start The first column of the run in the row.
+ * @param n The number of columns of the run.
+ * @param hl The highlight to paint.
+ * @return None
+ */
+void editorPaintRun(unsigned char *attr, int len, int start, int n, unsigned char hl)
+{
+    int from = start - E.buf->coloff;
+    int to = from + n;
+    if (from < 0)
+        from = 0;
+    if (to > len)
+        to = len;
+    if (from < to)
+        memset(&attr[from], hl, to - from);
+}
+
+/**
+ * Draws the rows of the editor into the frame. The rendered characters are copied into
+ * the cells as they are, and the highlighted runs that are in view are painted over them;
+ * only control characters are then replaced with their inverse-video symbol.
+ *
+ * @param None
+ * @return None
+ */
+void editorDrawRows()
+{
+    for (int y = 0; y < E.screenrows; y++)
+    {
+        int filerow = y + E.buf->rowoff;
+
+        if (filerow >= E.buf->numrows)
+        {
+            editorScreenPut(y, 0, "~", 1, HL_NORMAL);
+            if (E.buf->numrows == 0 && y == E.screenrows / 3)
+            {
+                char welcome[80];
+                int welcomelen = snprintf(welcome, sizeof(welcome),
+                                          "simple text editor -- version %s", EDITOR_VERSION);
+                if (welcomelen > E.screencols)
+                    welcomelen = E.screencols;
+                int padding = (E.screencols - welcomelen) / 2;
+                if (padding == 0)
+                    editorScreenBlank(&E.screen, y, 0, 1);
+                editorScreenPut(y, padding, welcome, welcomelen, HL_NORMAL);
+            }
+        }
+        else
+        {
+            erow *row = editorRowAt(filerow);
+            editorRowRender(row);
+            int len = row->rstart + row->rsize - E.buf->coloff;
+
+            if (len < 0)
+                len = 0;
+
+            if (len > E.screencols)
+                len = E.screencols;
+
+            char *ch = &E.screen.ch[y * E.screencols];
+            unsigned char *attr = &E.screen.attr[y * E.screencols];
+            if (len > 0)
+                memcpy(ch, &row->render[E.buf->coloff - row->rstart], len);
+            memset(attr, HL_NORMAL, len);
+
+            // skips the runs that end left of the view
+            int lo = 0, hi = row->nspans;
+            while (lo < hi)
+            {
+                int mid = lo + (hi - lo) / 2;
+                if (row->spans[mid].start + row->spans[mid].len <= E.buf->coloff)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (int k = lo; k < row->nspans && row->spans[k].start < E.buf->coloff + len; k++)
+                editorPaintRun(attr, len, row->spans[k].start, row->spans[k].len, row->spans[k].hl);
+            if (E.buf->search.matchlen && filerow == E.buf->search.matchline)
+                editorPaintRun(attr, len, E.buf->search.matchrx, E.buf->search.matchlen, HL_MATCH);
+
+            for (int j = 0; j < len; j++)
+            {
+                if (iscntrl(ch[j]))
+                {
+                    ch[j] = (ch[j] <= 26) ? '@' + ch[j] : '?';
+                    attr[j] = CELL_INVERSE;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Draws the status bar into the frame.
+ *
+ * @param None
+ * @return None
+ */
+void editorDrawStatusBar()
+{
+    int y = E.screenrows;
+    char status[80], rstatus[80];
+
+    // the position of the buffer, once there are several
+    char which[32] = "";
+    if (E.nbufs > 1)
+        snprintf(which, sizeof(which), "[%d/%d] ", editorBufferIndex(E.buf) + 1, E.nbufs);
+
+    int len;
+    if (E.buf->load.active)
+        len = snprintf(status, sizeof(status), "%s%.20s - loading... %d lines (%d%%) %s", which,
+                       E.buf->filename ? E.buf->filename : "[No Name]", E.buf->numrows,
+                       (int)(E.buf->load.loaded * 100 / E.buf->load.len), E.buf->modified ? "(modified)" : "");
+    else
+        len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s", which,
+                       E.buf->filename ? E.buf->filename : "[No Name]", E.buf->numrows,
+                       E.buf->modified ? "(modified)" : "");
+    if (len >= (int)sizeof(status))
+        len = sizeof(status) - 1;
+
+    char count[48] = "";
+    if (E.buf->search.active && E.buf->search.reerror)
+    {
+        snprintf(count, sizeof(count), "bad regex: %s | ", E.buf->search.reerror);
+    }
+    else if (E.buf->search.active && E.buf->search.depth > 0)
+    {
+        struct searchList *l = &E.buf->search.lists[E.buf->search.depth - 1];
+        snprintf(count, sizeof(count), "%zu matches%s | ", srCount(l),
+                 l->scanned < ptLength(&E.buf->pt) ? " so far" : "");
+    }
+
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d / %d", count,
+                        E.buf->syntax ? E.buf->syntax->filetype : "no filetype", E.buf->cy + 1, E.buf->numrows);
+
+    memset(&E.screen.attr[y * E.screencols], CELL_INVERSE, E.screencols);
+
+    editorScreenPut(y, 0, status, len, CELL_INVERSE);
+    if (len + rlen <= E.screencols)
+        editorScreenPut(y, E.screencols - rlen, rstatus, rlen, CELL_INVERSE);
+}
+
+/**
+ * Draws the message bar into the frame.
+ *
+ * @param None
+ * @return None
+ */
+void editorDrawMessageBar()
+{
+    int msglen = strlen(E.statusmsg);
+
+    if (msglen > E.screencols)
+        msglen = E.screencols;
+
+    if (msglen && time(NULL) - E.statusmsg_time < EDITOR_STATUS_SECONDS)
+        editorScreenPut(E.screenrows + 1, 0, E.statusmsg, msglen, HL_NORMAL);
+}
+
+/**
+ * Draws the timings of the previous frame over the right end of the message bar.
+ *
+ * @param st The timings of the previous frame.
+ * @return None
+ */
+void editorDrawOverlay(const struct editorStats *st)
+{
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf),
+                       " frame %.2f: draw %.2f (hl %.2f) diff %.2f write %.2f ms | %d B | open %.1f ms ",
+                       st->compose + st->diff + st->write, st->compose, st->syntax, st->diff, st->write,
+                       st->bytes, st->open);
+    if (len > E.screencols)
+        len = E.screencols;
+    editorScreenPut(E.screenrows + 1, E.screencols - len, buf, len, CELL_INVERSE);
+}
+
+/**
+ * Appends the escape sequences switching the terminal to a cell attribute.
+ *
+ * @param ab The buffer to append the output to.
+ * @param attr The attribute to switch to.
+ * @param cur The attribute the terminal is using, or -1 when unknown.
+ * @return None
+ */
+void editorScreenAttr(struct abuf *ab, int attr, int cur)
+{
+    if (cur == -1 || (cur & CELL_INVERSE) != (attr & CELL_INVERSE))
+    {
+        // [m - reset colors, [7m - invert colors
+        abAppend(ab, "\x1b[m", 3);
+        if (attr & CELL_INVERSE)
+            abAppend(ab, "\x1b[7m", 4);
+        cur = CELL_INVERSE & attr;
+    }
+    if ((cur & ~CELL_INVERSE) != (attr & ~CELL_INVERSE))
+    {
+        char *color = editorSyntaxToColor(attr & ~CELL_INVERSE);
+        abAppend(ab, color, strlen(color));
+    }
+}
+
+/**
+ * Scrolls the text rows of the terminal when the row offset moved by less than a
+ * screen since the previous frame, and shifts the shadow to match, so only the rows
+ * scrolled into view are left to be painted.
+ *
+ * @param ab The buffer to append the output to.
+ * @return None
+ */
+void editorScreenScroll(struct abuf *ab)
+{
+    int d = E.buf->rowoff - E.shadowrowoff;
+    if (!E.shadowvalid || d == 0 || E.buf->coloff != E.shadowcoloff ||
+        d >= E.screenrows || -d >= E.screenrows)
+        return;
+
+    char buf[32];
+    // [r - scroll region, [S - scroll up, [T - scroll down
+    abAppend(ab, "\x1b[m", 3);
+    snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r", E.screenrows, d > 0 ? d : -d, d > 0 ? 'S' : 'T');
+    abAppend(ab, buf, strlen(buf));
+
+    int n = d > 0 ? d : -d;
+    size_t keep = (size_t)(E.screenrows - n) * E.screencols;
+    size_t shift = (size_t)n * E.screencols;
+    if (d > 0)
+    {
+        memmove(E.shadow.ch, &E.shadow.ch[shift], keep);
+        memmove(E.shadow.attr, &E.shadow.attr[shift], keep);
+        editorScreenBlank(&E.shadow, E.screenrows - n, 0, n);
+    }
+    else
+    {
+        memmove(&E.shadow.ch[shift], E.shadow.ch, keep);
+        memmove(&E.shadow.attr[shift], E.shadow.attr, keep);
+        editorScreenBlank(&E.shadow, 0, 0, n);
+    }
+}
+
+/**
+ * Appends the output turning the shadow into the composed frame. Rows equal to
+ * the shadow are skipped whole. In the others only the runs of changed cells are
+ * sent, with a cursor move in front of each; runs separated by fewer than
+ * EDITOR_RUN_GAP unchanged cells are sent as one, and every stretch of a run drawn
+ * with one attribute is copied out at once. A row whose remaining cells are blank
+ * is cut with an erase in line. Rows holding bytes outside ASCII are repainted
+ * whole, since their glyphs do not map one to one onto cells.
+ *
+ * @param ab The buffer to append the output to.
+ * @return None
+ */
+void editorScreenFlush(struct abuf *ab)
+{
+    int rows = E.screenrows + 2, cols = E.screencols;
+    int cury = -1, curx = -1, curattr = -1;
+    char buf[32];
+
+    if (!E.shadowvalid)
+    {
+        // [2J - clear entire screen
+        abAppend(ab, "\x1b[m\x1b[2J", 7);
+        curattr = HL_NORMAL;
+        editorScreenBlank(&E.shadow, 0, 0, rows);
+        E.shadowvalid = 1;
+    }
+
+    for (int y = 0; y < rows; y++)
+    {
+        char *nch = &E.screen.ch[y * cols], *och = &E.shadow.ch[y * cols];
+        unsigned char *nat = &E.screen.attr[y * cols], *oat = &E.shadow.attr[y * cols];
+
+        int wide = 0;
+        for (int x = 0; x < cols && !wide; x++)
+            wide = (nch[x] & 0x80) || (och[x] & 0x80);
+
+        if (!wide && !memcmp(nch, och, cols) && !memcmp(nat, oat, cols))
+            continue;
+
+        int end = cols;
+        while (end > 0 && nch[end - 1] == ' ' && nat[end - 1] == HL_NORMAL)
+            end--;
+
+        int x = 0;
+        while (x < cols)
+        {
+            if (!wide && nch[x] == och[x] && nat[x] == oat[x])
+            {
+                x++;
+                continue;
+            }
+
+            if (cury != y || curx != x)
+            {
+                snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+                abAppend(ab, buf, strlen(buf));
+                cury = y;
+                curx = x;
+            }
+
+            if (x >= end)
+            {
+                if (curattr != HL_NORMAL)
+                    abAppend(ab, "\x1b[m", 3);
+                curattr = HL_NORMAL;
+                // [K - erase in line
+                abAppend(ab, "\x1b[K", 3);
+                editorScreenBlank(&E.shadow, y, x, 1);
+                break;
+            }
+
+            int stop = wide ? end : x + 1;
+            for (int k = stop; k < end && k - stop < EDITOR_RUN_GAP; k++)
+            {
+                if (nch[k] != och[k] || nat[k] != oat[k])
+                    stop = k + 1;
+            }
+
+            memcpy(&och[x], &nch[x], stop - x);
+            memcpy(&oat[x], &nat[x], stop - x);
+            while (x < stop)
+            {
+                int from = x;
+                while (x < stop && nat[x] == nat[from])
+                    x++;
+                if (nat[from] != curattr)
+                {
+                    editorScreenAttr(ab, nat[from], curattr);
+                    curattr = nat[from];
+                }
+                abAppend(ab, &nch[from], x - from);
+            }
+            curx = (wide || x == cols) ? -1 : x;
+        }
+    }
+
+    if (curattr != HL_NORMAL)
+        abAppend(ab, "\x1b[m", 3);
+}
+
+/**
+ * Refreshes the screen: composes the frame and sends the terminal only what
+ * changed since the previous one.
+ *
+ * @param None
+ * @return None
+ */
+void editorRefreshScreen()
+{
+    struct editorStats last = E.stats;
+    double start = E.stats.on ? editorNow() : 0;
+    E.stats.syntax = 0;
+
+    E.rowframe = E.rowclock;
+    E.events.lastframe = editorNow();
+    editorScroll();
+
+    editorScreenBlank(&E.screen, 0, 0, E.screenrows + 2);
+
+    editorDrawRows();
+    editorDrawStatusBar();
+    editorDrawMessageBar();
+    if (E.stats.overlay)
+        editorDrawOverlay(&last);
+
+    double composed = E.stats.on ? editorNow() : 0;
+
+    // the output buffer is kept from frame to frame, so it stops growing after the first ones
+    static struct abuf ab = ABUF_INIT;
+    ab.len = 0;
+
+    // [?25l - hide cursor
+    abAppend(&ab, "\x1b[?25l", 6);
+
+    editorScreenScroll(&ab);
+    editorScreenFlush(&ab);
+    E.shadowrowoff = E.buf->rowoff;
+    E.shadowcoloff = E.buf->coloff;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.buf->cy - E.buf->rowoff) + 1, (E.buf->rx - E.buf->coloff) + 1);
+    abAppend(&ab, buf, strlen(buf));
+
+    abAppend(&ab, "\x1b[?25h", 6);
+
+    double diffed = E.stats.on ? editorNow() : 0;
+
+    write(STDOUT_FILENO, ab.b, ab.len);
+
+    if (E.stats.on)
+    {
+        E.stats.compose = composed - start;
+        E.stats.diff = diffed - composed;
+        E.stats.write = editorNow() - diffed;
+        E.stats.bytes = ab.len;
+    }
+}
+
+/**
+ * This function takes a format string and a variable number of arguments, similar to the `printf` function.
+ * It formats the message according to the format string and stores it in the `E.statusmsg` buffer.
+ * The formatted message is truncated if it exceeds the size of the buffer.
+ * The current time is also stored in `E.statusmsg_time` to track when the status message was set.
+ *
+ * @param fmt The format string for the status message.
+ * @param ... The variable number of arguments to be formatted.
+ * @return None
+ */
+void editorSetStatusMessage(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+    va_end(ap);
+    E.statusmsg_time = time(NULL);
+}
+
+/*** input ***/
+
+/**
+ * This function displays a prompt message to the user and waits for the user to enter text.
+ * The entered text is stored in a dynamically allocated string and returned to the caller.
+ * The function also accepts an optional callback function that can be used to perform additional actions on the entered text.
+ *
+ * @param prompt The prompt message to display to the user.
+ * @param callback A pointer to a function that takes a char pointer and an integer as arguments.
+ *                 This function will be called with the entered text and the last key pressed as arguments.
+ *                 Pass NULL if no callback function is needed.
+ * @return The entered text as a dynamically allocated string.
+ *         Returns NULL if the user cancels the input by pressing the escape key.
+ */
+char *editorPrompt(char *prompt, void (*callback)(char *, int))
+{
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    size_t buflen = 0;
+    buf[0] = '\0';
+    while (1)
+    {
+        editorSetStatusMessage(prompt, buf);
+        editorRefreshScreen();
+        int c = editorReadKey();
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+        {
+            if (buflen != 0)
+                buf[--buflen] = '\0';
+        }
+        else if (c == '\x1b')
+        {
+            editorSetStatusMessage("");
+            if (callback)
+                callback(buf, c);
+            free(buf);
+            return NULL;
+        }
+        else if (c == '\r')
+        {
+            if (buflen != 0)
+            {
+                editorSetStatusMessage("");
+                if (callback)
+                    callback(buf, c);
+                return buf;
+            }
+        }
+        else if (c == PASTE_KEY)
+        {
+            // a prompt takes one line: the paste stops at its first line break
+            for (size_t i = 0; i < E.input.pastelen; i++)
+            {
+                unsigned char p = E.input.paste[i];
+                if (p == '\r' || p == '\n')
+                    break;
+                if (iscntrl(p) || p >= 128)
+                    continue;
+                if (buflen == bufsize - 1)
+                {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = p;
+            }
+            buf[buflen] = '\0';
+        }
+        else if (!iscntrl(c) && c < 128)
+        {
+            if (buflen == bufsize - 1)
+            {
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+
+        if (callback)
+            callback(buf, c);
+    }
+}
+
+/**
+ * Moves the cursor based on the keypress.
+ *
+ * @param key The key that was pressed.
+ * @return None
+ */
+void editorMoveCursor(int key)
+{
+    // the row below has to be loaded before the cursor can go there
+    if (key == ARROW_DOWN || key == ARROW_RIGHT)
+        editorLoadUpto(E.buf->cy + 1);
+
+    // Get the current row
+    erow *row = (E.buf->cy >= E.buf->numrows) ? NULL : editorRowAt(E.buf->cy);
+
+    switch (key)
+    {
+    case ARROW_LEFT:
+        // Move cursor left if not at the beginning of the line
+        if (E.buf->cx != 0)
+            E.buf->cx--;
+        // Move cursor to the end of the previous line if at the beginning of the current line
+        else if (E.buf->cy > 0)
+        {
+            E.buf->cy--;
+            E.buf->cx = editorRowAt(E.buf->cy)->size;
+        }
+        break;
+    case ARROW_RIGHT:
+        // Move cursor right if not at the end of the line
+        if (row && E.buf->cx < row->size)
+            E.buf->cx++;
+        // Move cursor to the beginning of the next line if at the end of the current line
+        else if (row && E.buf->cx == row->size)
+        {
+            E.buf->cy++;
+            E.buf->cx = 0;
+        }
+        break;
+    case ARROW_UP:
+        // Move cursor up if not at the top row
+        if (E.buf->cy != 0)
+            E.buf->cy--;
+        break;
+    case ARROW_DOWN:
+        // Move cursor down if not at the bottom row
+        if (E.buf->cy < E.buf->numrows)
+            E.buf->cy++;
+        break;
+    }
+
+    // Update the current row and its length
+    row = (E.buf->cy >= E.buf->numrows) ? NULL : editorRowAt(E.buf->cy);
+    int rowlen = row ? row->size : 0;
+
+    // Adjust the cursor position if it exceeds the row length
+    if (E.buf->cx > rowlen)
+        E.buf->cx = rowlen;
+}
+
+/**
+ * Waits for a keypress and handles it.
+ *
+ * @param None
+ * @return None
+ */
+void editorProcessKeypress()
+{
+    static int quit_times = EDITOR_QUIT_TIMES;
+    static int close_times = EDITOR_QUIT_TIMES;
+
+    int c = editorReadKey();
+
+    switch (c)
+    {
+    case '\r':
+        editorInsertNewLine();
+        break;
+
+    case CTRL_KEY('q'):
+        // a save still being written would be lost
+        editorSaveWait();
+        if (editorBuffersModified() && quit_times > 0)
+        {
+            editorSetStatusMessage("WARNING!!! %s unsaved changes. "
+                                   "Press Ctrl-Q %d more times to quit.",
+                                   E.nbufs > 1 ? "Buffers have" : "File has", quit_times);
+            quit_times--;
+            return;
+        }
+
+        write(STDOUT_FILENO, "\x1b[2J", 4);
+        write(STDOUT_FILENO, "\x1b[H", 3);
+        exit(0);
+        break;
+
+    case CTRL_KEY('s'):
+        editorSave();
+        break;
+
+    case CTRL_KEY('o'):
+        editorBufferOpen();
+        break;
+
+    case CTRL_KEY('b'):
+        editorBufferNext();
+        break;
+
+    case CTRL_KEY('w'):
+        editorSaveWait();
+        if (E.buf->modified && close_times > 0)
+        {
+            editorSetStatusMessage("WARNING!!! Buffer has unsaved changes. "
+                                   "Press Ctrl-W %d more times to close it.",
+                                   close_times);
+            close_times--;
+            return;
+        }
+        editorBufferClose();
+        break;
+
+    case HOME_KEY:
+        editorUndoBreak();
+        E.buf->cx = 0;
+        break;
+
+    case END_KEY:
+        editorUndoBreak();
+        if (E.buf->cy < E.buf->numrows)
+            E.buf->cx = editorRowAt(E.buf->cy)->size;
+        break;
+
+    case CTRL_KEY('f'):
+        editorFind(0);
+        break;
+
+    case CTRL_KEY('r'):
+        editorFind(1);
+        break;
+
+    case CTRL_KEY('t'):
+        E.stats.overlay = !E.stats.overlay;
+        E.stats.on = E.stats.overlay;
+        break;
+
+    case PASTE_KEY:
+        editorInsertText(E.input.paste, E.input.pastelen);
+        break;
+
+    case CTRL_KEY('z'):
+        editorUndo();
+        break;
+
+    case CTRL_KEY('y'):
+        editorRedo();
+        break;
+
+    case BACKSPACE:
+    case CTRL_KEY('h'):
+    case DEL_KEY:
+        if (c == DEL_KEY)
+            editorMoveCursor(ARROW_RIGHT);
+        editorDelChar();
+        break;
+
+    case PAGE_UP:
+    case PAGE_DOWN:
+    {
+        editorUndoBreak();
+        // the view follows the cursor at the repaint, which a batch of keys puts off
+        if (E.buf->cy < E.buf->rowoff)
+            E.buf->rowoff = E.buf->cy;
+        else if (E.buf->cy >= E.buf->rowoff + E.screenrows)
+            E.buf->rowoff = E.buf->cy - E.screenrows + 1;
+
+        // a screen up from the top row, or down from the bottom row
+        if (c == PAGE_UP)
+            E.buf->cy = E.buf->rowoff > E.screenrows ? E.buf->rowoff - E.screenrows : 0;
+        else
+        {
+            E.buf->cy = E.buf->rowoff + 2 * E.screenrows - 1;
+            editorLoadUpto(E.buf->cy);
+            if (E.buf->cy > E.buf->numrows)
+                E.buf->cy = E.buf->numrows;
+        }
+
+        int rowlen = E.buf->cy < E.buf->numrows ? editorRowAt(E.buf->cy)->size : 0;
+        if (E.buf->cx > rowlen)
+            E.buf->cx = rowlen;
+    }
+    break;
+
+    case ARROW_UP:
+    case ARROW_DOWN:
+    case ARROW_LEFT:
+    case ARROW_RIGHT:
+        editorUndoBreak();
+        editorMoveCursor(c);
+        break;
+
+    case CTRL_KEY('l'):
+    case '\x1b':
+        break;
+
+    default:
+        editorInsertChar(c);
+        break;
+    }
+
+    quit_times = EDITOR_QUIT_TIMES;
+    close_times = EDITOR_QUIT_TIMES;
+}
+
+/*** init ***/
+
+/**
+ * Initializes the editor by setting the initial values for various editor properties.
+ *
+ * @param None
+ * @return None
+ */
+void initEditor()
+{
+    E.bufs = NULL;
+    E.nbufs = 0;
+    E.buf = editorBufferNew();
+
+    E.rowcache = NULL;
+    E.rowcachelen = 0;
+    E.rowclock = 0;
+    E.rowframe = 0;
+    E.rowcachebytes = 0;
+    memset(&E.arena, 0, sizeof(E.arena));
+
+    E.statusmsg[0] = '\0';
+    E.statusmsg_time = 0;
+
+    E.langs = NULL;
+    E.nlangs = 0;
+    E.langext = NULL;
+    E.langextmask = 0;
+    editorLoadSyntaxes();
+
+    E.screen.ch = NULL;
+    E.screen.attr = NULL;
+    E.shadow.ch = NULL;
+    E.shadow.attr = NULL;
+    E.shadowrowoff = 0;
+    E.shadowcoloff = 0;
+
+    memset(&E.stats, 0, sizeof(E.stats));
+    memset(&E.input, 0, sizeof(E.input));
+    editorEventsInit();
+}
+
+/**
+ * Sizes the editor for a terminal of the given size: two rows are kept for the
+ * status and message bars, the screen cells are reallocated and the row cache is
+ * grown if it could no longer hold two screens of rows.
+ *
+ * @param rows The number of rows of the terminal.
+ * @param cols The number of columns of the terminal.
+ * @return None
+ */
+void editorResize(int rows, int cols)
+{
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+
+    editorScreenAlloc();
+
+    // the cache has to hold at least a full screen of rows, or drawing would recycle them
+    int len = EDITOR_ROW_CACHE;
+    if (len < E.screenrows * 2)
+        len = E.screenrows * 2;
+    if (len <= E.rowcachelen)
+        return;
+
+    E.rowcache = realloc(E.rowcache, len * sizeof(erow));
+    if (E.rowcache == NULL)
+        die("realloc");
+    memset(&E.rowcache[E.rowcachelen], 0, (len - E.rowcachelen) * sizeof(erow));
+    for (int j = E.rowcachelen; j < len; j++)
+        E.rowcache[j].idx = -1;
+    E.rowcachelen = len;
+}
+
+#if !defined(EDITOR_BENCH) && !defined(EDITOR_STRESS)
+int main(int argc, char *argv[])
+{
+    enableRawMode();
+    initEditor();
+    editorWatchWindow();
+    editorWatchMappings();
+
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1)
+        die("getWindowSize");
+    editorResize(rows, cols);
+
+    // set first for an error opening one of the files to take its place
+    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = search | Ctrl-R = regex | Ctrl-Z/Y = undo/redo | Ctrl-O/B/W = open/next/close buffer | Ctrl-T = timings");
+
+    // -f follows the first file as it grows, the others are opened in buffers of their own;
+    // a directory is left as an empty buffer, any other file that can't be opened is fatal
+    int follow = argc >= 3 && strcmp(argv[1], "-f") == 0;
+    if (argc >= 2 + follow)
+    {
+        if (follow)
+        {
+            if (editorFollowStart(argv[2]) == -1 && errno != EISDIR)
+                die("open");
+        }
+        else if (editorOpen(argv[1]) == -1 && errno != EISDIR)
+            die("open");
+    }
+    for (int i = 2 + follow; i < argc; i++)
+    {
+        editorBufferShow(editorBufferNew());
+        if (editorOpen(argv[i]) == -1 && errno != EISDIR)
+            die("open");
+    }
+    editorBufferShow(E.bufs[0]);
+
+    while (1)
+    {
+        editorRefreshScreen();
+        // the keys that came with this one, or before the next frame is due, are
+        // handled before the next repaint
+        do
+            editorProcessKeypress();
+        while (editorKeysPending() || editorFrameWait());
+    }
+
+    return EXIT_SUCCESS;
+}
+#endif
+
+/*** benchmark ***/
+
+#ifdef EDITOR_BENCH
+
+#define BENCH_ROWS 60
+#define BENCH_COLS 160
+#define BENCH_SYNTHETIC_LINES 200000
+
+/**
+ * @struct benchScript
+ * @brief A keystroke sequence replayed by the benchmark.
+ */
+struct benchScript
+{
+    const char *name; ///< The name the results are reported under.
+    const char *keys; ///< The keystrokes of one repetition.
+    int repeat;       ///< The number of repetitions.
+};
+
+struct benchScript benchScripts[] = {
+    {"scroll", "\x1b[6~\x1b[6~\x1b[6~\x1b[5~\x1b[B\x1b[B\x1b[B\x1b[B", 60},
+    {"type", "int x = 42; /* note */ s = \"str\";\r", 100},
+    {"comment", "/*\x7f\x7f", 200},
+    {"search", "\x06return\x1b[B\x1b[B\x1b[B\x1b[B\x1b[B\x1b[B\x1b[B\x1b[B\r", 20},
+    {"paste", "\x1b[200~int pasted(int a)\r{\r\treturn a + 1; /* pasted */\r}\r\r\x1b[201~\x1b[B", 200},
+};
+
+#define BENCH_SCRIPTS (sizeof(benchScripts) / sizeof(benchScripts[0]))
+
+/**
+ * The allocation counter fed by the wrapped allocator entry points; the bench
+ * target links with -Wl,--wrap for malloc, calloc and realloc.
+ */
+size_t benchAllocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+/**
+ * Counts an allocation and forwards it to malloc.
+ *
+ * @param size The size of the allocation.
+ * @return The allocated memory.
+ */
+void *__wrap_malloc(size_t size)
+{
+    benchAllocs++;
+    return __real_malloc(size);
+}
+
+/**
+ * Counts an allocation and forwards it to calloc.
+ *
+ * @param nmemb The number of elements.
+ * @param size The size of an element.
+ * @return The allocated memory.
+ */
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    benchAllocs++;
+    return __real_calloc(nmemb, size);
+}
+
+/**
+ * Counts an allocation and forwards it to realloc.
+ *
+ * @param ptr The memory to resize.
+ * @param size The new size.
+ * @return The reallocated memory.
+ */
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    benchAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+/**
+ * Compares two doubles for qsort.
+ *
+ * @param a The first double.
+ * @param b The second double.
+ * @return Negative, zero or positive as a is smaller, equal or larger than b.
+ */
+int benchCompare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns a percentile of a set of samples, sorting them.
+ *
+ * @param v The samples.
+ * @param n The number of samples.
+ * @param p The percentile, between 0 and 100.
+ * @return The percentile.
+ */
+double benchPercentile(double *v, int n, int p)
+{
+    if (n == 0)
+        return 0;
+    qsort(v, n, sizeof(double), benchCompare);
+    return v[(long)(n - 1) * p / 100];
+}
+
+/**
+ * Writes a synthetic C file mixing keywords, numbers, strings and both kinds of comments.
+ *
+ * @param path The template of the path, ending in XXXXXX.c; it is filled in.
+ * @return None
+ */
+void benchSynthetic(char *path)
+{
+    int fd = mkstemps(path, 2);
+    if (fd == -1)
+        die("mkstemps");
+    const char *lines[] = {
+        "/* block comment %d\n",
+        " * continued */\n",
+        "static int f%d(int a, char *s)\n",
+        "{\n",
+        "\tif (a > %d)\n",
+        "\t\treturn a * 3.5; // line comment\n",
+        "\ts = \"string %d with \\\"escapes\\\"\";\n",
+        "\twhile (a--) { unsigned long x = a + %d; }\n",
+        "}\n",
+        "\n",
+    };
+
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < BENCH_SYNTHETIC_LINES; i++)
+        fprintf(fp, lines[i % 10], i);
+    fclose(fp);
+}
+
+/**
+ * Runs one script against a file in a child process, so every run starts from a
+ * freshly opened editor. The keystrokes are read from a temporary file standing in
+ * for the terminal input, and the output goes to /dev/null. Reports the frame
+ * latencies, the keystroke latencies, the bytes written and the allocations made
+ * per frame on the given descriptor.
+ *
+ * @param out The descriptor to report on.
+ * @param path The file to edit.
+ * @param script The script to replay, or NULL to time opening and highlighting the file.
+ * @return None
+ */
+void benchRun(int out, const char *path, struct benchScript *script)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1)
+        die("fork");
+    if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    size_t keyslen = 0;
+    if (script)
+    {
+        FILE *keys = tmpfile();
+        for (int i = 0; i < script->repeat; i++)
+            fputs(script->keys, keys);
+        fflush(keys);
+        keyslen = ftell(keys);
+        rewind(keys);
+        dup2(fileno(keys), STDIN_FILENO);
+    }
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+
+    initEditor();
+    editorResize(BENCH_ROWS, BENCH_COLS);
+    E.stats.on = 1;
+    editorOpen((char *)path);
+    editorLoadFinish();
+
+    if (script == NULL)
+    {
+        hlJobCancel();
+        // lexing every byte, as the skippers must agree with
+        hlSkipFn skip = E.buf->syntax ? E.buf->syntax->skip : NULL;
+        if (E.buf->syntax)
+            E.buf->syntax->skip = NULL;
+        double start = editorNow();
+        editorSyntaxUpto(E.buf->numrows);
+        double bytewise = editorNow() - start;
+        if (E.buf->syntax)
+            E.buf->syntax->skip = skip;
+
+        E.buf->hlvalid = E.buf->hlstale = 0;
+        start = editorNow();
+        editorSyntaxUpto(E.buf->numrows);
+        double full = editorNow() - start;
+
+        E.buf->hlvalid = E.buf->hlstale = 0;
+        start = editorNow();
+        hlJobStart();
+        hlJobFinish();
+        dprintf(out, "%s: %d lines, open %.2f ms, full highlight %.2f ms (%.2f ms byte by byte), background %.2f ms\n",
+                path, E.buf->numrows, E.stats.open, full, bytewise, editorNow() - start);
+        exit(0);
+    }
+    // the frames are timed once the rows are highlighted
+    hlJobFinish();
+
+    int cap = 1024, n = 0;
+    double *frame = malloc(cap * sizeof(double));
+    double *key = malloc(cap * sizeof(double));
+    long bytes = 0;
+    size_t allocs = 0;
+
+    while ((size_t)lseek(STDIN_FILENO, 0, SEEK_CUR) < keyslen || editorKeysPending())
+    {
+        if (n == cap)
+        {
+            cap *= 2;
+            frame = realloc(frame, cap * sizeof(double));
+            key = realloc(key, cap * sizeof(double));
+        }
+        size_t before = benchAllocs;
+        double start = editorNow();
+        editorRefreshScreen();
+        double drawn = editorNow();
+        // one key a frame, as typed keys come
+        editorProcessKeypress();
+        frame[n] = drawn - start;
+        key[n] = editorNow() - drawn;
+        bytes += E.stats.bytes;
+        allocs += benchAllocs - before;
+        n++;
+    }
+
+    double f50 = benchPercentile(frame, n, 50), f99 = benchPercentile(frame, n, 99);
+    double k50 = benchPercentile(key, n, 50), k99 = benchPercentile(key, n, 99);
+    dprintf(out, "  %-8s %6d frames  frame p50 %7.3f p99 %7.3f ms  key p50 %7.3f p99 %7.3f ms"
+                 "  %7ld B/frame  %6.1f allocs/frame\n",
+            script->name, n, f50, f99, k50, k99, n ? bytes / n : 0, n ? (double)allocs / n : 0);
+    exit(0);
+}
+
+/**
+ * Runs every script against a synthetic file and each file of the command line,
+ * on a BENCH_ROWS x BENCH_COLS screen.
+ *
+ * @param argc The number of arguments.
+ * @param argv The files to benchmark besides the synthetic one.
+ * @return EXIT_SUCCESS.
+ */
+int main(int argc, char *argv[])
+{
+    int out = dup(STDOUT_FILENO);
+    char synthetic[] = "/tmp/editor-bench-XXXXXX.c";
+    benchSynthetic(synthetic);
+
+    dprintf(out, "screen %dx%d\n", BENCH_ROWS, BENCH_COLS);
+    for (int i = 0; i < argc; i++)
+    {
+        const char *path = i == 0 ? synthetic : argv[i];
+        benchRun(out, path, NULL);
+        for (unsigned int j = 0; j < BENCH_SCRIPTS; j++)
+            benchRun(out, path, &benchScripts[j]);
+    }
+
+    unlink(synthetic);
+    return EXIT_SUCCESS;
+}
+
+#endif
+
+/*** stress ***/
+
+#ifdef EDITOR_STRESS
+
+#define STRESS_ROWS 40
+#define STRESS_COLS 120
+#define STRESS_EDIT_BYTES (3 << 20) // the size of the file the random edits start from
+#define STRESS_ROUND 10000          // edits between two comparisons with the model
+#define STRESS_SAMPLES 512          // rows compared one by one at the end of a round
+#define STRESS_CHUNK (1 << 20)      // bytes compared at a time with a file
+#define STRESS_METRICS 32
+
+/**
+ * @struct stressModel
+ * @brief The reference model of the document: a gap buffer, which knows the line and
+ * the column of its gap.
+ */
+struct stressModel
+{
+    char *buf;     ///< The text, with the gap in the middle.
+    size_t cap;    ///< The size of buf.
+    size_t gap;    ///< The offset of the gap, where edits happen.
+    size_t gapend; ///< The offset of the text after the gap.
+    size_t lines;  ///< The number of newlines of the text.
+    int line;      ///< The index of the line of the gap.
+    int col;       ///< The column of the gap in its line.
+};
+
+/**
+ * @struct stressMetric
+ * @brief A number of the report.
+ */
+struct stressMetric
+{
+    char name[32]; ///< The name it is reported and looked up in the baseline under.
+    double value;  ///< The value.
+};
+
+struct stressMetric stressMetrics[STRESS_METRICS];
+int stressNmetrics = 0;
+
+uint64_t stressSeed = 1;         ///< The state of the random generator.
+long stressOps = 1000000;        ///< The number of random edits.
+size_t stressLines = 0;          ///< The number of lines of the large file.
+size_t stressBytes = 1024 << 20; ///< The size of the large file.
+
+/**
+ * Returns the next number of a xorshift64* sequence, the same on every platform for a seed.
+ *
+ * @param None
+ * @return The number.
+ */
+uint64_t stressRandom()
+{
+    stressSeed ^= stressSeed >> 12;
+    stressSeed ^= stressSeed << 25;
+    stressSeed ^= stressSeed >> 27;
+    return stressSeed * 2685821657736338717ULL;
+}
+
+/**
+ * Counts the newlines of a text.
+ *
+ * @param s The text.
+ * @param n The length of the text.
+ * @return The number of newlines.
+ */
+size_t stressNewlines(const char *s, size_t n)
+{
+    size_t count = 0;
+    for (const char *end = s + n; (s = memchr(s, '\n', end - s)) != NULL; s++)
+        count++;
+    return count;
+}
+
+/**
+ * Returns the length of the text of the model.
+ *
+ * @param m The model.
+ * @return The length.
+ */
+size_t stressLength(struct stressModel *m)
+{
+    return m->cap - m->gapend + m->gap;
+}
+
+/**
+ * Computes the column of the gap of the model from the text before it.
+ *
+ * @param m The model.
+ * @return None
+ */
+void stressColumn(struct stressModel *m)
+{
+    const char *nl = memrchr(m->buf, '\n', m->gap);
+    m->col = m->gap - (nl ? (size_t)(nl - m->buf) + 1 : 0);
+}
+
+/**
+ * Moves the gap of the model to an offset of the text.
+ *
+ * @param m The model.
+ * @param off The offset.
+ * @return None
+ */
+void stressMove(struct stressModel *m, size_t off)
+{
+    if (off < m->gap)
+    {
+        size_t n = m->gap - off;
+        m->line -= stressNewlines(m->buf + off, n);
+        memmove(m->buf + m->gapend - n, m->buf + off, n);
+        m->gap -= n;
+        m->gapend -= n;
+    }
+    else if (off > m->gap)
+    {
+        size_t n = off - m->gap;
+        m->line += stressNewlines(m->buf + m->gapend, n);
+        memmove(m->buf + m->gap, m->buf + m->gapend, n);
+        m->gap += n;
+        m->gapend += n;
+    }
+    stressColumn(m);
+}
+
+/**
+ * Inserts text at the gap of the model, which ends up after it.
+ *
+ * @param m The model.
+ * @param s The text.
+ * @param n The length of the text.
+ * @return None
+ */
+void stressInsert(struct stressModel *m, const char *s, size_t n)
+{
+    if (m->gapend - m->gap < n)
+    {
+        size_t cap = m->cap * 2 + n, tail = m->cap - m->gapend;
+        m->buf = realloc(m->buf, cap);
+        if (m->buf == NULL)
+            die("realloc");
+        memmove(m->buf + cap - tail, m->buf + m->gapend, tail);
+        m->gapend = cap - tail;
+        m->cap = cap;
+    }
+    memcpy(m->buf + m->gap, s, n);
+    m->gap += n;
+    size_t nl = stressNewlines(s, n);
+    m->line += nl;
+    m->lines += nl;
+    stressColumn(m);
+}
+
+/**
+ * Deletes text after the gap of the model.
+ *
+ * @param m The model.
+ * @param n The number of bytes to delete.
+ * @return None
+ */
+void stressDelete(struct stressModel *m, size_t n)
+{
+    m->lines -= stressNewlines(m->buf + m->gapend, n);
+    m->gapend += n;
+}
+
+/**
+ * Deletes the byte before the gap of the model.
+ *
+ * @param m The model.
+ * @return None
+ */
+void stressBackspace(struct stressModel *m)
+{
+    m->gap--;
+    if (m->buf[m->gap] == '\n')
+    {
+        m->line--;
+        m->lines--;
+        stressColumn(m);
+    }
+    else
+        m->col--;
+}
+
+/**
+ * Copies the text of the model.
+ *
+ * @param m The model.
+ * @return The text, of stressLength() bytes, to be freed by the caller.
+ */
+char *stressText(struct stressModel *m)
+{
+    char *text = malloc(stressLength(m) + 1);
+    memcpy(text, m->buf, m->gap);
+    memcpy(text + m->gap, m->buf + m->gapend, m->cap - m->gapend);
+    return text;
+}
+
+/**
+ * Adds a number to the report.
+ *
+ * @param out The descriptor the phase reports on.
+ * @param name The name of the number.
+ * @param value The value.
+ * @return None
+ */
+void stressReport(int out, const char *name, double value)
+{
+    dprintf(out, "%s %.3f\n", name, value);
+}
+
+/**
+ * Tells of a difference between the editor and what it should hold.
+ *
+ * @param what The difference.
+ * @param round The round of edits it was found in, or -1.
+ * @return 1, the number of mismatches it counts for.
+ */
+int stressMismatch(const char *what, long round)
+{
+    if (round >= 0)
+        fprintf(stderr, "stress: round %ld: %s\n", round, what);
+    else
+        fprintf(stderr, "stress: %s\n", what);
+    return 1;
+}
+
+/**
+ * Writes a synthetic C file mixing keywords, numbers, strings and both kinds of comments.
+ *
+ * @param path The template of the path, ending in XXXXXX.c; it is filled in.
+ * @param bytes The size the file reaches at least.
+ * @return The number of lines of the file.
+ */
+size_t stressSynthetic(char *path, size_t bytes)
+{
+    int fd = mkstemps(path, 2);
+    if (fd == -1)
+        die("mkstemps");
+    const char *lines[] = {
+        "/* block comment %zu\n",
+        " * continued */\n",
+        "static int f%zu(int a, char *s)\n",
+        "{\n",
+        "\tif (a > %zu)\n",
+        "\t\treturn a * 3.5; // line comment\n",
+        "\ts = \"string %zu with \\\"escapes\\\"\";\n",
+        "\twhile (a--) { unsigned long x = a + %zu; }\n",
+        "}\n",
+        "\n",
+    };
+
+    FILE *fp = fdopen(fd, "w");
+    size_t n = 0, written = 0;
+    while (written < bytes)
+    {
+        written += fprintf(fp, lines[n % 10], n);
+        n++;
+    }
+    if (fclose(fp) != 0)
+        die("fclose");
+    return n;
+}
+
+/**
+ * Compares the document of the buffer shown with a text.
+ *
+ * @param text The text.
+ * @param len The length of the text.
+ * @param lines The number of newlines of the text.
+ * @return Whether they are the same.
+ */
+int stressSame(const char *text, size_t len, size_t lines)
+{
+    if (ptLength(&E.buf->pt) != len || (size_t)E.buf->numrows != lines)
+        return 0;
+    char *doc = malloc(STRESS_CHUNK);
+    int same = 1;
+    for (size_t off = 0; same && off < len; off += STRESS_CHUNK)
+    {
+        size_t n = len - off < STRESS_CHUNK ? len - off : STRESS_CHUNK;
+        ptCopy(&E.buf->pt, off, n, doc);
+        same = memcmp(doc, text + off, n) == 0;
+    }
+    free(doc);
+    return same;
+}
+
+/**
+ * Compares the document of the buffer shown with a file, a chunk at a time.
+ *
+ * @param path The file.
+ * @return Whether they are the same.
+ */
+int stressSameFile(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || (size_t)st.st_size != ptLength(&E.buf->pt))
+    {
+        if (fd != -1)
+            close(fd);
+        return 0;
+    }
+
+    char *doc = malloc(STRESS_CHUNK), *file = malloc(STRESS_CHUNK);
+    size_t len = st.st_size;
+    int same = 1;
+    for (size_t off = 0; same && off < len; off += STRESS_CHUNK)
+    {
+        size_t n = len - off < STRESS_CHUNK ? len - off : STRESS_CHUNK;
+        ptCopy(&E.buf->pt, off, n, doc);
+        same = pread(fd, file, n, off) == (ssize_t)n && memcmp(doc, file, n) == 0;
+    }
+    free(doc);
+    free(file);
+    close(fd);
+    return same;
+}
+
+/**
+ * Tells whether a character ends a word, as the original editorUpdateSyntax did.
+ *
+ * @param c The character.
+ * @return Whether it is a separator.
+ */
+int stressSeparator(int c)
+{
+    return isspace(c) || c == '\0' || strchr(EDITOR_SEPARATORS, c) != NULL;
+}
+
+/**
+ * Renders a line as the original editor did, expanding its tabs to the next
+ * multiple of EDITOR_TAB_STOP columns.
+ *
+ * @param s The line.
+ * @param len The length of the line.
+ * @param render The render, grown as needed and NUL-terminated, as the reference lexer reads past its end.
+ * @param cap The capacity of render.
+ * @return The number of columns of the render.
+ */
+int stressRender(const char *s, size_t len, char **render, size_t *cap)
+{
+    size_t tabs = 0;
+    for (size_t i = 0; i < len; i++)
+        tabs += s[i] == '\t';
+    if (len + tabs * (EDITOR_TAB_STOP - 1) + 1 > *cap)
+    {
+        *cap = (len + tabs * (EDITOR_TAB_STOP - 1) + 1) * 2;
+        *render = realloc(*render, *cap);
+        if (*render == NULL)
+            die("realloc");
+    }
+
+    int n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '\t')
+        {
+            int stop = editorTabStop(n);
+            while (n < stop)
+                (*render)[n++] = ' ';
+        }
+        else
+            (*render)[n++] = s[i];
+    }
+    (*render)[n] = '\0';
+    return n;
+}
+
+/**
+ * The reference the highlighting is compared with: the editorUpdateSyntax of the
+ * original editor, which lexed the whole render of every row byte by byte, ported to
+ * work on a render of the model with the syntax of the buffer shown.
+ *
+ * @param render The render of the line, NUL-terminated.
+ * @param rsize The number of columns of the render.
+ * @param in_comment Whether the line starts inside a multi-line comment.
+ * @param hl The highlight of every column, of rsize bytes.
+ * @return Whether the line ends inside a multi-line comment.
+ */
+int stressUpdateSyntax(const char *render, int rsize, int in_comment, unsigned char *hl)
+{
+    memset(hl, HL_NORMAL, rsize);
+    struct editorSyntax *syntax = E.buf->syntax;
+    char **keywords = syntax->keywords;
+
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int prev_sep = 1;
+    int in_string = 0;
+
+    int i = 0;
+    while (i < rsize)
+    {
+        char c = render[i];
+        unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
+
+        if (scs_len && !in_string && !in_comment)
+        {
+            if (!strncmp(&render[i], scs, scs_len))
+            {
+                memset(&hl[i], HL_COMMENT, rsize - i);
+                break;
+            }
+        }
+
+        if (mcs_len && mce_len && !in_string)
+        {
+            if (in_comment)
+            {
+                hl[i] = HL_MLCOMMENT;
+                if (!strncmp(&render[i], mce, mce_len))
+                {
+                    memset(&hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
+                }
+                else
+                {
+                    i++;
+                    continue;
+                }
+            }
+            else if (!strncmp(&render[i], mcs, mcs_len))
+            {
+                memset(&hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_STRINGS)
+        {
+            if (in_string)
+            {
+                hl[i] = HL_STRING;
+                if (c == '\\' && i + 1 < rsize)
+                {
+                    hl[i + 1] = HL_STRING;
+                    i += 2;
+                    continue;
+                }
+                if (c == in_string)
+                    in_string = 0;
+                i++;
+                prev_sep = 1;
+                continue;
+            }
+            else
+            {
+                if (c == '"' || c == '\'')
+                {
+                    in_string = c;
+                    hl[i] = HL_STRING;
+                    i++;
+                    continue;
+                }
+            }
         }
-        else if (c == '\r')
+
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS)
         {
-            if (buflen != 0)
+            if ((isdigit((unsigned char)c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER))
             {
-                editorSetStatusMessage("");
-                if (callback)
-                    callback(buf, c);
-                return buf;
+                hl[i] = HL_NUMBER;
+                i++;
+                prev_sep = 0;
+                continue;
             }
         }
-        else if (!iscntrl(c) && c < 128)
+
+        if (prev_sep)
         {
-            if (buflen == bufsize - 1)
+            int j;
+            for (j = 0; keywords[j]; j++)
             {
-                bufsize *= 2;
-                buf = realloc(buf, bufsize);
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+                if (kw2)
+                    klen--;
+                if (!strncmp(&render[i], keywords[j], klen) && stressSeparator((unsigned char)render[i + klen]))
+                {
+                    memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+                    i += klen;
+                    break;
+                }
+            }
+            if (keywords[j] != NULL)
+            {
+                prev_sep = 0;
+                continue;
             }
-            buf[buflen++] = c;
-            buf[buflen] = '\0';
         }
 
-        if (callback)
-            callback(buf, c);
+        prev_sep = stressSeparator((unsigned char)c);
+        i++;
     }
+
+    return in_comment;
 }
 
 /**
- * Moves the cursor based on the keypress.
+ * Compares the highlighting of a row of the buffer shown with the reference, over the
+ * columns it was rendered for: the whole row, or the window in view of a long row.
  *
- * @param key The key that was pressed.
- * @return None
+ * @param row The row, rendered.
+ * @param ref The highlight of every column of the row by the reference.
+ * @return Whether they are the same.
  */
-void editorMoveCursor(int key)
+int stressSameSpans(erow *row, const unsigned char *ref)
 {
-    // Get the current row
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    int ra = row->ntabs ? row->rstart : row->hla;
+    int rb = row->ntabs ? row->rstart + row->rsize : row->hlb;
+    if (rb <= ra)
+        return 1;
+
+    unsigned char *got = malloc(rb - ra);
+    memset(got, HL_NORMAL, rb - ra);
+    for (int k = 0; k < row->nspans; k++)
+    {
+        int a = row->spans[k].start, b = a + row->spans[k].len;
+        if (a < ra)
+            a = ra;
+        if (b > rb)
+            b = rb;
+        if (a < b)
+            memset(&got[a - ra], row->spans[k].hl, b - a);
+    }
+    int same = memcmp(got, &ref[ra], rb - ra) == 0;
+    free(got);
+    return same;
+}
 
-    switch (key)
+/**
+ * Compares the buffer shown with the model: the whole text, a sample of the rows the
+ * row cache builds and, against the original editorUpdateSyntax run on the model,
+ * the multi-line comment state of every row and the highlight of every column of the
+ * sampled rows. The sample takes random rows, the last rows of the file and, at
+ * random windows, the rows longer than EDITOR_LONG_LINE.
+ *
+ * @param m The model.
+ * @param round The round of edits.
+ * @return The number of mismatches found.
+ */
+int stressVerify(struct stressModel *m, long round)
+{
+    int bad = 0;
+    size_t len = stressLength(m);
+    char *text = stressText(m);
+    if (!stressSame(text, len, m->lines))
     {
-    case ARROW_LEFT:
-        // Move cursor left if not at the beginning of the line
-        if (E.cx != 0)
-            E.cx--;
-        // Move cursor to the end of the previous line if at the beginning of the current line
-        else if (E.cy > 0)
+        free(text);
+        return stressMismatch("the text differs from the model", round);
+    }
+
+    size_t *starts = malloc((m->lines + 1) * sizeof(size_t));
+    starts[0] = 0;
+    for (size_t i = 0, n = 1; i < len; i++)
+        if (text[i] == '\n')
+            starts[n++] = i + 1;
+
+    // the state every row ends in by the reference, as the sampled rows start in it
+    char *render = NULL;
+    size_t rendercap = 0, hlcap = 0;
+    unsigned char *hl = NULL, *ref = NULL;
+    if (E.buf->syntax)
+    {
+        hlJobFinish();
+        editorSyntaxUpto(E.buf->numrows);
+        ref = malloc(m->lines);
+        int in = 0, wrong = 0;
+        for (size_t at = 0; at < m->lines; at++)
         {
-            E.cy--;
-            E.cx = E.row[E.cy].size;
+            int rsize = stressRender(text + starts[at], starts[at + 1] - starts[at] - 1, &render, &rendercap);
+            if ((size_t)rsize > hlcap)
+                hl = realloc(hl, hlcap = rsize * 2);
+            ref[at] = in = stressUpdateSyntax(render, rsize, in, hl);
+            if (!wrong && (E.buf->hlstate[at] & HL_STATE_COMMENT) != in)
+                wrong = 1;
         }
-        break;
-    case ARROW_RIGHT:
-        // Move cursor right if not at the end of the line
-        if (row && E.cx < row->size)
-            E.cx++;
-        // Move cursor to the beginning of the next line if at the end of the current line
-        else if (row && E.cx == row->size)
+        if (wrong)
+            bad += stressMismatch("a row ends in the wrong comment state", round);
+    }
+
+    int nsamples = STRESS_SAMPLES, *samples = malloc((STRESS_SAMPLES + 64 + 8) * sizeof(int));
+    for (int i = 0; i < STRESS_SAMPLES; i++)
+        samples[i] = stressRandom() % m->lines;
+    for (int i = 0; i < 64 && (size_t)i < m->lines; i++)
+        samples[nsamples++] = m->lines - 1 - i;
+    for (size_t at = 0, n = 0; at < m->lines && n < 8; at++)
+        if (starts[at + 1] - starts[at] - 1 > EDITOR_LONG_LINE)
+            samples[nsamples++] = at, n++;
+
+    int rowbad = 0, hlbad = 0;
+    for (int i = 0; i < nsamples && !(rowbad && hlbad); i++)
+    {
+        int at = samples[i];
+        size_t size = starts[at + 1] - starts[at] - 1;
+        erow *row = editorRowAt(at);
+        if ((size_t)row->size != size || memcmp(row->chars, text + starts[at], size) != 0)
         {
-            E.cy++;
-            E.cx = 0;
+            rowbad = 1;
+            continue;
         }
-        break;
-    case ARROW_UP:
-        // Move cursor up if not at the top row
-        if (E.cy != 0)
-            E.cy--;
-        break;
-    case ARROW_DOWN:
-        // Move cursor down if not at the bottom row
-        if (E.cy < E.numrows)
-            E.cy++;
-        break;
+        if (ref == NULL || hlbad)
+            continue;
+
+        int rsize = stressRender(text + starts[at], size, &render, &rendercap);
+        if ((size_t)rsize > hlcap)
+            hl = realloc(hl, hlcap = rsize * 2);
+        stressUpdateSyntax(render, rsize, at > 0 ? ref[at - 1] : 0, hl);
+
+        // a long row is highlighted for the window in view
+        int coloff = E.buf->coloff;
+        if (size > EDITOR_LONG_LINE)
+            E.buf->coloff = stressRandom() % rsize;
+        editorRowRender(row);
+        hlbad = !stressSameSpans(row, hl);
+        E.buf->coloff = coloff;
     }
+    if (rowbad)
+        bad += stressMismatch("a row differs from its line", round);
+    if (hlbad)
+        bad += stressMismatch("a row is highlighted otherwise than by the original editor", round);
+
+    free(samples);
+    free(render);
+    free(hl);
+    free(ref);
+    free(starts);
+    free(text);
+    return bad;
+}
 
-    // Update the current row and its length
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-    int rowlen = row ? row->size : 0;
-
-    // Adjust the cursor position if it exceeds the row length
-    if (E.cx > rowlen)
-        E.cx = rowlen;
+/**
+ * Picks a random piece of C to insert: a few tokens, or rarely a line longer than
+ * EDITOR_LONG_LINE.
+ *
+ * @param s Where the piece is written, of at least EDITOR_LONG_LINE + 4097 bytes.
+ * @return The length of the piece.
+ */
+size_t stressPiece(char *s)
+{
+    static const char *tokens[] = {
+        "int ", "x", " = ", "42", ";", "\n", "\n", "\t", "/*", "*/", "\"", "\\",
+        "// c", "{", "}", "'", "return ", "a * b", "  ", "3.5",
+    };
+    if (stressRandom() % 5000 == 0)
+    {
+        size_t n = EDITOR_LONG_LINE + stressRandom() % 4096;
+        memset(s, 'y', n);
+        return n;
+    }
+    size_t n = 0;
+    for (int k = 1 + stressRandom() % 6; k > 0; k--)
+    {
+        const char *t = tokens[stressRandom() % (sizeof(tokens) / sizeof(tokens[0]))];
+        size_t len = strlen(t);
+        memcpy(s + n, t, len);
+        n += len;
+    }
+    return n;
 }
 
 /**
- * Waits for a keypress and handles it.
+ * Applies random edits to a file through the entry points of the editor and the same
+ * edits to the model, going through inserts and deletes of the buffer, typed keys,
+ * pastes, backspaces and repaints at a random walk of positions. Every STRESS_ROUND
+ * edits the buffer is compared with the model; every fourth round the highlighting is
+ * redone by the background job first, and the edits of the round are undone, compared
+ * with the text the round started from, and redone. The file is saved at the end and
+ * compared with the model. The last byte, a newline, is never edited.
  *
- * @param None
+ * @param out The descriptor to report on.
+ * @param path The file.
  * @return None
  */
-void editorProcessKeypress()
+void stressEdit(int out, const char *path)
 {
-    static int quit_times = EDITOR_QUIT_TIMES;
-
-    int c = editorReadKey();
-
-    switch (c)
+    initEditor();
+    editorResize(STRESS_ROWS, STRESS_COLS);
+    editorOpen((char *)path);
+    editorLoadFinish();
+
+    struct stressModel m = {0};
+    size_t len = ptLength(&E.buf->pt), spare = 1 << 20;
+    m.cap = len + spare;
+    m.buf = malloc(m.cap);
+    ptCopy(&E.buf->pt, 0, len, m.buf + spare);
+    m.gapend = spare;
+    m.lines = stressNewlines(m.buf + spare, len);
+
+    char *piece = malloc(EDITOR_LONG_LINE + 4097);
+    char *snapshot = NULL;
+    size_t snaplen = 0, snaplines = 0;
+    int bad = 0;
+    double elapsed = 0;
+
+    for (long i = 0; i < stressOps; i++)
     {
-    case '\r':
-        editorInsertNewLine();
-        break;
-
-    case CTRL_KEY('q'):
-        if (E.modified && quit_times > 0)
+        len = stressLength(&m);
+        size_t off = m.gap;
+        if (stressRandom() % 1000 == 0)
+            off = stressRandom() % (len - 1);
+        else
         {
-            editorSetStatusMessage("WARNING!!! File has unsaved changes. "
-                                   "Press Ctrl-Q %d more times to quit.",
-                                   quit_times);
-            quit_times--;
-            return;
+            long step = (long)(stressRandom() % 401) - 200;
+            if (step < 0 && (size_t)-step > off)
+                off = 0;
+            else if (off + step > len - 1)
+                off = len - 1;
+            else
+                off += step;
         }
+        stressMove(&m, off);
 
-        write(STDOUT_FILENO, "\x1b[2J", 4);
-        write(STDOUT_FILENO, "\x1b[H", 3);
-        exit(0);
-        break;
-
-    case CTRL_KEY('s'):
-        editorSave();
-        break;
+        int op = stressRandom() % 100;
+        size_t n = 0;
+        if (op < 75)
+            n = stressPiece(piece);
 
-    case HOME_KEY:
-        E.cx = 0;
-        break;
+        double start = editorNow();
+        int keys = 0;
+        if (op < 45)
+        {
+            editorBufferInsert(m.line, m.col, piece, n);
+            stressInsert(&m, piece, n);
+        }
+        else if (op < 65)
+        {
+            E.buf->cy = m.line;
+            E.buf->cx = m.col;
+            for (size_t j = 0; j < n; j++)
+            {
+                if (piece[j] == '\n')
+                    editorInsertNewLine();
+                else
+                    editorInsertChar(piece[j]);
+            }
+            stressInsert(&m, piece, n);
+            keys = 1;
+        }
+        else if (op < 75)
+        {
+            E.buf->cy = m.line;
+            E.buf->cx = m.col;
+            editorInsertText(piece, n);
+            stressInsert(&m, piece, n);
+            keys = 1;
+        }
+        else if (op < 92)
+        {
+            n = stressRandom() % 2000 == 0 ? stressRandom() % (EDITOR_LONG_LINE * 2) : 1 + stressRandom() % 64;
+            if (n > len - 1 - off)
+                n = len - 1 - off;
+            editorBufferDelete(m.line, m.col, n);
+            stressDelete(&m, n);
+        }
+        else if (off > 0)
+        {
+            E.buf->cy = m.line;
+            E.buf->cx = m.col;
+            editorDelChar();
+            stressBackspace(&m);
+            keys = 1;
+        }
 
-    case END_KEY:
-        if (E.cy < E.numrows)
-            E.cx = E.row[E.cy].size;
-        break;
+        if (i % 16 == 0)
+        {
+            E.buf->cy = m.line;
+            E.buf->cx = m.col;
+            editorRefreshScreen();
+        }
+        if (i % 256 == 0)
+            hlJobIdle();
+        elapsed += editorNow() - start;
 
-    case CTRL_KEY('f'):
-        editorFind();
-        break;
+        if (keys && (E.buf->cy != m.line || E.buf->cx != m.col))
+            bad += stressMismatch("the cursor is not where the edit ended", i / STRESS_ROUND);
+        if ((size_t)E.buf->numrows != m.lines)
+        {
+            bad += stressMismatch("the number of rows differs from the model", i / STRESS_ROUND);
+            break;
+        }
 
-    case BACKSPACE:
-    case CTRL_KEY('h'):
-    case DEL_KEY:
-        if (c == DEL_KEY)
-            editorMoveCursor(ARROW_RIGHT);
-        editorDelChar();
-        break;
+        if ((i + 1) % STRESS_ROUND != 0 && i + 1 != stressOps)
+            continue;
 
-    case PAGE_UP:
-    case PAGE_DOWN:
-    {
-        if (c == PAGE_UP)
-            E.cy = E.rowoff;
-        else if (c == PAGE_DOWN)
+        long round = i / STRESS_ROUND;
+        if (round % 4 == 0)
         {
-            E.cy = E.rowoff + E.screenrows - 1;
-            if (E.cy > E.numrows)
-                E.cy = E.numrows;
+            hlJobCancel();
+            E.buf->hlvalid = E.buf->hlstale = 0;
+            hlJobStart();
         }
+        bad += stressVerify(&m, round);
 
-        int times = E.screenrows;
-        while (times--)
-            editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+        if (snapshot)
+        {
+            while (E.buf->undo.cur > 0)
+                editorUndo();
+            if (!stressSame(snapshot, snaplen, snaplines))
+                bad += stressMismatch("undoing the round does not give back its text", round);
+            while (E.buf->undo.cur < E.buf->undo.len)
+                editorRedo();
+            free(snapshot);
+            snapshot = NULL;
+            bad += stressVerify(&m, round);
+        }
+        if (round % 4 == 3)
+        {
+            editorUndoReset();
+            snapshot = stressText(&m);
+            snaplen = stressLength(&m);
+            snaplines = m.lines;
+        }
     }
-    break;
-
-    case ARROW_UP:
-    case ARROW_DOWN:
-    case ARROW_LEFT:
-    case ARROW_RIGHT:
-        editorMoveCursor(c);
-        break;
-
-    case CTRL_KEY('l'):
-    case '\x1b':
-        break;
 
-    default:
-        editorInsertChar(c);
-        break;
-    }
+    // the undo journal keeps the text of the deleted long lines alive
+    editorUndoReset();
+    editorSave();
+    editorSaveWait();
+    len = stressLength(&m);
+    char *text = stressText(&m);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    char *file = malloc(len + 1);
+    if (fd == -1 || fstat(fd, &st) == -1 || (size_t)st.st_size != len || pread(fd, file, len, 0) != (ssize_t)len ||
+        memcmp(file, text, len) != 0)
+        bad += stressMismatch("the saved file differs from the model", -1);
+    if (fd != -1)
+        close(fd);
 
-    quit_times = EDITOR_QUIT_TIMES;
+    stressReport(out, "mismatches", bad);
+    stressReport(out, "edit_ops", stressOps);
+    stressReport(out, "edit_ops_per_sec", elapsed > 0 ? stressOps / (elapsed / 1e3) : 0);
+    stressReport(out, "edit_final_bytes", len);
 }
 
-/*** init ***/
-
 /**
- * Initializes the editor by setting the initial values for various editor properties.
+ * Times opening the large file and highlighting it in the background, then opening it
+ * again from the index cache, comparing the document with the file both times.
  *
- * @param None
+ * @param out The descriptor to report on.
+ * @param path The large file.
  * @return None
  */
-void initEditor()
+void stressOpen(int out, const char *path)
 {
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-
-    E.rowoff = 0;
-    E.coloff = 0;
-
-    E.numrows = 0;
-
-    E.row = NULL;
-
-    E.modified = 0;
+    initEditor();
+    editorResize(STRESS_ROWS, STRESS_COLS);
+    int bad = 0;
+    double mb = stressBytes / (double)(1 << 20);
+
+    double start = editorNow();
+    editorOpen((char *)path);
+    editorLoadFinish();
+    double open = editorNow() - start;
+    if ((size_t)E.buf->numrows != stressLines || !stressSameFile(path))
+        bad += stressMismatch("the opened file differs from the file", -1);
+
+    hlJobCancel();
+    E.buf->hlvalid = E.buf->hlstale = 0;
+    start = editorNow();
+    hlJobStart();
+    hlJobFinish();
+    double highlight = editorNow() - start;
+
+    start = editorNow();
+    editorIndexIdle();
+    double index = editorNow() - start;
+
+    start = editorNow();
+    editorOpen((char *)path);
+    editorLoadFinish();
+    double reopen = editorNow() - start;
+    int cached = E.buf->pt.nlmap != NULL;
+    if ((size_t)E.buf->numrows != stressLines || !stressSameFile(path))
+        bad += stressMismatch("the reopened file differs from the file", -1);
+
+    stressReport(out, "mismatches", bad);
+    stressReport(out, "open_mb_per_sec", open > 0 ? mb / (open / 1e3) : 0);
+    stressReport(out, "highlight_mb_per_sec", highlight > 0 ? mb / (highlight / 1e3) : 0);
+    stressReport(out, "index_write_ms", index);
+    stressReport(out, "reopen_ms", reopen);
+    stressReport(out, "reopen_cached", cached);
+}
 
-    E.filename = NULL;
+/**
+ * Times saving the large file after a change of one byte, which is written in place,
+ * and after an insert at its start, which rewrites it, comparing the file with the
+ * document after both.
+ *
+ * @param out The descriptor to report on.
+ * @param path The large file.
+ * @return None
+ */
+void stressSave(int out, const char *path)
+{
+    initEditor();
+    editorResize(STRESS_ROWS, STRESS_COLS);
+    editorOpen((char *)path);
+    editorLoadFinish();
+    int bad = 0;
+    double mb = stressBytes / (double)(1 << 20);
+
+    int at = E.buf->numrows / 2;
+    while (at < E.buf->numrows && editorRowAt(at)->size == 0)
+        at++;
+    if (at == E.buf->numrows)
+        at = 0;
+    editorBufferDelete(at, 0, 1);
+    editorBufferInsert(at, 0, "#", 1);
+    double start = editorNow();
+    editorSave();
+    editorSaveWait();
+    double inplace = editorNow() - start;
+    if (strncmp(E.statusmsg, "Can't", 5) == 0 || !stressSameFile(path))
+        bad += stressMismatch("the file saved in place differs from the document", -1);
+
+    editorBufferInsert(0, 0, "#", 1);
+    start = editorNow();
+    editorSave();
+    editorSaveWait();
+    double rewrite = editorNow() - start;
+    if (strncmp(E.statusmsg, "Can't", 5) == 0 || !stressSameFile(path))
+        bad += stressMismatch("the rewritten file differs from the document", -1);
+
+    stressReport(out, "mismatches", bad);
+    stressReport(out, "save_inplace_ms", inplace);
+    stressReport(out, "save_mb_per_sec", rewrite > 0 ? mb / (rewrite / 1e3) : 0);
+}
 
-    E.statusmsg[0] = '\0';
-    E.statusmsg_time = 0;
+/**
+ * Adds a number to the numbers of the run, adding it up with one of the same name.
+ *
+ * @param name The name of the number.
+ * @param value The value.
+ * @return None
+ */
+void stressAdd(const char *name, double value)
+{
+    for (int i = 0; i < stressNmetrics; i++)
+    {
+        if (strcmp(stressMetrics[i].name, name) == 0)
+        {
+            stressMetrics[i].value += value;
+            return;
+        }
+    }
+    if (stressNmetrics == STRESS_METRICS)
+        return;
+    struct stressMetric *mt = &stressMetrics[stressNmetrics++];
+    snprintf(mt->name, sizeof(mt->name), "%s", name);
+    mt->value = value;
+}
 
-    E.syntax = NULL;
+/**
+ * Runs a phase in a child process, so each starts from a fresh editor and has a peak
+ * resident set size of its own, and adds the numbers it reports to those of the run,
+ * with the peak as <name>_peak_rss_kb. A phase that dies counts as a mismatch.
+ *
+ * @param name The name of the phase.
+ * @param phase The phase.
+ * @param path The file it works on.
+ * @return None
+ */
+void stressPhase(const char *name, void (*phase)(int, const char *), const char *path)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+        die("pipe");
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1)
+        die("fork");
+    if (pid == 0)
+    {
+        close(fds[0]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        phase(fds[1], path);
+        exit(0);
+    }
+    close(fds[1]);
+
+    // the reports are short, the pipe holds them until the child is waited for
+    char buf[4096];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(buf) - 1 && (n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+        len += n;
+    buf[len] = '\0';
+    close(fds[0]);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        stressAdd("mismatches", stressMismatch("a phase died", -1));
+
+    for (char *line = strtok(buf, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        char key[32];
+        double value;
+        if (sscanf(line, "%31s %lf", key, &value) == 2)
+            stressAdd(key, value);
+    }
+    char key[32];
+    snprintf(key, sizeof(key), "%s_peak_rss_kb", name);
+    stressAdd(key, ru.ru_maxrss);
+}
 
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1)
-        die("getWindowSize");
+/**
+ * Returns which way a number of the report gets better: throughputs go up, times and
+ * sizes of memory go down, and the other numbers describe the run.
+ *
+ * @param name The name of the number.
+ * @return 1 if it gets better going up, -1 going down, 0 if it is not compared.
+ */
+int stressDirection(const char *name)
+{
+    size_t len = strlen(name);
+    if (len > 8 && strcmp(name + len - 8, "_per_sec") == 0)
+        return 1;
+    if (len > 3 && (strcmp(name + len - 3, "_ms") == 0 || strcmp(name + len - 3, "_kb") == 0))
+        return -1;
+    return 0;
+}
 
-    E.screenrows -= 2;
+/**
+ * Removes a directory and what it holds.
+ *
+ * @param path The directory.
+ * @return None
+ */
+void stressRemove(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir)
+    {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+            char child[PATH_MAX];
+            snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+            struct stat st;
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode))
+                stressRemove(child);
+            else
+                unlink(child);
+        }
+        closedir(dir);
+    }
+    rmdir(path);
 }
 
+/**
+ * Runs the random edits against the model on a synthetic file, then the open and save
+ * phases on a large one, and writes the numbers as JSON. Given a baseline report, a
+ * throughput lower, or a time or a peak of memory higher, than its baseline by more
+ * than the threshold counts as a regression. The caches of the editor go to a
+ * temporary directory, so every run starts from the same state.
+ *
+ * Usage: editor-stress [-n ops] [-s megabytes] [-r seed] [-t percent] [-o report] [-b baseline]
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on a mismatch or a regression.
+ */
 int main(int argc, char *argv[])
 {
-    enableRawMode();
-    initEditor();
-    if (argc >= 2)
+    double threshold = 25;
+    const char *report = NULL, *baseline = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+            stressOps = atol(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            stressBytes = (size_t)atol(argv[++i]) << 20;
+        else if (i + 1 < argc && strcmp(argv[i], "-r") == 0)
+            stressSeed = strtoull(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-t") == 0)
+            threshold = atof(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-o") == 0)
+            report = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "-b") == 0)
+            baseline = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n ops] [-s megabytes] [-r seed] [-t percent] [-o report] [-b baseline]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (stressOps < 1 || stressBytes == 0 || stressSeed == 0)
     {
-        editorOpen(argv[1]);
+        fprintf(stderr, "stress: the ops, the size and the seed must be positive\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t seed = stressSeed;
+
+    char cache[] = "/tmp/editor-stress-cache-XXXXXX";
+    if (mkdtemp(cache) == NULL)
+        die("mkdtemp");
+    setenv("XDG_CACHE_HOME", cache, 1);
+
+    char small[] = "/tmp/editor-stress-XXXXXX.c";
+    stressSynthetic(small, STRESS_EDIT_BYTES);
+    stressPhase("edit", stressEdit, small);
+    unlink(small);
+
+    char large[] = "/tmp/editor-stress-XXXXXX.c";
+    stressLines = stressSynthetic(large, stressBytes);
+    struct stat st;
+    if (stat(large, &st) == 0)
+        stressBytes = st.st_size;
+    stressPhase("open", stressOpen, large);
+    stressPhase("save", stressSave, large);
+    unlink(large);
+    stressRemove(cache);
+
+    char *base = NULL;
+    if (baseline)
+    {
+        FILE *fp = fopen(baseline, "r");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "stress: can't read %s: %s\n", baseline, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        size_t cap = 1 << 16, len = fread(base = malloc(cap), 1, cap - 1, fp);
+        base[len] = '\0';
+        fclose(fp);
     }
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = search");
-
-    while (1)
+    FILE *fp = report ? fopen(report, "w") : stdout;
+    if (fp == NULL)
+        die("fopen");
+    fprintf(fp, "{\n  \"seed\": %llu,\n  \"threshold\": %.1f,\n  \"metrics\": {\n", (unsigned long long)seed,
+            threshold);
+    int mismatches = 0, regressions = 0;
+    for (int i = 0; i < stressNmetrics; i++)
     {
-        editorRefreshScreen();
-        editorProcessKeypress();
+        struct stressMetric *mt = &stressMetrics[i];
+        fprintf(fp, "    \"%s\": %.3f%s\n", mt->name, mt->value, i + 1 < stressNmetrics ? "," : "");
+        if (strcmp(mt->name, "mismatches") == 0)
+            mismatches = mt->value;
+
+        char key[40];
+        snprintf(key, sizeof(key), "\"%.31s\":", mt->name);
+        char *found = base ? strstr(base, key) : NULL;
+        int dir = stressDirection(mt->name);
+        if (found == NULL || dir == 0)
+        {
+            fprintf(stderr, "%-24s %14.3f\n", mt->name, mt->value);
+            continue;
+        }
+        double was = strtod(found + strlen(key), NULL);
+        double change = was != 0 ? (mt->value - was) / was * 100 : 0;
+        int regressed = dir * change < -threshold;
+        regressions += regressed;
+        fprintf(stderr, "%-24s %14.3f  baseline %14.3f  %+7.1f%%%s\n", mt->name, mt->value, was, change,
+                regressed ? "  REGRESSED" : "");
     }
+    fprintf(fp, "  },\n  \"regressions\": %d,\n  \"pass\": %s\n}\n", regressions,
+            mismatches == 0 && regressions == 0 ? "true" : "false");
+    if (fp != stdout)
+        fclose(fp);
+    free(base);
 
-    return EXIT_SUCCESS;
+    return mismatches == 0 && regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+
+#endif